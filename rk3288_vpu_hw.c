@@ -7,8 +7,10 @@
  */
 
 #include <linux/clk.h>
+#include <media/videobuf2-dma-contig.h>
 
 #include "rockchip_vpu.h"
+#include "rockchip_vpu_trace.h"
 #include "rk3288_vpu_regs.h"
 
 #define RK3288_ACLK_MAX_FREQ (400 * 1000 * 1000)
@@ -32,6 +34,20 @@ static const struct rockchip_vpu_fmt rk3288_vpu_enc_fmts[] = {
 		.depth = { 8, 4 },
 		.enc_fmt = RK3288_VPU_ENC_FMT_YUV420SP,
 	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUV420,
+		.codec_mode = RK_VPU_MODE_NONE,
+		.num_planes = 1,
+		.depth = { 12 },
+		.enc_fmt = RK3288_VPU_ENC_FMT_YUV420P,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV12,
+		.codec_mode = RK_VPU_MODE_NONE,
+		.num_planes = 1,
+		.depth = { 12 },
+		.enc_fmt = RK3288_VPU_ENC_FMT_YUV420SP,
+	},
 	{
 		.fourcc = V4L2_PIX_FMT_YUYV,
 		.codec_mode = RK_VPU_MODE_NONE,
@@ -60,12 +76,38 @@ static const struct rockchip_vpu_fmt rk3288_vpu_enc_fmts[] = {
 			.step_height = MB_DIM,
 		},
 	},
+	{
+		.fourcc = V4L2_PIX_FMT_H264,
+		.codec_mode = RK_VPU_MODE_H264_ENC,
+		.num_planes = 1,
+		.max_depth = 2,
+		.frmsize = {
+			.min_width = 144,
+			.max_width = 1920,
+			.step_width = MB_DIM,
+			.min_height = 96,
+			.max_height = 1088,
+			.step_height = MB_DIM,
+		},
+	},
 };
 
 static const struct rockchip_vpu_fmt rk3288_vpu_dec_fmts[] = {
 	{
-		.name = "One slice of an H264 Encoded Stream (RK3288)",
-		.fourcc = V4L2_PIX_FMT_H264,
+		.fourcc = V4L2_PIX_FMT_NV12,
+		.codec_mode = RK_VPU_MODE_NONE,
+		.num_planes = 1,
+		.depth = { 12 },
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV16,
+		.codec_mode = RK_VPU_MODE_NONE,
+		.num_planes = 1,
+		.depth = { 16 },
+	},
+	{
+		.name = "One frame of an H264 Encoded Stream (RK3288)",
+		.fourcc = V4L2_PIX_FMT_H264_SLICE,
 		.codec_mode = RK_VPU_MODE_H264_DEC,
 		.num_planes = 1,
 		/* FIXME Provide the actual VPU sizes limits for H264 */
@@ -80,7 +122,7 @@ static const struct rockchip_vpu_fmt rk3288_vpu_dec_fmts[] = {
 	},
 	{
 		.name = "One frame of a VP8 Encoded Stream (RK3288)",
-		.fourcc = V4L2_PIX_FMT_VP8,
+		.fourcc = V4L2_PIX_FMT_VP8_FRAME,
 		.codec_mode = RK_VPU_MODE_VP8_DEC,
 		.num_planes = 1,
 		/* FIXME Provide the actual VPU sizes limits for VP8 */
@@ -93,6 +135,20 @@ static const struct rockchip_vpu_fmt rk3288_vpu_dec_fmts[] = {
 			.step_height = MB_DIM,
 		},
 	},
+	{
+		.name = "A baseline JPEG image (RK3288)",
+		.fourcc = V4L2_PIX_FMT_JPEG,
+		.codec_mode = RK_VPU_MODE_JPEG_DEC,
+		.num_planes = 1,
+		.frmsize = {
+			.min_width = 48,
+			.max_width = 8192,
+			.step_width = MB_DIM,
+			.min_height = 48,
+			.max_height = 8192,
+			.step_height = MB_DIM,
+		},
+	},
 };
 
 static irqreturn_t rk3288_vepu_irq(int irq, void *dev_id)
@@ -101,32 +157,40 @@ static irqreturn_t rk3288_vepu_irq(int irq, void *dev_id)
 	u32 status = vepu_read(vpu, VEPU_REG_INTERRUPT);
 	u32 bytesused =	vepu_read(vpu, VEPU_REG_STR_BUF_LIMIT) / 8;
 
+	trace_rockchip_vpu_irq(rockchip_vpu_watchdog_ctx(&vpu->enc_watchdog),
+			       status);
 	vepu_write(vpu, 0, VEPU_REG_INTERRUPT);
 	vepu_write(vpu, 0, VEPU_REG_AXI_CTRL);
 
-	rockchip_vpu_irq_done(vpu,
+	return rockchip_vpu_enc_irq_done(vpu,
 		bytesused,
 		status & VEPU_REG_INTERRUPT_FRAME_RDY ?
 		VB2_BUF_STATE_DONE :
 		VB2_BUF_STATE_ERROR);
-	return IRQ_HANDLED;
 }
 
 static irqreturn_t rk3288_vdpu_irq(int irq, void *dev_id)
 {
 	struct rockchip_vpu_dev *vpu = dev_id;
-	printk(KERN_INFO "Handled IRQ %d", irq);
+	u32 status = vdpu_read(vpu, VDPU_REG_INTERRUPT);
 
+	trace_rockchip_vpu_irq(rockchip_vpu_watchdog_ctx(&vpu->dec_watchdog),
+			       status);
 	vdpu_write(vpu, 0, VDPU_REG_INTERRUPT);
-	return IRQ_HANDLED;
+	vdpu_write(vpu, 0, VDPU_REG_CONFIG);
+
+	return rockchip_vpu_dec_irq_done(vpu, 0,
+		status & VDPU_REG_INTERRUPT_DEC_RDY_INT ?
+		VB2_BUF_STATE_DONE :
+		VB2_BUF_STATE_ERROR);
 }
 
 static int rk3288_vpu_hw_init(struct rockchip_vpu_dev *vpu)
 {
-	/* TODO : ??? The clocks are prepared after setting the
-	 * rate ? Shouldn't we do this before ? */
-	/* Bump ACLK to max. possible freq. to improve performance. */
-	clk_set_rate(vpu->clocks[0].clk, RK3288_ACLK_MAX_FREQ);
+	/*
+	 * ACLK is scaled from RK3288_ACLK_MAX_FREQ down by
+	 * rockchip_vpu_devfreq_init(), once the driver is registered.
+	 */
 	return 0;
 }
 
@@ -139,16 +203,43 @@ static void rk3288_vpu_enc_reset(struct rockchip_vpu_ctx *ctx)
 	vepu_write(vpu, 0, VEPU_REG_AXI_CTRL);
 }
 
-static void rk3288_vpu_dec_reset(struct rockchip_vpu_ctx *ctx)
+/* Number of macroblocks processed by the running encoding job. */
+static u32 rk3288_vpu_enc_progress(struct rockchip_vpu_ctx *ctx)
 {
-	struct rockchip_vpu_dev *vpu = ctx->dev;
+	return VEPU_REG_MB_CNT_OUT(vepu_read(ctx->dev, VEPU_REG_MB_CTRL));
+}
 
-	vdpu_write(vpu, VDPU_REG_INTERRUPT_DEC_IRQ_DIS, VDPU_REG_INTERRUPT);
+/*
+ * Buffer registers of every encoder: the source planes, and the whole
+ * capture buffer. The H.264 and VP8 encoders move the output stream
+ * past their headers when starting a job.
+ */
+static void rk3288_vpu_enc_prepare_buf(struct rockchip_vpu_ctx *ctx,
+				       struct vb2_buffer *vb)
+{
+	struct rockchip_vpu_buf *buf = rockchip_vpu_get_buf(vb);
+	dma_addr_t src[3];
+
+	if (!V4L2_TYPE_IS_OUTPUT(vb->vb2_queue->type)) {
+		rockchip_vpu_buf_reg(buf, VEPU_REG_ADDR_OUTPUT_STREAM,
+				     vb2_dma_contig_plane_dma_addr(vb, 0));
+		rockchip_vpu_buf_reg(buf, VEPU_REG_STR_BUF_LIMIT,
+				     vb2_plane_size(vb, 0));
+		return;
+	}
+
+	rockchip_vpu_enc_src_addrs(ctx, vb, src);
+
+	rockchip_vpu_buf_reg(buf, VEPU_REG_ADDR_IN_LUMA, src[PLANE_Y]);
+	rockchip_vpu_buf_reg(buf, VEPU_REG_ADDR_IN_CR, src[PLANE_CR]);
+	rockchip_vpu_buf_reg(buf, VEPU_REG_ADDR_IN_CB, src[PLANE_CB]);
 }
 
-/* FIXME Implement the VP8 decoder. */
-void rk3288_vpu_vp8_dec_run(struct rockchip_vpu_ctx *ctx)
+static void rk3288_vpu_dec_reset(struct rockchip_vpu_ctx *ctx)
 {
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+
+	vdpu_write(vpu, VDPU_REG_INTERRUPT_DEC_IRQ_DIS, VDPU_REG_INTERRUPT);
 }
 
 /*
@@ -157,16 +248,38 @@ void rk3288_vpu_vp8_dec_run(struct rockchip_vpu_ctx *ctx)
 static const struct rockchip_vpu_codec_ops rk3288_vpu_codec_ops[] = {
 	[RK_VPU_MODE_JPEG_ENC] = {
 		.run = rk3288_vpu_jpeg_enc_run,
+		.prepare = rk3288_vpu_jpeg_enc_prepare,
+		.prepare_buf = rk3288_vpu_enc_prepare_buf,
 		.reset = rk3288_vpu_enc_reset,
+		.progress = rk3288_vpu_enc_progress,
 	},
 	[RK_VPU_MODE_H264_DEC] = {
+		.init = rockchip_vpu_h264_dec_init,
 		.run = rk3288_vpu_h264_dec_run,
 		.reset = rk3288_vpu_dec_reset,
 	},
 	[RK_VPU_MODE_VP8_DEC] = {
+		.init = rockchip_vpu_vp8_dec_init,
+		.exit = rockchip_vpu_vp8_dec_exit,
 		.run = rk3288_vpu_vp8_dec_run,
 		.reset = rk3288_vpu_dec_reset,
 	},
+	[RK_VPU_MODE_H264_ENC] = {
+		.init = rockchip_vpu_h264_enc_init,
+		.exit = rockchip_vpu_h264_enc_exit,
+		.run = rk3288_vpu_h264_enc_run,
+		.done = rockchip_vpu_h264_enc_done,
+		.prepare = rk3288_vpu_h264_enc_prepare,
+		.prepare_buf = rk3288_vpu_enc_prepare_buf,
+		.reset = rk3288_vpu_enc_reset,
+		.progress = rk3288_vpu_enc_progress,
+	},
+	[RK_VPU_MODE_JPEG_DEC] = {
+		.init = rockchip_vpu_jpeg_dec_init,
+		.exit = rockchip_vpu_jpeg_dec_exit,
+		.run = rk3288_vpu_jpeg_dec_run,
+		.reset = rk3288_vpu_dec_reset,
+	},
 };
 
 /*
@@ -181,10 +294,13 @@ const struct rockchip_vpu_variant rk3288_vpu_variant = {
 	.dec_fmts = rk3288_vpu_dec_fmts,
 	.num_dec_fmts = ARRAY_SIZE(rk3288_vpu_dec_fmts),
 	.codec_ops = rk3288_vpu_codec_ops,
-	.codec = RK_VPU_CODEC_JPEG,
+	.codec = RK_VPU_CODEC_JPEG | RK_VPU_CODEC_H264_DEC |
+		 RK_VPU_CODEC_VP8_DEC | RK_VPU_CODEC_H264_ENC |
+		 RK_VPU_CODEC_JPEG_DEC,
 	.vepu_irq = rk3288_vepu_irq,
 	.vdpu_irq = rk3288_vdpu_irq,
 	.init = rk3288_vpu_hw_init,
 	.clk_names = {"aclk", "hclk"},
-	.num_clocks = 2
+	.num_clocks = 2,
+	.aclk_max_freq = RK3288_ACLK_MAX_FREQ,
 };
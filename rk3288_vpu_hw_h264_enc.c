@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * H.264 encoding on the RK3288 VEPU.
+ *
+ * The hardware writes a single slice per frame, after the parameter
+ * sets written by rockchip_vpu_h264_enc.c on IDR frames.
+ */
+
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+#include "rockchip_vpu_hw.h"
+#include "rockchip_vpu_trace.h"
+#include "rk3288_vpu_regs.h"
+
+#define VEPU_DMV_PENALTY_REGS		32
+
+static void rk3288_vpu_h264e_set_dmv_penalty(struct rockchip_vpu_ctx *ctx,
+					     u32 mv_penalty)
+{
+	unsigned int i, j;
+	u32 pel, qpel, bits;
+
+	/*
+	 * Penalty of each motion vector difference, in full pixels for the
+	 * first table and in quarter pixels for the second one.
+	 */
+	for (i = 0; i < VEPU_DMV_PENALTY_REGS; i++) {
+		pel = 0;
+		qpel = 0;
+		for (j = 0; j < 4; j++) {
+			bits = rockchip_vpu_h264_enc_mvd_bits(4 * (i * 4 + j));
+			pel |= VEPU_REG_DMV_4P_1P_PENALTY_BIT(
+					min_t(u32, bits * mv_penalty, 255), j);
+			bits = rockchip_vpu_h264_enc_mvd_bits(i * 4 + j);
+			qpel |= VEPU_REG_DMV_QPEL_PENALTY_BIT(
+					min_t(u32, bits * mv_penalty, 255), j);
+		}
+		rockchip_vpu_ctx_reg(ctx, VEPU_REG_DMV_4P_1P_PENALTY(i), pel);
+		rockchip_vpu_ctx_reg(ctx, VEPU_REG_DMV_QPEL_PENALTY(i), qpel);
+	}
+}
+
+/*
+ * Build the register image of the context. The frame type, QP,
+ * frame_num and reference frames change with every frame and are
+ * written by rk3288_vpu_h264_enc_run().
+ */
+void rk3288_vpu_h264_enc_prepare(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	struct rockchip_vpu_h264_enc_penalties p;
+	u32 reg;
+
+	rockchip_vpu_h264_enc_prepare(ctx);
+	rockchip_vpu_h264_enc_penalties(h264_enc->qp_p, &p);
+
+	/* Switch to H.264 encoder mode before writing registers */
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENC_CTRL,
+			     VEPU_REG_ENC_CTRL_ENC_MODE_H264);
+
+	reg = VEPU_REG_IN_IMG_CTRL_ROW_LEN(rockchip_vpu_enc_row_len(ctx))
+		| VEPU_REG_IN_IMG_CTRL_OVRFLR_D4(
+				rockchip_vpu_enc_overfill_right(ctx))
+		| VEPU_REG_IN_IMG_CTRL_OVRFLB_D4(
+				rockchip_vpu_enc_overfill_bottom(ctx))
+		| VEPU_REG_IN_IMG_CTRL_FMT(ctx->vpu_src_fmt->enc_fmt);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_IN_IMG_CTRL, reg);
+
+	reg = VEPU_REG_AXI_CTRL_OUTPUT_SWAP16
+		| VEPU_REG_AXI_CTRL_INPUT_SWAP16
+		| VEPU_REG_AXI_CTRL_BURST_LEN(16)
+		| VEPU_REG_AXI_CTRL_OUTPUT_SWAP32
+		| VEPU_REG_AXI_CTRL_INPUT_SWAP32
+		| VEPU_REG_AXI_CTRL_OUTPUT_SWAP8
+		| VEPU_REG_AXI_CTRL_INPUT_SWAP8;
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_AXI_CTRL, reg);
+
+	/* Byte stream, with start codes, and a single slice. */
+	reg = VEPU_REG_ENC_CTRL2_INTRA16X16_MODE(p.intra16_favor);
+	if (h264_enc->cabac)
+		reg |= VEPU_REG_ENC_CTRL2_ENTROPY_CODING_MODE
+		     | VEPU_REG_ENC_CTRL2_CABAC_INIT_IDC(0);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENC_CTRL2, reg);
+
+	reg = VEPU_REG_ENC_CTRL3_MUTIMV_EN
+		| VEPU_REG_ENC_CTRL3_MV_PENALTY_1_4P(p.mv)
+		| VEPU_REG_ENC_CTRL3_MV_PENALTY_4P(p.mv)
+		| VEPU_REG_ENC_CTRL3_MV_PENALTY_1P(p.mv);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENC_CTRL3, reg);
+
+	reg = VEPU_REG_ENC_CTRL4_MV_PENALTY_16X8_8X16(p.split_16x8)
+		| VEPU_REG_ENC_CTRL4_MV_PENALTY_8X8(p.split_8x8)
+		| VEPU_REG_ENC_CTRL4_8X4_4X8(p.split_4x4);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENC_CTRL4, reg);
+
+	reg = VEPU_REG_ENC_CTRL5_MACROBLOCK_PENALTY(p.skip)
+		| VEPU_REG_ENC_CTRL5_INTER_MODE(p.inter_favor);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENC_CTRL5, reg);
+
+	/* Plain AVC, no MVC extension. */
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_MVC_CTRL, 0);
+
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ADDR_CABAC_TBL,
+			     ctx->dev->h264_enc_cabac.dma);
+	rk3288_vpu_h264e_set_dmv_penalty(ctx, p.mv);
+
+	ctx->start_reg = VEPU_REG_ENC_CTRL_WIDTH(MB_WIDTH(ctx->src_fmt.width))
+		| VEPU_REG_ENC_CTRL_HEIGHT(MB_HEIGHT(ctx->src_fmt.height))
+		| VEPU_REG_ENC_CTRL_ENC_MODE_H264
+		| VEPU_REG_ENC_CTRL_EN_BIT;
+}
+
+static void rk3288_vpu_h264e_set_frame(struct rockchip_vpu_ctx *ctx)
+{
+	const struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	const struct rockchip_vpu_aux_buf *ref, *rec;
+	struct rockchip_vpu_h264_enc_penalties p;
+	struct vb2_buffer *dst_buf;
+	unsigned int luma_size;
+	dma_addr_t dst_dma;
+	u32 qp, reg;
+
+	rockchip_vpu_h264_enc_penalties(h264_enc->qp_p, &p);
+	qp = h264_enc->idr ? h264_enc->qp_i : h264_enc->qp_p;
+
+	reg = VEPU_REG_ENC_CTRL0_INIT_QP(h264_enc->qp_i)
+		| VEPU_REG_ENC_CTRL0_IDR_PICID(h264_enc->idr_pic_id);
+	vepu_write_relaxed(vpu, reg, VEPU_REG_ENC_CTRL0);
+
+	reg = VEPU_REG_ENC_CTRL1_PPS_ID(0)
+		| VEPU_REG_ENC_CTRL1_INTRA_PRED_MODE(p.prev_mode_favor)
+		| VEPU_REG_ENC_CTRL1_FRAME_NUM(h264_enc->frame_num & 0xffff);
+	vepu_write_relaxed(vpu, reg, VEPU_REG_ENC_CTRL1);
+
+	reg = VEPU_REG_QP_VAL_LUM(qp)
+		| VEPU_REG_QP_VAL_MAX(51)
+		| VEPU_REG_QP_VAL_MIN(0)
+		| VEPU_REG_QP_VAL_CHECKPOINT_DISTAN(0);
+	vepu_write_relaxed(vpu, reg, VEPU_REG_QP_VAL);
+
+	/* NV12, chroma right after the luma. */
+	luma_size = rockchip_vpu_rounded_luma_size(ctx->src_fmt.width,
+						   ctx->src_fmt.height);
+	ref = &h264_enc->rec[h264_enc->ref];
+	rec = &h264_enc->rec[h264_enc->ref ^ 1];
+	vepu_write_relaxed(vpu, ref->dma, VEPU_REG_ADDR_REF_LUMA);
+	vepu_write_relaxed(vpu, ref->dma + luma_size, VEPU_REG_ADDR_REF_CHROMA);
+	vepu_write_relaxed(vpu, rec->dma, VEPU_REG_ADDR_REC_LUMA);
+	vepu_write_relaxed(vpu, rec->dma + luma_size, VEPU_REG_ADDR_REC_CHROMA);
+
+	/* The slice goes after the parameter sets. */
+	if (h264_enc->stream_offset) {
+		dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+		dst_dma = vb2_dma_contig_plane_dma_addr(dst_buf, 0);
+		vepu_write_relaxed(vpu, dst_dma + h264_enc->stream_offset,
+				   VEPU_REG_ADDR_OUTPUT_STREAM);
+		vepu_write_relaxed(vpu, vb2_plane_size(dst_buf, 0) -
+				   h264_enc->stream_offset,
+				   VEPU_REG_STR_BUF_LIMIT);
+	}
+}
+
+void rk3288_vpu_h264_enc_run(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct vb2_buffer *src_buf, *dst_buf;
+	u32 pic_type;
+
+	if (rockchip_vpu_h264_enc_prepare_run(ctx)) {
+		rockchip_vpu_watchdog_fail(&vpu->enc_watchdog, ctx);
+		return;
+	}
+
+	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+
+	vepu_write_regs(vpu, ctx->regs, ctx->num_regs);
+	vepu_write_buf_regs(vpu, rockchip_vpu_get_buf(src_buf));
+	vepu_write_buf_regs(vpu, rockchip_vpu_get_buf(dst_buf));
+	rk3288_vpu_h264e_set_frame(ctx);
+
+	/* Make sure that all registers are written at this point. */
+	wmb();
+
+	/* Kick the watchdog and start encoding */
+	rockchip_vpu_watchdog_arm(&vpu->enc_watchdog, ctx,
+				  MB_WIDTH(ctx->src_fmt.width) *
+				  MB_HEIGHT(ctx->src_fmt.height));
+	pic_type = ctx->h264_enc.idr ? VEPU_REG_ENC_PIC_INTRA :
+				       VEPU_REG_ENC_PIC_INTER;
+	vepu_write(vpu, ctx->start_reg | pic_type, VEPU_REG_ENC_CTRL);
+	trace_rockchip_vpu_kick(ctx);
+}
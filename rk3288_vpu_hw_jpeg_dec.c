@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * Baseline JPEG decoding on the RK3288 VDPU.
+ *
+ * In JPEG mode, the registers holding the reference frame addresses in
+ * the other modes give the number of Huffman codes of each length, and
+ * the first of them the address of the chroma plane.
+ */
+
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+#include "rockchip_vpu_hw.h"
+#include "rockchip_vpu_trace.h"
+#include "rk3288_vpu_regs.h"
+
+/* The hardware reads the bitstream from 64-bit aligned addresses. */
+#define RK3288_VPU_JPEG_ALIGN_MASK	0x07U
+
+#define RK3288_VPU_JPEG_DEC_MODE	3
+
+/* Chroma subsampling, as numbered by the JPEG_MODE field. */
+#define RK3288_VPU_JPEG_MODE_420	2
+#define RK3288_VPU_JPEG_MODE_422	3
+
+#define VDPU_REG_JPEG_CH_OUT		VDPU_REG_ADDR_REF(0)
+/* Counts of DC codes, 4 bits each, 8 lengths per register. */
+#define VDPU_REG_JPEG_DC_CNT(t, len)	VDPU_REG_ADDR_REF(9 + 2 * (t) + \
+							  ((len) - 1) / 8)
+#define VDPU_JPEG_DC_CNT_SHIFT(len)	(4 * (((len) - 1) % 8))
+
+struct rk3288_vpu_jpegd_field {
+	u32 reg;
+	u8 shift;
+};
+
+/*
+ * Counts of AC codes. Fewer than 2^n codes have n bits, so the fields of
+ * the short lengths are narrower, down to 2 bits for 1-bit codes.
+ */
+static const struct rk3288_vpu_jpegd_field rk3288_jpegd_ac_cnt[2][16] = {
+	{
+		{ VDPU_REG_ADDR_REF(2), 0 },
+		{ VDPU_REG_ADDR_REF(2), 3 },
+		{ VDPU_REG_ADDR_REF(2), 7 },
+		{ VDPU_REG_ADDR_REF(2), 11 },
+		{ VDPU_REG_ADDR_REF(2), 16 },
+		{ VDPU_REG_ADDR_REF(2), 24 },
+		{ VDPU_REG_ADDR_REF(3), 0 },
+		{ VDPU_REG_ADDR_REF(3), 8 },
+		{ VDPU_REG_ADDR_REF(3), 16 },
+		{ VDPU_REG_ADDR_REF(3), 24 },
+		{ VDPU_REG_ADDR_REF(4), 0 },
+		{ VDPU_REG_ADDR_REF(4), 8 },
+		{ VDPU_REG_ADDR_REF(4), 16 },
+		{ VDPU_REG_ADDR_REF(4), 24 },
+		{ VDPU_REG_ADDR_REF(5), 16 },
+		{ VDPU_REG_ADDR_REF(5), 24 },
+	},
+	{
+		{ VDPU_REG_ADDR_REF(5), 0 },
+		{ VDPU_REG_ADDR_REF(5), 3 },
+		{ VDPU_REG_ADDR_REF(5), 7 },
+		{ VDPU_REG_ADDR_REF(5), 11 },
+		{ VDPU_REG_ADDR_REF(6), 0 },
+		{ VDPU_REG_ADDR_REF(6), 8 },
+		{ VDPU_REG_ADDR_REF(6), 16 },
+		{ VDPU_REG_ADDR_REF(6), 24 },
+		{ VDPU_REG_ADDR_REF(7), 0 },
+		{ VDPU_REG_ADDR_REF(7), 8 },
+		{ VDPU_REG_ADDR_REF(7), 16 },
+		{ VDPU_REG_ADDR_REF(7), 24 },
+		{ VDPU_REG_ADDR_REF(8), 0 },
+		{ VDPU_REG_ADDR_REF(8), 8 },
+		{ VDPU_REG_ADDR_REF(8), 16 },
+		{ VDPU_REG_ADDR_REF(8), 24 },
+	},
+};
+
+/* The counts of both classes fill VDPU_REG_ADDR_REF(2) to (12). */
+#define RK3288_VPU_JPEG_CNT_REGS	11
+#define RK3288_VPU_JPEG_CNT_IDX(reg)	(((reg) - VDPU_REG_ADDR_REF(2)) / 4)
+
+static void rk3288_vpu_jpegd_set_cnt(struct rockchip_vpu_ctx *ctx)
+{
+	const struct rockchip_vpu_jpeg_dec_hdr *hdr = &ctx->jpeg_dec.hdr;
+	const struct rk3288_vpu_jpegd_field *field;
+	u32 cnt[RK3288_VPU_JPEG_CNT_REGS] = { };
+	unsigned int t, len, i;
+	u32 mask, reg;
+
+	for (t = 0; t < RK_VPU_JPEG_DEC_NUM_HUFF; t++) {
+		for (len = 1; len <= 16; len++) {
+			field = &rk3288_jpegd_ac_cnt[t][len - 1];
+			mask = GENMASK(min(len, 7U), 0);
+			i = RK3288_VPU_JPEG_CNT_IDX(field->reg);
+			cnt[i] |= (hdr->ac[t].bits[len - 1] & mask) <<
+				  field->shift;
+
+			reg = VDPU_REG_JPEG_DC_CNT(t, len);
+			i = RK3288_VPU_JPEG_CNT_IDX(reg);
+			cnt[i] |= (hdr->dc[t].bits[len - 1] & 0xf) <<
+				  VDPU_JPEG_DC_CNT_SHIFT(len);
+		}
+	}
+
+	for (i = 0; i < RK3288_VPU_JPEG_CNT_REGS; i++)
+		vdpu_write_relaxed(ctx->dev, cnt[i], VDPU_REG_ADDR_REF(2 + i));
+}
+
+void rk3288_vpu_jpeg_dec_run(struct rockchip_vpu_ctx *ctx)
+{
+	const struct rockchip_vpu_jpeg_dec_hdr *hdr = &ctx->jpeg_dec.hdr;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct vb2_buffer *src_buf, *dst_buf;
+	unsigned int mb_width, mb_height;
+	dma_addr_t src_dma, dst_dma;
+	u32 offset, reg;
+
+	if (rockchip_vpu_jpeg_dec_prepare_run(ctx)) {
+		rockchip_vpu_run_done(ctx);
+		rockchip_vpu_watchdog_fail(&vpu->dec_watchdog, ctx);
+		return;
+	}
+
+	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+	src_dma = vb2_dma_contig_plane_dma_addr(src_buf, 0);
+	dst_dma = vb2_dma_contig_plane_dma_addr(dst_buf, 0);
+
+	reg = VDPU_REG_DEC_CTRL0_DEC_MODE(RK3288_VPU_JPEG_DEC_MODE);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_DEC_CTRL0);
+
+	mb_width = MB_WIDTH(hdr->width);
+	mb_height = MB_HEIGHT(hdr->height);
+	reg = VDPU_REG_DEC_CTRL1_PIC_MB_WIDTH(mb_width)
+		| VDPU_REG_DEC_CTRL1_PIC_MB_HEIGHT_P(mb_height)
+		| VDPU_REG_DEC_CTRL1_PIC_MB_W_EXT(mb_width >> 9)
+		| VDPU_REG_DEC_CTRL1_PIC_MB_H_EXT(mb_height >> 8);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_DEC_CTRL1);
+
+	/* Entropy-coded data, from the 64-bit word holding its first bit. */
+	offset = hdr->scan_offset;
+	reg = VDPU_REG_DEC_CTRL2_STRM_START_BIT(
+			(offset & RK3288_VPU_JPEG_ALIGN_MASK) * 8)
+		| VDPU_REG_DEC_CTRL2_JPEG_QTABLES(RK_VPU_JPEG_DEC_NUM_COMPS)
+		| VDPU_REG_DEC_CTRL2_JPEG_STREAM_ALL;
+	if (hdr->v_samp == 2)
+		reg |= VDPU_REG_DEC_CTRL2_JPEG_MODE(RK3288_VPU_JPEG_MODE_420);
+	else
+		reg |= VDPU_REG_DEC_CTRL2_JPEG_MODE(RK3288_VPU_JPEG_MODE_422);
+	if (hdr->restart_interval)
+		reg |= VDPU_REG_DEC_CTRL2_SYNC_MARKER_E;
+	if (hdr->ac_sel[1])
+		reg |= VDPU_REG_DEC_CTRL2_CB_AC_VLCTABLE;
+	if (hdr->ac_sel[2])
+		reg |= VDPU_REG_DEC_CTRL2_CR_AC_VLCTABLE;
+	if (hdr->dc_sel[1])
+		reg |= VDPU_REG_DEC_CTRL2_CB_DC_VLCTABLE;
+	if (hdr->dc_sel[2])
+		reg |= VDPU_REG_DEC_CTRL2_CR_DC_VLCTABLE;
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_DEC_CTRL2);
+
+	reg = vb2_get_plane_payload(src_buf, 0) -
+	      (offset & ~RK3288_VPU_JPEG_ALIGN_MASK);
+	vdpu_write_relaxed(vpu, VDPU_REG_DEC_CTRL3_STREAM_LEN(reg),
+			   VDPU_REG_DEC_CTRL3);
+
+	/* 4:2:2 images may end with half a macroblock row. */
+	reg = 0;
+	if (hdr->v_samp == 1 && DIV_ROUND_UP(hdr->height, 8) & 1)
+		reg |= VDPU_REG_DEC_CTRL4_PJPEG_FILDOWN_E;
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_DEC_CTRL4);
+
+	vdpu_write_relaxed(vpu,
+			   VDPU_REG_DEC_CTRL5_PJPEG_REST_FREQ(
+				hdr->restart_interval),
+			   VDPU_REG_DEC_CTRL5);
+
+	rk3288_vpu_jpegd_set_cnt(ctx);
+
+	vdpu_write_relaxed(vpu, src_dma +
+			   (offset & ~RK3288_VPU_JPEG_ALIGN_MASK),
+			   VDPU_REG_ADDR_STR);
+	vdpu_write_relaxed(vpu, ctx->jpeg_dec.tbl.dma, VDPU_REG_ADDR_QTABLE);
+
+	/* NV12 or NV16, chroma right after the luma. */
+	vdpu_write_relaxed(vpu, dst_dma, VDPU_REG_ADDR_DST);
+	vdpu_write_relaxed(vpu, dst_dma +
+			   rockchip_vpu_rounded_luma_size(ctx->dst_fmt.width,
+							  ctx->dst_fmt.height),
+			   VDPU_REG_JPEG_CH_OUT);
+
+	rockchip_vpu_run_done(ctx);
+
+	rockchip_vpu_watchdog_arm(&vpu->dec_watchdog, ctx,
+				  mb_width * mb_height);
+
+	/* Start decoding! */
+	vdpu_write_relaxed(vpu, VDPU_REG_CONFIG_DEC_AXI_RD_ID(0xffu)
+				| VDPU_REG_CONFIG_DEC_TIMEOUT_E
+				| VDPU_REG_CONFIG_DEC_IN_ENDIAN
+				| VDPU_REG_CONFIG_DEC_OUT_ENDIAN
+				| VDPU_REG_CONFIG_DEC_STRENDIAN_E
+				| VDPU_REG_CONFIG_DEC_MAX_BURST(16)
+				| VDPU_REG_CONFIG_DEC_OUTSWAP32_E
+				| VDPU_REG_CONFIG_DEC_INSWAP32_E
+				| VDPU_REG_CONFIG_DEC_STRSWAP32_E
+				| VDPU_REG_CONFIG_DEC_CLK_GATE_E,
+				VDPU_REG_CONFIG);
+	vdpu_write(vpu, VDPU_REG_INTERRUPT_DEC_E, VDPU_REG_INTERRUPT);
+	trace_rockchip_vpu_kick(ctx);
+}
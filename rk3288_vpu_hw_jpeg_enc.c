@@ -10,60 +10,25 @@
 #include "rockchip_vpu.h"
 #include "rockchip_vpu_common.h"
 #include "rockchip_vpu_hw.h"
+#include "rockchip_vpu_trace.h"
 #include "rk3288_vpu_regs.h"
 
 #define VEPU_JPEG_QUANT_TABLE_COUNT 16
 
-static void rk3288_vpu_set_src_img_ctrl(struct rockchip_vpu_dev *vpu,
-					struct rockchip_vpu_ctx *ctx)
+static void rk3288_vpu_set_src_img_ctrl(struct rockchip_vpu_ctx *ctx)
 {
-	struct v4l2_pix_format_mplane *pix_fmt = &ctx->src_fmt;
 	u32 reg;
 
-	reg = VEPU_REG_IN_IMG_CTRL_ROW_LEN(pix_fmt->width)
-		| VEPU_REG_IN_IMG_CTRL_OVRFLR_D4(0)
-		| VEPU_REG_IN_IMG_CTRL_OVRFLB_D4(0)
+	reg = VEPU_REG_IN_IMG_CTRL_ROW_LEN(rockchip_vpu_enc_row_len(ctx))
+		| VEPU_REG_IN_IMG_CTRL_OVRFLR_D4(
+				rockchip_vpu_enc_overfill_right(ctx))
+		| VEPU_REG_IN_IMG_CTRL_OVRFLB_D4(
+				rockchip_vpu_enc_overfill_bottom(ctx))
 		| VEPU_REG_IN_IMG_CTRL_FMT(ctx->vpu_src_fmt->enc_fmt);
-	vepu_write_relaxed(vpu, reg, VEPU_REG_IN_IMG_CTRL);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_IN_IMG_CTRL, reg);
 }
 
-static void rk3288_vpu_jpeg_enc_set_buffers(struct rockchip_vpu_dev *vpu,
-					 struct rockchip_vpu_ctx *ctx,
-					 struct vb2_buffer *src_buf,
-					 struct vb2_buffer *dst_buf)
-{
-	struct v4l2_pix_format_mplane *pix_fmt = &ctx->src_fmt;
-	dma_addr_t dst, src[3];
-	u32 dst_size;
-
-	WARN_ON(pix_fmt->num_planes > 3);
-
-	dst = vb2_dma_contig_plane_dma_addr(dst_buf, 0);
-	dst_size = vb2_plane_size(dst_buf, 0);
-
-	vepu_write_relaxed(vpu, dst, VEPU_REG_ADDR_OUTPUT_STREAM);
-	vepu_write_relaxed(vpu, dst_size, VEPU_REG_STR_BUF_LIMIT);
-
-	if (pix_fmt->num_planes == 1) {
-		src[0] = vb2_dma_contig_plane_dma_addr(src_buf, 0);
-		/* single plane formats we supported are all interlaced */
-		src[1] = src[2] = src[0];
-	} else if (pix_fmt->num_planes == 2) {
-		src[PLANE_Y] = vb2_dma_contig_plane_dma_addr(src_buf, PLANE_Y);
-		src[PLANE_CB] = vb2_dma_contig_plane_dma_addr(src_buf, PLANE_CB);
-		src[PLANE_CR] = src[PLANE_CB];
-	} else {
-		src[PLANE_Y] = vb2_dma_contig_plane_dma_addr(src_buf, PLANE_Y);
-		src[PLANE_CB] = vb2_dma_contig_plane_dma_addr(src_buf, PLANE_CB);
-		src[PLANE_CR] = vb2_dma_contig_plane_dma_addr(src_buf, PLANE_CR);
-	}
-
-	vepu_write_relaxed(vpu, src[PLANE_Y], VEPU_REG_ADDR_IN_LUMA);
-	vepu_write_relaxed(vpu, src[PLANE_CR], VEPU_REG_ADDR_IN_CR);
-	vepu_write_relaxed(vpu, src[PLANE_CB], VEPU_REG_ADDR_IN_CB);
-}
-
-static void rk3288_vpu_jpeg_enc_set_qtable(struct rockchip_vpu_dev *vpu,
+static void rk3288_vpu_jpeg_enc_set_qtable(struct rockchip_vpu_ctx *ctx,
 		const struct v4l2_ctrl_jpeg_quantization *qtable)
 {
 	const __u16 *chroma_coef;
@@ -80,34 +45,29 @@ static void rk3288_vpu_jpeg_enc_set_qtable(struct rockchip_vpu_dev *vpu,
 				 luma_coef[i*4 + 2], luma_coef[i*4 + 3]);
 		chroma = RK_QUANT_ROW(chroma_coef[i*4], chroma_coef[i*4 + 1],
 				   chroma_coef[i*4 + 2], chroma_coef[i*4 + 3]);
-		vepu_write_relaxed(vpu, luma, VEPU_REG_JPEG_LUMA_QUAT(i));
-		vepu_write_relaxed(vpu, chroma, VEPU_REG_JPEG_CHROMA_QUAT(i));
+		rockchip_vpu_ctx_reg(ctx, VEPU_REG_JPEG_LUMA_QUAT(i), luma);
+		rockchip_vpu_ctx_reg(ctx, VEPU_REG_JPEG_CHROMA_QUAT(i), chroma);
 	}
 }
 
-void rk3288_vpu_jpeg_enc_run(struct rockchip_vpu_ctx *ctx)
+/*
+ * Build the register image of the context. Everything but the buffer
+ * addresses only depends on the formats and on the quantization tables.
+ */
+void rk3288_vpu_jpeg_enc_prepare(struct rockchip_vpu_ctx *ctx)
 {
 	const struct v4l2_ctrl_jpeg_quantization *qtable;
-	struct rockchip_vpu_dev *vpu = ctx->dev;
-	struct vb2_buffer *src_buf, *dst_buf;
 	u32 reg;
 
-	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
-	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
-
 	/* Switch to JPEG encoder mode before writing registers */
-	vepu_write_relaxed(vpu, VEPU_REG_ENC_CTRL_ENC_MODE_JPEG,
-			   VEPU_REG_ENC_CTRL);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENC_CTRL,
+			     VEPU_REG_ENC_CTRL_ENC_MODE_JPEG);
 
-	rk3288_vpu_set_src_img_ctrl(vpu, ctx);
-	rk3288_vpu_jpeg_enc_set_buffers(vpu, ctx, src_buf, dst_buf);
+	rk3288_vpu_set_src_img_ctrl(ctx);
 
 	qtable = rockchip_vpu_find_control_data(ctx,
 			V4L2_CID_JPEG_QUANTIZATION);
-	rk3288_vpu_jpeg_enc_set_qtable(vpu, qtable);
-
-	/* Make sure that all registers are written at this point. */
-	wmb();
+	rk3288_vpu_jpeg_enc_set_qtable(ctx, qtable);
 
 	reg = VEPU_REG_AXI_CTRL_OUTPUT_SWAP16
 		| VEPU_REG_AXI_CTRL_INPUT_SWAP16
@@ -116,14 +76,34 @@ void rk3288_vpu_jpeg_enc_run(struct rockchip_vpu_ctx *ctx)
 		| VEPU_REG_AXI_CTRL_INPUT_SWAP32
 		| VEPU_REG_AXI_CTRL_OUTPUT_SWAP8
 		| VEPU_REG_AXI_CTRL_INPUT_SWAP8;
-	vepu_write_relaxed(vpu, reg, VEPU_REG_AXI_CTRL);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_AXI_CTRL, reg);
 
-	reg = VEPU_REG_ENC_CTRL_WIDTH(MB_WIDTH(ctx->src_fmt.width))
+	ctx->start_reg = VEPU_REG_ENC_CTRL_WIDTH(MB_WIDTH(ctx->src_fmt.width))
 		| VEPU_REG_ENC_CTRL_HEIGHT(MB_HEIGHT(ctx->src_fmt.height))
 		| VEPU_REG_ENC_CTRL_ENC_MODE_JPEG
 		| VEPU_REG_ENC_PIC_INTRA
 		| VEPU_REG_ENC_CTRL_EN_BIT;
+}
+
+void rk3288_vpu_jpeg_enc_run(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct vb2_buffer *src_buf, *dst_buf;
+
+	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+
+	vepu_write_regs(vpu, ctx->regs, ctx->num_regs);
+	vepu_write_buf_regs(vpu, rockchip_vpu_get_buf(src_buf));
+	vepu_write_buf_regs(vpu, rockchip_vpu_get_buf(dst_buf));
+
+	/* Make sure that all registers are written at this point. */
+	wmb();
+
 	/* Kick the watchdog and start encoding */
-	schedule_delayed_work(&vpu->watchdog_work, msecs_to_jiffies(2000));
-	vepu_write(vpu, reg, VEPU_REG_ENC_CTRL);
+	rockchip_vpu_watchdog_arm(&vpu->enc_watchdog, ctx,
+				  MB_WIDTH(ctx->src_fmt.width) *
+				  MB_HEIGHT(ctx->src_fmt.height));
+	vepu_write(vpu, ctx->start_reg, VEPU_REG_ENC_CTRL);
+	trace_rockchip_vpu_kick(ctx);
 }
@@ -0,0 +1,473 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * VP8 decoding on the RK3288 VDPU.
+ *
+ * Per-segment values, filter taps and DCT partitions are spread over
+ * registers shared with other fields, so the registers are gathered in
+ * an image first, then written in one go.
+ */
+
+#include <linux/bitmap.h>
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+#include "rockchip_vpu_hw.h"
+#include "rockchip_vpu_trace.h"
+#include "rk3288_vpu_regs.h"
+
+/* The hardware reads the bitstream from 64-bit aligned addresses. */
+#define RK3288_VPU_VP8_ALIGN_MASK	0x07U
+
+#define RK3288_VPU_VP8_NUM_REGS		(VDPU_REG_REF_BUF_CTRL2 / 4 + 1)
+
+#define VP8_FRAME_IS_KEY_FRAME(hdr) \
+	((hdr)->flags & V4L2_VP8_FRAME_HEADER_FLAG_KEY_FRAME)
+
+struct rk3288_vpu_vp8d_regs {
+	u32 val[RK3288_VPU_VP8_NUM_REGS];
+	DECLARE_BITMAP(used, RK3288_VPU_VP8_NUM_REGS);
+};
+
+struct rk3288_vpu_vp8d_field {
+	u32 reg;
+	u8 shift;
+	u32 mask;
+};
+
+/* DCT partition base addresses. */
+static const struct rk3288_vpu_vp8d_field rk3288_vp8d_dct_base[8] = {
+	{ VDPU_REG_ADDR_STR, 0, 0xffffffff },
+	{ VDPU_REG_ADDR_REF(8), 0, 0xffffffff },
+	{ VDPU_REG_ADDR_REF(9), 0, 0xffffffff },
+	{ VDPU_REG_ADDR_REF(10), 0, 0xffffffff },
+	{ VDPU_REG_ADDR_REF(11), 0, 0xffffffff },
+	{ VDPU_REG_ADDR_REF(12), 0, 0xffffffff },
+	{ VDPU_REG_ADDR_REF(14), 0, 0xffffffff },
+	{ VDPU_REG_ADDR_REF(15), 0, 0xffffffff },
+};
+
+/* DCT partition start bits. */
+static const struct rk3288_vpu_vp8d_field rk3288_vp8d_dct_start_bits[8] = {
+	{ VDPU_REG_DEC_CTRL2, 26, 0x3f },
+	{ VDPU_REG_DEC_CTRL4, 26, 0x3f },
+	{ VDPU_REG_DEC_CTRL4, 20, 0x3f },
+	{ VDPU_REG_DEC_CTRL7, 24, 0x3f },
+	{ VDPU_REG_DEC_CTRL7, 18, 0x3f },
+	{ VDPU_REG_DEC_CTRL7, 12, 0x3f },
+	{ VDPU_REG_DEC_CTRL7, 6, 0x3f },
+	{ VDPU_REG_DEC_CTRL7, 0, 0x3f },
+};
+
+/* Loop filter level of each segment. */
+static const struct rk3288_vpu_vp8d_field rk3288_vp8d_lf_level[4] = {
+	{ VDPU_REG_REF_PIC(2), 18, 0x3f },
+	{ VDPU_REG_REF_PIC(2), 12, 0x3f },
+	{ VDPU_REG_REF_PIC(2), 6, 0x3f },
+	{ VDPU_REG_REF_PIC(2), 0, 0x3f },
+};
+
+/* Loop filter adjustment of each macroblock mode. */
+static const struct rk3288_vpu_vp8d_field rk3288_vp8d_mb_adj[4] = {
+	{ VDPU_REG_REF_PIC(0), 21, 0x7f },
+	{ VDPU_REG_REF_PIC(0), 14, 0x7f },
+	{ VDPU_REG_REF_PIC(0), 7, 0x7f },
+	{ VDPU_REG_REF_PIC(0), 0, 0x7f },
+};
+
+/* Loop filter adjustment of each reference frame. */
+static const struct rk3288_vpu_vp8d_field rk3288_vp8d_ref_adj[4] = {
+	{ VDPU_REG_REF_PIC(1), 21, 0x7f },
+	{ VDPU_REG_REF_PIC(1), 14, 0x7f },
+	{ VDPU_REG_REF_PIC(1), 7, 0x7f },
+	{ VDPU_REG_REF_PIC(1), 0, 0x7f },
+};
+
+/* Quantizer index of each segment. */
+static const struct rk3288_vpu_vp8d_field rk3288_vp8d_quant[4] = {
+	{ VDPU_REG_REF_PIC(3), 11, 0x7ff },
+	{ VDPU_REG_REF_PIC(3), 0, 0x7ff },
+	{ VDPU_REG_BD_REF_PIC(4), 11, 0x7ff },
+	{ VDPU_REG_BD_REF_PIC(4), 0, 0x7ff },
+};
+
+/* Quantizer deltas: Y DC, Y2 DC, Y2 AC, UV DC and UV AC. */
+static const struct rk3288_vpu_vp8d_field rk3288_vp8d_quant_delta[5] = {
+	{ VDPU_REG_REF_PIC(3), 27, 0x1f },
+	{ VDPU_REG_REF_PIC(3), 22, 0x1f },
+	{ VDPU_REG_BD_REF_PIC(4), 27, 0x1f },
+	{ VDPU_REG_BD_REF_PIC(4), 22, 0x1f },
+	{ VDPU_REG_BD_P_REF_PIC, 27, 0x1f },
+};
+
+/* Middle taps of the six-tap interpolation filters. */
+static const struct rk3288_vpu_vp8d_field rk3288_vp8d_pred_bc_tap[8][4] = {
+	{
+		{ VDPU_REG_PRED_FLT, 22, 0x3ff },
+		{ VDPU_REG_PRED_FLT, 12, 0x3ff },
+		{ VDPU_REG_PRED_FLT, 2, 0x3ff },
+		{ VDPU_REG_REF_PIC(4), 22, 0x3ff },
+	},
+	{
+		{ VDPU_REG_REF_PIC(4), 12, 0x3ff },
+		{ VDPU_REG_REF_PIC(4), 2, 0x3ff },
+		{ VDPU_REG_REF_PIC(5), 22, 0x3ff },
+		{ VDPU_REG_REF_PIC(5), 12, 0x3ff },
+	},
+	{
+		{ VDPU_REG_REF_PIC(5), 2, 0x3ff },
+		{ VDPU_REG_REF_PIC(6), 22, 0x3ff },
+		{ VDPU_REG_REF_PIC(6), 12, 0x3ff },
+		{ VDPU_REG_REF_PIC(6), 2, 0x3ff },
+	},
+	{
+		{ VDPU_REG_REF_PIC(7), 22, 0x3ff },
+		{ VDPU_REG_REF_PIC(7), 12, 0x3ff },
+		{ VDPU_REG_REF_PIC(7), 2, 0x3ff },
+		{ VDPU_REG_LT_REF, 22, 0x3ff },
+	},
+	{
+		{ VDPU_REG_LT_REF, 12, 0x3ff },
+		{ VDPU_REG_LT_REF, 2, 0x3ff },
+		{ VDPU_REG_VALID_REF, 22, 0x3ff },
+		{ VDPU_REG_VALID_REF, 12, 0x3ff },
+	},
+	{
+		{ VDPU_REG_VALID_REF, 2, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(0), 22, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(0), 12, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(0), 2, 0x3ff },
+	},
+	{
+		{ VDPU_REG_BD_REF_PIC(1), 22, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(1), 12, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(1), 2, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(2), 22, 0x3ff },
+	},
+	{
+		{ VDPU_REG_BD_REF_PIC(2), 12, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(2), 2, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(3), 22, 0x3ff },
+		{ VDPU_REG_BD_REF_PIC(3), 12, 0x3ff },
+	},
+};
+
+static void rk3288_vp8d_or(struct rk3288_vpu_vp8d_regs *regs, u32 reg, u32 val)
+{
+	regs->val[reg / 4] |= val;
+	set_bit(reg / 4, regs->used);
+}
+
+static void rk3288_vp8d_set(struct rk3288_vpu_vp8d_regs *regs,
+			    const struct rk3288_vpu_vp8d_field *field, u32 val)
+{
+	rk3288_vp8d_or(regs, field->reg, (val & field->mask) << field->shift);
+}
+
+static void rk3288_vp8d_write(struct rockchip_vpu_dev *vpu,
+			      const struct rk3288_vpu_vp8d_regs *regs)
+{
+	unsigned int i;
+
+	for_each_set_bit(i, regs->used, RK3288_VPU_VP8_NUM_REGS)
+		vdpu_write_relaxed(vpu, regs->val[i], i * 4);
+}
+
+static void rk3288_vp8d_cfg_lf(struct rk3288_vpu_vp8d_regs *regs,
+			       const struct v4l2_ctrl_vp8_frame_header *hdr)
+{
+	const struct v4l2_vp8_segment_header *seg = &hdr->segment_header;
+	const struct v4l2_vp8_loopfilter_header *lf = &hdr->lf_header;
+	unsigned int i;
+	u32 reg;
+
+	if (!(seg->flags & V4L2_VP8_SEGMENT_HEADER_FLAG_ENABLED)) {
+		rk3288_vp8d_set(regs, &rk3288_vp8d_lf_level[0], lf->level);
+	} else if (seg->flags & V4L2_VP8_SEGMENT_HEADER_FLAG_DELTA_VALUE_MODE) {
+		for (i = 0; i < 4; i++)
+			rk3288_vp8d_set(regs, &rk3288_vp8d_lf_level[i],
+					clamp(lf->level + seg->lf_update[i],
+					      0, 63));
+	} else {
+		for (i = 0; i < 4; i++)
+			rk3288_vp8d_set(regs, &rk3288_vp8d_lf_level[i],
+					seg->lf_update[i]);
+	}
+
+	reg = VDPU_REG_REF_PIC_FILT_SHARPNESS(lf->sharpness_level);
+	if (lf->flags & V4L2_VP8_LF_FILTER_TYPE_SIMPLE)
+		reg |= VDPU_REG_REF_PIC_FILT_TYPE_E;
+	rk3288_vp8d_or(regs, VDPU_REG_REF_PIC(0), reg);
+
+	if (lf->flags & V4L2_VP8_LF_HEADER_ADJ_ENABLE) {
+		for (i = 0; i < 4; i++) {
+			rk3288_vp8d_set(regs, &rk3288_vp8d_mb_adj[i],
+					lf->mb_mode_delta[i]);
+			rk3288_vp8d_set(regs, &rk3288_vp8d_ref_adj[i],
+					lf->ref_frm_delta[i]);
+		}
+	}
+}
+
+static void rk3288_vp8d_cfg_qp(struct rk3288_vpu_vp8d_regs *regs,
+			       const struct v4l2_ctrl_vp8_frame_header *hdr)
+{
+	const struct v4l2_vp8_quantization_header *q = &hdr->quant_header;
+	const struct v4l2_vp8_segment_header *seg = &hdr->segment_header;
+	unsigned int i;
+
+	if (!(seg->flags & V4L2_VP8_SEGMENT_HEADER_FLAG_ENABLED)) {
+		rk3288_vp8d_set(regs, &rk3288_vp8d_quant[0], q->y_ac_qi);
+	} else if (seg->flags & V4L2_VP8_SEGMENT_HEADER_FLAG_DELTA_VALUE_MODE) {
+		for (i = 0; i < 4; i++)
+			rk3288_vp8d_set(regs, &rk3288_vp8d_quant[i],
+					clamp(q->y_ac_qi + seg->quant_update[i],
+					      0, 127));
+	} else {
+		for (i = 0; i < 4; i++)
+			rk3288_vp8d_set(regs, &rk3288_vp8d_quant[i],
+					seg->quant_update[i] & 0x7f);
+	}
+
+	rk3288_vp8d_set(regs, &rk3288_vp8d_quant_delta[0], q->y_dc_delta);
+	rk3288_vp8d_set(regs, &rk3288_vp8d_quant_delta[1], q->y2_dc_delta);
+	rk3288_vp8d_set(regs, &rk3288_vp8d_quant_delta[2], q->y2_ac_delta);
+	rk3288_vp8d_set(regs, &rk3288_vp8d_quant_delta[3], q->uv_dc_delta);
+	rk3288_vp8d_set(regs, &rk3288_vp8d_quant_delta[4], q->uv_ac_delta);
+}
+
+/*
+ * The first partition holds the frame header, parsed by userspace, then
+ * the macroblock modes. The DCT partitions follow, preceded by 3 bytes
+ * giving the size of each of them but the last.
+ */
+static void rk3288_vp8d_cfg_parts(struct rockchip_vpu_ctx *ctx,
+				  struct rk3288_vpu_vp8d_regs *regs,
+				  const struct v4l2_ctrl_vp8_frame_header *hdr)
+{
+	u32 first_part_offset = VP8_FRAME_IS_KEY_FRAME(hdr) ? 10 : 3;
+	u32 mb_offset_bits, mb_offset_bytes, mb_start_bits, mb_size;
+	u32 dct_size_part_size, dct_part_offset, dct_part_total_len;
+	u32 byte_offset, count = 0;
+	struct vb2_buffer *src_buf;
+	dma_addr_t src_dma;
+	unsigned int i;
+
+	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	src_dma = vb2_dma_contig_plane_dma_addr(src_buf, 0);
+
+	/* Macroblock modes, from the 64-bit word holding their first bit. */
+	mb_offset_bits = first_part_offset * 8 +
+			 hdr->first_part_header_bits + 8;
+	mb_offset_bytes = mb_offset_bits / 8;
+	mb_start_bits = mb_offset_bits -
+			(mb_offset_bytes & ~RK3288_VPU_VP8_ALIGN_MASK) * 8;
+	mb_size = hdr->first_part_size -
+		  (mb_offset_bytes - first_part_offset) +
+		  (mb_offset_bytes & RK3288_VPU_VP8_ALIGN_MASK);
+
+	rk3288_vp8d_or(regs, VDPU_REG_ADDR_REF(13),
+		       src_dma + (mb_offset_bytes & ~RK3288_VPU_VP8_ALIGN_MASK));
+	rk3288_vp8d_or(regs, VDPU_REG_DEC_CTRL2,
+		       VDPU_REG_DEC_CTRL2_STRM1_START_BIT(mb_start_bits));
+	rk3288_vp8d_or(regs, VDPU_REG_DEC_CTRL6,
+		       VDPU_REG_DEC_CTRL6_STREAM1_LEN(mb_size) |
+		       VDPU_REG_DEC_CTRL6_COEFFS_PART_AM(hdr->num_dct_parts - 1));
+
+	/* DCT partitions. */
+	dct_size_part_size = (hdr->num_dct_parts - 1) * 3;
+	dct_part_offset = first_part_offset + hdr->first_part_size;
+	dct_part_total_len = dct_size_part_size +
+			     (dct_part_offset & RK3288_VPU_VP8_ALIGN_MASK);
+	for (i = 0; i < hdr->num_dct_parts; i++)
+		dct_part_total_len += hdr->dct_part_sizes[i];
+
+	rk3288_vp8d_or(regs, VDPU_REG_DEC_CTRL3,
+		       VDPU_REG_DEC_CTRL3_STREAM_LEN(dct_part_total_len));
+
+	for (i = 0; i < hdr->num_dct_parts; i++) {
+		byte_offset = dct_part_offset + dct_size_part_size + count;
+		rk3288_vp8d_set(regs, &rk3288_vp8d_dct_base[i],
+				(src_dma + byte_offset) &
+				~RK3288_VPU_VP8_ALIGN_MASK);
+		rk3288_vp8d_set(regs, &rk3288_vp8d_dct_start_bits[i],
+				(byte_offset & RK3288_VPU_VP8_ALIGN_MASK) * 8);
+		count += hdr->dct_part_sizes[i];
+	}
+}
+
+/* Version 0 uses six-tap filters, the other versions bilinear ones. */
+static void rk3288_vp8d_cfg_tap(struct rk3288_vpu_vp8d_regs *regs,
+				const struct v4l2_ctrl_vp8_frame_header *hdr)
+{
+	const s32 (*filter)[6] = rockchip_vpu_vp8_dec_mc_filter;
+	struct rk3288_vpu_vp8d_field outer = {
+		.reg = VDPU_REG_BD_REF_PIC(3),
+		.mask = 0xf,
+	};
+	unsigned int i, j;
+
+	if (hdr->version & 0x03)
+		return;
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 4; j++)
+			rk3288_vp8d_set(regs, &rk3288_vp8d_pred_bc_tap[i][j],
+					filter[i][j + 1]);
+
+		/* Only the odd filters have non-zero outer taps. */
+		switch (i) {
+		case 2:
+			outer.shift = 8;
+			break;
+		case 4:
+			outer.shift = 4;
+			break;
+		case 6:
+			outer.shift = 0;
+			break;
+		default:
+			continue;
+		}
+		rk3288_vp8d_set(regs, &outer, (filter[i][0] << 2) | filter[i][5]);
+	}
+}
+
+static void rk3288_vp8d_cfg_ref(struct rockchip_vpu_ctx *ctx,
+				struct rk3288_vpu_vp8d_regs *regs,
+				const struct v4l2_ctrl_vp8_frame_header *hdr,
+				dma_addr_t dst_dma)
+{
+	dma_addr_t ref;
+
+	/* Missing references are replaced by the frame being decoded. */
+	ref = rockchip_vpu_vp8_get_ref(ctx, hdr->last_frame_ts);
+	rk3288_vp8d_or(regs, VDPU_REG_ADDR_REF(0), ref ? ref : dst_dma);
+
+	ref = rockchip_vpu_vp8_get_ref(ctx, hdr->golden_frame_ts);
+	WARN_ON(!ref && hdr->golden_frame_ts);
+	if (!ref)
+		ref = dst_dma;
+	if (hdr->flags & V4L2_VP8_FRAME_HEADER_FLAG_SIGN_BIAS_GOLDEN)
+		ref |= VDPU_REG_ADDR_REF_TOPC_E;
+	rk3288_vp8d_or(regs, VDPU_REG_ADDR_REF(4), ref);
+
+	ref = rockchip_vpu_vp8_get_ref(ctx, hdr->alt_frame_ts);
+	WARN_ON(!ref && hdr->alt_frame_ts);
+	if (!ref)
+		ref = dst_dma;
+	if (hdr->flags & V4L2_VP8_FRAME_HEADER_FLAG_SIGN_BIAS_ALT)
+		ref |= VDPU_REG_ADDR_REF_TOPC_E;
+	rk3288_vp8d_or(regs, VDPU_REG_ADDR_REF(5), ref);
+}
+
+static void rk3288_vp8d_cfg_buffers(struct rockchip_vpu_ctx *ctx,
+				    struct rk3288_vpu_vp8d_regs *regs,
+				    const struct v4l2_ctrl_vp8_frame_header *hdr,
+				    dma_addr_t dst_dma)
+{
+	const struct v4l2_vp8_segment_header *seg = &hdr->segment_header;
+	u32 reg;
+
+	rk3288_vp8d_or(regs, VDPU_REG_ADDR_QTABLE, ctx->vp8_dec.prob_tbl.dma);
+
+	reg = VDPU_REG_FWD_PIC1_SEGMENT_BASE(ctx->vp8_dec.segment_map.dma);
+	if (seg->flags & V4L2_VP8_SEGMENT_HEADER_FLAG_ENABLED) {
+		reg |= VDPU_REG_FWD_PIC1_SEGMENT_E;
+		if (seg->flags & V4L2_VP8_SEGMENT_HEADER_FLAG_UPDATE_MAP)
+			reg |= VDPU_REG_FWD_PIC1_SEGMENT_UPD_E;
+	}
+	rk3288_vp8d_or(regs, VDPU_REG_FWD_PIC(0), reg);
+
+	rk3288_vp8d_or(regs, VDPU_REG_ADDR_DST, dst_dma);
+}
+
+void rk3288_vpu_vp8_dec_run(struct rockchip_vpu_ctx *ctx)
+{
+	const struct v4l2_ctrl_vp8_frame_header *hdr;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct rk3288_vpu_vp8d_regs regs = { };
+	unsigned int mb_width, mb_height;
+	struct vb2_buffer *dst_buf;
+	dma_addr_t dst_dma;
+	u32 reg;
+
+	hdr = rockchip_vpu_find_control_data(ctx,
+				V4L2_CID_MPEG_VIDEO_VP8_FRAME_HEADER);
+	if (WARN_ON(!hdr)) {
+		rockchip_vpu_run_done(ctx);
+		rockchip_vpu_watchdog_fail(&vpu->dec_watchdog, ctx);
+		return;
+	}
+
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+	dst_dma = vb2_dma_contig_plane_dma_addr(dst_buf, 0);
+
+	/* Segmentation is reset on key frames. */
+	if (VP8_FRAME_IS_KEY_FRAME(hdr))
+		memset(ctx->vp8_dec.segment_map.cpu, 0,
+		       ctx->vp8_dec.segment_map.size);
+
+	rockchip_vpu_vp8_prob_update(ctx->vp8_dec.prob_tbl.cpu, hdr);
+
+	reg = VDPU_REG_DEC_CTRL0_DEC_MODE(10);
+	if (!VP8_FRAME_IS_KEY_FRAME(hdr))
+		reg |= VDPU_REG_DEC_CTRL0_PIC_INTER_E;
+	if (!(hdr->flags & V4L2_VP8_FRAME_HEADER_FLAG_MB_NO_SKIP_COEFF))
+		reg |= VDPU_REG_DEC_CTRL0_SKIP_MODE;
+	if (hdr->lf_header.level == 0)
+		reg |= VDPU_REG_DEC_CTRL0_FILTERING_DIS;
+	rk3288_vp8d_or(&regs, VDPU_REG_DEC_CTRL0, reg);
+
+	mb_width = MB_WIDTH(ctx->dst_fmt.width);
+	mb_height = MB_HEIGHT(ctx->dst_fmt.height);
+	rk3288_vp8d_or(&regs, VDPU_REG_DEC_CTRL1,
+		       VDPU_REG_DEC_CTRL1_PIC_MB_WIDTH(mb_width) |
+		       VDPU_REG_DEC_CTRL1_PIC_MB_HEIGHT_P(mb_height) |
+		       VDPU_REG_DEC_CTRL1_PIC_MB_W_EXT(mb_width >> 9) |
+		       VDPU_REG_DEC_CTRL1_PIC_MB_H_EXT(mb_height >> 8));
+
+	/* State of the boolean decoder after the frame header. */
+	rk3288_vp8d_or(&regs, VDPU_REG_DEC_CTRL2,
+		       VDPU_REG_DEC_CTRL2_BOOLEAN_RANGE(hdr->coder_state.range) |
+		       VDPU_REG_DEC_CTRL2_BOOLEAN_VALUE(hdr->coder_state.value));
+
+	reg = 0;
+	if (hdr->version != 3)
+		reg |= VDPU_REG_DEC_CTRL4_VC1_HEIGHT_EXT;
+	if (hdr->version & 0x3)
+		reg |= VDPU_REG_DEC_CTRL4_BILIN_MC_E;
+	rk3288_vp8d_or(&regs, VDPU_REG_DEC_CTRL4, reg);
+
+	rk3288_vp8d_cfg_lf(&regs, hdr);
+	rk3288_vp8d_cfg_qp(&regs, hdr);
+	rk3288_vp8d_cfg_parts(ctx, &regs, hdr);
+	rk3288_vp8d_cfg_tap(&regs, hdr);
+	rk3288_vp8d_cfg_ref(ctx, &regs, hdr, dst_dma);
+	rk3288_vp8d_cfg_buffers(ctx, &regs, hdr, dst_dma);
+
+	rk3288_vp8d_write(vpu, &regs);
+
+	rockchip_vpu_run_done(ctx);
+
+	rockchip_vpu_watchdog_arm(&vpu->dec_watchdog, ctx,
+				  mb_width * mb_height);
+
+	/* Start decoding! */
+	vdpu_write_relaxed(vpu, VDPU_REG_CONFIG_DEC_AXI_RD_ID(0xffu)
+				| VDPU_REG_CONFIG_DEC_TIMEOUT_E
+				| VDPU_REG_CONFIG_DEC_IN_ENDIAN
+				| VDPU_REG_CONFIG_DEC_OUT_ENDIAN
+				| VDPU_REG_CONFIG_DEC_STRENDIAN_E
+				| VDPU_REG_CONFIG_DEC_MAX_BURST(16)
+				| VDPU_REG_CONFIG_DEC_OUTSWAP32_E
+				| VDPU_REG_CONFIG_DEC_INSWAP32_E
+				| VDPU_REG_CONFIG_DEC_STRSWAP32_E
+				| VDPU_REG_CONFIG_DEC_CLK_GATE_E,
+				VDPU_REG_CONFIG);
+	vdpu_write(vpu, VDPU_REG_INTERRUPT_DEC_E, VDPU_REG_INTERRUPT);
+	trace_rockchip_vpu_kick(ctx);
+}
@@ -7,8 +7,10 @@
  */
 
 #include <linux/clk.h>
+#include <media/videobuf2-dma-contig.h>
 
 #include "rockchip_vpu.h"
+#include "rockchip_vpu_trace.h"
 #include "rk3399_vpu_regs.h"
 
 #define RK3399_ACLK_MAX_FREQ (400 * 1000 * 1000)
@@ -32,6 +34,20 @@ static const struct rockchip_vpu_fmt rk3399_vpu_enc_fmts[] = {
 		.depth = { 8, 4 },
 		.enc_fmt = RK3288_VPU_ENC_FMT_YUV420SP,
 	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUV420,
+		.codec_mode = RK_VPU_MODE_NONE,
+		.num_planes = 1,
+		.depth = { 12 },
+		.enc_fmt = RK3288_VPU_ENC_FMT_YUV420P,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV12,
+		.codec_mode = RK_VPU_MODE_NONE,
+		.num_planes = 1,
+		.depth = { 12 },
+		.enc_fmt = RK3288_VPU_ENC_FMT_YUV420SP,
+	},
 	{
 		.fourcc = V4L2_PIX_FMT_YUYV,
 		.codec_mode = RK_VPU_MODE_NONE,
@@ -60,9 +76,58 @@ static const struct rockchip_vpu_fmt rk3399_vpu_enc_fmts[] = {
 			.step_height = MB_DIM,
 		},
 	},
+	{
+		.fourcc = V4L2_PIX_FMT_H264,
+		.codec_mode = RK_VPU_MODE_H264_ENC,
+		.num_planes = 1,
+		.max_depth = 2,
+		.frmsize = {
+			.min_width = 144,
+			.max_width = 1920,
+			.step_width = MB_DIM,
+			.min_height = 96,
+			.max_height = 1088,
+			.step_height = MB_DIM,
+		},
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_VP8,
+		.codec_mode = RK_VPU_MODE_VP8_ENC,
+		.num_planes = 1,
+		.max_depth = 2,
+		.frmsize = {
+			.min_width = 144,
+			.max_width = 1920,
+			.step_width = MB_DIM,
+			.min_height = 96,
+			.max_height = 1088,
+			.step_height = MB_DIM,
+		},
+	},
 };
 
-static const struct rockchip_vpu_fmt rk3399_vpu_dec_fmts[] = {};
+static const struct rockchip_vpu_fmt rk3399_vpu_dec_fmts[] = {
+	{
+		.fourcc = V4L2_PIX_FMT_NV12,
+		.codec_mode = RK_VPU_MODE_NONE,
+		.num_planes = 1,
+		.depth = { 12 },
+	},
+	{
+		.name = "One frame of an H264 Encoded Stream (RK3399)",
+		.fourcc = V4L2_PIX_FMT_H264_SLICE,
+		.codec_mode = RK_VPU_MODE_H264_DEC,
+		.num_planes = 1,
+		.frmsize = {
+			.min_width = 48,
+			.max_width = 4096,
+			.step_width = MB_DIM,
+			.min_height = 48,
+			.max_height = 2304,
+			.step_height = MB_DIM,
+		},
+	},
+};
 
 static irqreturn_t rk3399_vepu_irq(int irq, void *dev_id)
 {
@@ -70,31 +135,40 @@ static irqreturn_t rk3399_vepu_irq(int irq, void *dev_id)
 	u32 status = vepu_read(vpu, VEPU_REG_INTERRUPT);
 	u32 bytesused =	vepu_read(vpu, VEPU_REG_STR_BUF_LIMIT) / 8;
 
+	trace_rockchip_vpu_irq(rockchip_vpu_watchdog_ctx(&vpu->enc_watchdog),
+			       status);
 	vepu_write(vpu, 0, VEPU_REG_INTERRUPT);
 	vepu_write(vpu, 0, VEPU_REG_AXI_CTRL);
 
-	rockchip_vpu_irq_done(vpu,
+	return rockchip_vpu_enc_irq_done(vpu,
 		bytesused,
 		status & VEPU_REG_INTERRUPT_FRAME_READY ?
 		VB2_BUF_STATE_DONE :
 		VB2_BUF_STATE_ERROR);
-	return IRQ_HANDLED;
 }
 
 static irqreturn_t rk3399_vdpu_irq(int irq, void *dev_id)
 {
 	struct rockchip_vpu_dev *vpu = dev_id;
+	u32 status = vdpu_read(vpu, VDPU_REG_INTERRUPT);
 
+	trace_rockchip_vpu_irq(rockchip_vpu_watchdog_ctx(&vpu->dec_watchdog),
+			       status);
 	vdpu_write(vpu, 0, VDPU_REG_INTERRUPT);
 	vdpu_write(vpu, 0, VDPU_REG_AXI_CTRL);
 
-	return IRQ_HANDLED;
+	return rockchip_vpu_dec_irq_done(vpu, 0,
+		status & VDPU_REG_INTERRUPT_DEC_RDY_INT ?
+		VB2_BUF_STATE_DONE :
+		VB2_BUF_STATE_ERROR);
 }
 
 static int rk3399_vpu_hw_init(struct rockchip_vpu_dev *vpu)
 {
-	/* Bump ACLK to max. possible freq. to improve performance. */
-	clk_set_rate(vpu->clocks[0].clk, RK3399_ACLK_MAX_FREQ);
+	/*
+	 * ACLK is scaled from RK3399_ACLK_MAX_FREQ down by
+	 * rockchip_vpu_devfreq_init(), once the driver is registered.
+	 */
 	return 0;
 }
 
@@ -107,6 +181,47 @@ static void rk3399_vpu_enc_reset(struct rockchip_vpu_ctx *ctx)
 	vepu_write(vpu, 0, VEPU_REG_AXI_CTRL);
 }
 
+/* Number of macroblocks processed by the running encoding job. */
+static u32 rk3399_vpu_enc_progress(struct rockchip_vpu_ctx *ctx)
+{
+	return vepu_read(ctx->dev, VEPU_REG_MB_CTRL) >> 16;
+}
+
+/*
+ * Buffer registers of every encoder: the source planes, and the whole
+ * capture buffer. The H.264 and VP8 encoders move the output stream
+ * past their headers when starting a job.
+ */
+static void rk3399_vpu_enc_prepare_buf(struct rockchip_vpu_ctx *ctx,
+				       struct vb2_buffer *vb)
+{
+	struct rockchip_vpu_buf *buf = rockchip_vpu_get_buf(vb);
+	dma_addr_t src[3];
+
+	if (!V4L2_TYPE_IS_OUTPUT(vb->vb2_queue->type)) {
+		rockchip_vpu_buf_reg(buf, VEPU_REG_ADDR_OUTPUT_STREAM,
+				     vb2_dma_contig_plane_dma_addr(vb, 0));
+		rockchip_vpu_buf_reg(buf, VEPU_REG_STR_BUF_LIMIT,
+				     vb2_plane_size(vb, 0));
+		return;
+	}
+
+	rockchip_vpu_enc_src_addrs(ctx, vb, src);
+
+	rockchip_vpu_buf_reg(buf, VEPU_REG_ADDR_IN_LUMA, src[PLANE_Y]);
+	rockchip_vpu_buf_reg(buf, VEPU_REG_ADDR_IN_CR, src[PLANE_CR]);
+	rockchip_vpu_buf_reg(buf, VEPU_REG_ADDR_IN_CB, src[PLANE_CB]);
+}
+
+static void rk3399_vpu_dec_reset(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+
+	vdpu_write(vpu, VDPU_REG_INTERRUPT_DEC_IRQ_DIS, VDPU_REG_INTERRUPT);
+	vdpu_write(vpu, 0, VDPU_REG_EN_FLAGS);
+	vdpu_write(vpu, 1, VDPU_REG_SOFT_RESET);
+}
+
 /*
  * Supported codec ops.
  */
@@ -114,7 +229,35 @@ static void rk3399_vpu_enc_reset(struct rockchip_vpu_ctx *ctx)
 static const struct rockchip_vpu_codec_ops rk3399_vpu_codec_ops[] = {
 	[RK_VPU_MODE_JPEG_ENC] = {
 		.run = rk3399_vpu_jpeg_enc_run,
+		.prepare = rk3399_vpu_jpeg_enc_prepare,
+		.prepare_buf = rk3399_vpu_enc_prepare_buf,
+		.reset = rk3399_vpu_enc_reset,
+		.progress = rk3399_vpu_enc_progress,
+	},
+	[RK_VPU_MODE_H264_DEC] = {
+		.init = rockchip_vpu_h264_dec_init,
+		.run = rk3399_vpu_h264_dec_run,
+		.reset = rk3399_vpu_dec_reset,
+	},
+	[RK_VPU_MODE_H264_ENC] = {
+		.init = rockchip_vpu_h264_enc_init,
+		.exit = rockchip_vpu_h264_enc_exit,
+		.run = rk3399_vpu_h264_enc_run,
+		.done = rockchip_vpu_h264_enc_done,
+		.prepare = rk3399_vpu_h264_enc_prepare,
+		.prepare_buf = rk3399_vpu_enc_prepare_buf,
+		.reset = rk3399_vpu_enc_reset,
+		.progress = rk3399_vpu_enc_progress,
+	},
+	[RK_VPU_MODE_VP8_ENC] = {
+		.init = rockchip_vpu_vp8_enc_init,
+		.exit = rockchip_vpu_vp8_enc_exit,
+		.run = rk3399_vpu_vp8_enc_run,
+		.done = rockchip_vpu_vp8_enc_done,
+		.prepare = rk3399_vpu_vp8_enc_prepare,
+		.prepare_buf = rk3399_vpu_enc_prepare_buf,
 		.reset = rk3399_vpu_enc_reset,
+		.progress = rk3399_vpu_enc_progress,
 	},
 };
 
@@ -126,14 +269,16 @@ const struct rockchip_vpu_variant rk3399_vpu_variant = {
 	.enc_offset = 0x0,
 	.enc_fmts = rk3399_vpu_enc_fmts,
 	.num_enc_fmts = ARRAY_SIZE(rk3399_vpu_enc_fmts),
-	.dec_offset = 0x0, // TODO : Bogus offset. Find the right one.
+	.dec_offset = 0x400,
 	.dec_fmts = rk3399_vpu_dec_fmts,
 	.num_dec_fmts = ARRAY_SIZE(rk3399_vpu_dec_fmts),
-	.codec = RK_VPU_CODEC_JPEG,
+	.codec = RK_VPU_CODEC_JPEG | RK_VPU_CODEC_H264_DEC |
+		 RK_VPU_CODEC_H264_ENC | RK_VPU_CODEC_VP8_ENC,
 	.codec_ops = rk3399_vpu_codec_ops,
 	.vepu_irq = rk3399_vepu_irq,
 	.vdpu_irq = rk3399_vdpu_irq,
 	.init = rk3399_vpu_hw_init,
 	.clk_names = {"aclk", "hclk"},
-	.num_clocks = 2
+	.num_clocks = 2,
+	.aclk_max_freq = RK3399_ACLK_MAX_FREQ,
 };
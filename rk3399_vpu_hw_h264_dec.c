@@ -1 +1,317 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * H.264 decoding on the RK3399 VDPU.
+ *
+ * The RK3399 decoder takes the same parameters and tables as the RK3288
+ * one, laid out differently in its registers. Decoding is started from
+ * the register holding the picture structure flags, so those are only
+ * written with the start bit.
+ */
 
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+#include "rockchip_vpu_hw.h"
+#include "rockchip_vpu_trace.h"
+#include "rk3399_vpu_regs.h"
+
+static void rk3399_vpu_h264d_set_params(struct rockchip_vpu_ctx *ctx)
+{
+	const struct rockchip_vpu_h264_dec_ctrls *ctrls = &ctx->h264_dec.ctrls;
+	const struct v4l2_ctrl_h264_decode_params *dec_param = ctrls->decode;
+	const struct v4l2_ctrl_h264_slice_params *slices = ctrls->slices;
+	const struct v4l2_ctrl_h264_sps *sps = ctrls->sps;
+	const struct v4l2_ctrl_h264_pps *pps = ctrls->pps;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct vb2_buffer *src_buf;
+	u32 reg;
+
+	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+
+	vdpu_write_relaxed(vpu, 0, VDPU_REG_DEC_CTRL0);
+	vdpu_write_relaxed(vpu, VDPU_REG_DEC_CTRL0_DEC_MODE(0),
+			   VDPU_REG_DEC_FORMAT);
+
+	reg = VDPU_REG_DEC_CTRL3_INIT_QP(pps->pic_init_qp_minus26 + 26)
+	    | VDPU_REG_DEC_CTRL3_STREAM_LEN(vb2_get_plane_payload(src_buf, 0));
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_STREAM_LEN);
+
+	reg = VDPU_REG_DEC_CTRL1_PIC_MB_WIDTH(sps->pic_width_in_mbs_minus1 + 1)
+	    | VDPU_REG_DEC_CTRL1_PIC_MB_HEIGHT_P(
+			sps->pic_height_in_map_units_minus1 + 1)
+	    | VDPU_REG_DEC_CTRL2_CH_QP_OFFSET(pps->chroma_qp_index_offset)
+	    | VDPU_REG_DEC_CTRL2_CH_QP_OFFSET2(
+			pps->second_chroma_qp_index_offset);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_H264_PIC_MB_SIZE);
+
+	reg = VDPU_REG_DEC_CTRL1_REF_FRAMES(sps->max_num_ref_frames)
+	    | VDPU_REG_DEC_CTRL4_WEIGHT_BIPR_IDC(pps->weighted_bipred_idc);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_H264_CTRL);
+
+	reg = VDPU_REG_DEC_CTRL4_FRAMENUM_LEN(sps->log2_max_frame_num_minus4 + 4)
+	    | VDPU_REG_DEC_CTRL4_FRAMENUM(slices[0].frame_num);
+	if (pps->flags & V4L2_H264_PPS_FLAG_DEBLOCKING_FILTER_CONTROL_PRESENT)
+		reg |= VDPU_REG_DEC_CTRL5_FILT_CTRL_PRES;
+	if (pps->flags & V4L2_H264_PPS_FLAG_REDUNDANT_PIC_CNT_PRESENT)
+		reg |= VDPU_REG_DEC_CTRL5_RDPIC_CNT_PRES;
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_CURRENT_FRAME);
+
+	reg = VDPU_REG_DEC_CTRL5_REFPIC_MK_LEN(
+			slices[0].dec_ref_pic_marking_bit_size)
+	    | VDPU_REG_DEC_CTRL5_IDR_PIC_ID(slices[0].idr_pic_id);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_REF_FRAME);
+
+	reg = VDPU_REG_DEC_CTRL6_PPS_ID(slices[0].pic_parameter_set_id)
+	    | VDPU_REG_DEC_CTRL6_REFIDX0_ACTIVE(
+			pps->num_ref_idx_l0_default_active_minus1 + 1)
+	    | VDPU_REG_DEC_CTRL6_REFIDX1_ACTIVE(
+			pps->num_ref_idx_l1_default_active_minus1 + 1)
+	    | VDPU_REG_DEC_CTRL6_POC_LENGTH(slices[0].pic_order_cnt_bit_size);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_DEC_CTRL6);
+
+	/* The scaling lists always come from userspace. */
+	reg = VDPU_REG_DEC_CTRL2_TYPE1_QUANT_E;
+	if (slices[0].flags & V4L2_H264_SLICE_FLAG_FIELD_PIC)
+		reg |= VDPU_REG_DEC_CTRL2_FIELDPIC_FLAG_E;
+	if (pps->flags & V4L2_H264_PPS_FLAG_ENTROPY_CODING_MODE)
+		reg |= VDPU_REG_DEC_CTRL4_CABAC_E;
+	if (sps->flags & V4L2_H264_SPS_FLAG_DIRECT_8X8_INFERENCE)
+		reg |= VDPU_REG_DEC_CTRL4_DIR_8X8_INFER_E;
+	if (sps->profile_idc >= 100 && sps->chroma_format_idc == 0)
+		reg |= VDPU_REG_DEC_CTRL4_BLACKWHITE_E;
+	if (pps->flags & V4L2_H264_PPS_FLAG_WEIGHTED_PRED)
+		reg |= VDPU_REG_DEC_CTRL4_WEIGHT_PRED_E;
+	if (pps->flags & V4L2_H264_PPS_FLAG_CONSTRAINED_INTRA_PRED)
+		reg |= VDPU_REG_DEC_CTRL5_CONST_INTRA_E;
+	if (pps->flags & V4L2_H264_PPS_FLAG_TRANSFORM_8X8_MODE)
+		reg |= VDPU_REG_DEC_CTRL5_8X8TRANS_FLAG_E;
+	if (dec_param->flags & V4L2_H264_DECODE_PARAM_FLAG_IDR_PIC)
+		reg |= VDPU_REG_DEC_CTRL5_IDR_PIC_E;
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_ENABLE_FLAG);
+
+	vdpu_write_relaxed(vpu, VDPU_REG_REF_BUF_CTRL2_APF_THRESHOLD(8),
+			   VDPU_REG_ERROR_CONCEALMENT);
+
+	/* 6-tap luma interpolation filter (1, -5, 20). */
+	vdpu_write_relaxed(vpu, VDPU_REG_PRED_FLT_PRED_BC_TAP_0_0(1)
+				| VDPU_REG_PRED_FLT_PRED_BC_TAP_0_1(-5 & 0x3ff)
+				| VDPU_REG_PRED_FLT_PRED_BC_TAP_0_2(20),
+				VDPU_REG_PRED_FLT);
+
+	vdpu_write_relaxed(vpu, 0, VDPU_REG_REFBUF_RELATED);
+}
+
+static void rk3399_vpu_h264d_set_ref(struct rockchip_vpu_ctx *ctx)
+{
+	const struct v4l2_h264_dpb_entry *dpb = ctx->h264_dec.dpb;
+	const struct rockchip_vpu_h264_dec_reflists *reflists;
+	const u8 *b0, *b1, *p;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	u32 dpb_longterm = 0;
+	u32 dpb_valid = 0;
+	unsigned int i;
+	u32 reg;
+
+	reflists = &ctx->h264_dec.reflists;
+	b0 = reflists->b0;
+	b1 = reflists->b1;
+	p = reflists->p;
+
+	/* Bitmaps of valid and long term slots, the MSB is slot 0. */
+	for (i = 0; i < RK_VPU_H264_DPB_SIZE; i++) {
+		if (dpb[i].flags & V4L2_H264_DPB_ENTRY_FLAG_ACTIVE)
+			dpb_valid |= BIT(RK_VPU_H264_DPB_SIZE - 1 - i);
+		if (dpb[i].flags & V4L2_H264_DPB_ENTRY_FLAG_LONG_TERM)
+			dpb_longterm |= BIT(RK_VPU_H264_DPB_SIZE - 1 - i);
+	}
+	vdpu_write_relaxed(vpu, dpb_valid << 16, VDPU_REG_VALID_REF);
+	vdpu_write_relaxed(vpu, dpb_longterm << 16, VDPU_REG_LT_REF);
+
+	/* Picture numbers, two slots per register. */
+	for (i = 0; i < RK_VPU_H264_DPB_SIZE; i += 2) {
+		reg = 0;
+		if (dpb[i].flags & V4L2_H264_DPB_ENTRY_FLAG_LONG_TERM)
+			reg |= VDPU_REG_REF_PIC_REFER0_NBR(dpb[i].pic_num);
+		else
+			reg |= VDPU_REG_REF_PIC_REFER0_NBR(dpb[i].frame_num);
+
+		if (dpb[i + 1].flags & V4L2_H264_DPB_ENTRY_FLAG_LONG_TERM)
+			reg |= VDPU_REG_REF_PIC_REFER1_NBR(dpb[i + 1].pic_num);
+		else
+			reg |= VDPU_REG_REF_PIC_REFER1_NBR(dpb[i + 1].frame_num);
+
+		vdpu_write_relaxed(vpu, reg, VDPU_REG_REF_PIC(i / 2));
+	}
+
+	/* Each list takes three registers, six entries in the first two. */
+	reg = VDPU_REG_BD_REF_PIC_BINIT_RLIST_F0(b0[0])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F1(b0[1])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F2(b0[2])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F3(b0[3])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F4(b0[4])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F5(b0[5]);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_INITIAL_REF_PIC_LIST0);
+
+	reg = VDPU_REG_BD_REF_PIC_BINIT_RLIST_F6(b0[6])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F7(b0[7])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F8(b0[8])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F9(b0[9])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F10(b0[10])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F11(b0[11]);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_INITIAL_REF_PIC_LIST1);
+
+	reg = VDPU_REG_BD_REF_PIC_BINIT_RLIST_F12(b0[12])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F13(b0[13])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F14(b0[14])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_F15(b0[15]);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_INITIAL_REF_PIC_LIST2);
+
+	reg = VDPU_REG_BD_REF_PIC_BINIT_RLIST_B0(b1[0])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B1(b1[1])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B2(b1[2])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B3(b1[3])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B4(b1[4])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B5(b1[5]);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_INITIAL_REF_PIC_LIST3);
+
+	reg = VDPU_REG_BD_REF_PIC_BINIT_RLIST_B6(b1[6])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B7(b1[7])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B8(b1[8])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B9(b1[9])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B10(b1[10])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B11(b1[11]);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_INITIAL_REF_PIC_LIST4);
+
+	reg = VDPU_REG_BD_REF_PIC_BINIT_RLIST_B12(b1[12])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B13(b1[13])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B14(b1[14])
+	    | VDPU_REG_BD_REF_PIC_BINIT_RLIST_B15(b1[15]);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_INITIAL_REF_PIC_LIST5);
+
+	reg = VDPU_REG_BD_P_REF_PIC_PINIT_RLIST_F0(p[0])
+	    | VDPU_REG_BD_P_REF_PIC_PINIT_RLIST_F1(p[1])
+	    | VDPU_REG_BD_P_REF_PIC_PINIT_RLIST_F2(p[2])
+	    | VDPU_REG_BD_P_REF_PIC_PINIT_RLIST_F3(p[3]);
+	vdpu_write_relaxed(vpu, reg, VDPU_REG_INITIAL_REF_PIC_LIST6);
+
+	/* Rest of the P list, six entries per register. */
+	for (i = 4; i < RK_VPU_H264_DPB_SIZE; i += 6) {
+		reg = VDPU_REG_FWD_PIC_PINIT_RLIST_F0(p[i])
+		    | VDPU_REG_FWD_PIC_PINIT_RLIST_F1(p[i + 1])
+		    | VDPU_REG_FWD_PIC_PINIT_RLIST_F2(p[i + 2])
+		    | VDPU_REG_FWD_PIC_PINIT_RLIST_F3(p[i + 3])
+		    | VDPU_REG_FWD_PIC_PINIT_RLIST_F4(p[i + 4])
+		    | VDPU_REG_FWD_PIC_PINIT_RLIST_F5(p[i + 5]);
+		vdpu_write_relaxed(vpu, reg, VDPU_REG_FWD_PIC((i - 4) / 6));
+	}
+
+	for (i = 0; i < RK_VPU_H264_DPB_SIZE; i++)
+		vdpu_write_relaxed(vpu, rockchip_vpu_h264_get_ref_buf(ctx, i),
+				   VDPU_REG_H264_ADDR_REF(i));
+}
+
+static void rk3399_vpu_h264d_set_buffers(struct rockchip_vpu_ctx *ctx)
+{
+	const struct rockchip_vpu_h264_dec_ctrls *ctrls = &ctx->h264_dec.ctrls;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct vb2_buffer *src_buf, *dst_buf;
+	unsigned int mbs, bytes_per_mb;
+	dma_addr_t dst_dma;
+
+	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+
+	vdpu_write_relaxed(vpu, vb2_dma_contig_plane_dma_addr(src_buf, 0),
+			   VDPU_REG_ADDR_STR);
+
+	dst_dma = vb2_dma_contig_plane_dma_addr(dst_buf, 0);
+	vdpu_write_relaxed(vpu, dst_dma, VDPU_REG_ADDR_DST);
+
+	/* Same motion vector layout as on RK3288. */
+	if (ctrls->sps->profile_idc > 66 && ctrls->decode->nal_ref_idc) {
+		mbs = MB_WIDTH(ctx->dst_fmt.width) *
+		      MB_HEIGHT(ctx->dst_fmt.height);
+		bytes_per_mb = 384;
+		if (ctrls->sps->profile_idc >= 100 &&
+		    ctrls->sps->chroma_format_idc == 0)
+			bytes_per_mb = 256;
+		if (ctrls->slices[0].flags & V4L2_H264_SLICE_FLAG_BOTTOM_FIELD)
+			bytes_per_mb += 32;
+		vdpu_write_relaxed(vpu, dst_dma + mbs * bytes_per_mb,
+				   VDPU_REG_DIRECT_MV_ADDR);
+	}
+
+	vdpu_write_relaxed(vpu, vpu->h264_dec_tbl.dma, VDPU_REG_ADDR_QTABLE);
+}
+
+/* Picture structure flags, sharing the register of the start bit. */
+static u32 rk3399_vpu_h264d_en_flags(struct rockchip_vpu_ctx *ctx)
+{
+	const struct rockchip_vpu_h264_dec_ctrls *ctrls = &ctx->h264_dec.ctrls;
+	const struct v4l2_ctrl_h264_slice_params *slices = ctrls->slices;
+	const struct v4l2_ctrl_h264_sps *sps = ctrls->sps;
+	u32 reg;
+
+	reg = VDPU_REG_DEC_CTRL3_START_CODE_E
+	    | VDPU_REG_CONFIG_DEC_TIMEOUT_E
+	    | VDPU_REG_CONFIG_DEC_CLK_GATE_E;
+	if (sps->flags & V4L2_H264_SPS_FLAG_MB_ADAPTIVE_FRAME_FIELD)
+		reg |= VDPU_REG_DEC_CTRL0_SEQ_MBAFF_E;
+	if (sps->profile_idc > 66) {
+		reg |= VDPU_REG_DEC_CTRL0_PICORD_COUNT_E;
+		if (ctrls->decode->nal_ref_idc)
+			reg |= VDPU_REG_DEC_CTRL0_WRITE_MVS_E;
+	}
+	if (!(sps->flags & V4L2_H264_SPS_FLAG_FRAME_MBS_ONLY) &&
+	    (sps->flags & V4L2_H264_SPS_FLAG_MB_ADAPTIVE_FRAME_FIELD ||
+	     slices[0].flags & V4L2_H264_SLICE_FLAG_FIELD_PIC))
+		reg |= VDPU_REG_DEC_CTRL0_PIC_INTERLACE_E;
+	if (slices[0].flags & V4L2_H264_SLICE_FLAG_FIELD_PIC)
+		reg |= VDPU_REG_DEC_CTRL0_PIC_FIELDMODE_E;
+	if (!(slices[0].flags & V4L2_H264_SLICE_FLAG_BOTTOM_FIELD))
+		reg |= VDPU_REG_DEC_CTRL0_PIC_TOPFIELD_E;
+	return reg;
+}
+
+void rk3399_vpu_h264_dec_run(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	u32 en_flags;
+
+	if (rockchip_vpu_h264_dec_prepare_run(ctx)) {
+		rockchip_vpu_run_done(ctx);
+		rockchip_vpu_watchdog_fail(&vpu->dec_watchdog, ctx);
+		return;
+	}
+
+	/* Configure hardware registers. */
+	rk3399_vpu_h264d_set_params(ctx);
+	rk3399_vpu_h264d_set_ref(ctx);
+	rk3399_vpu_h264d_set_buffers(ctx);
+	en_flags = rk3399_vpu_h264d_en_flags(ctx);
+
+	vdpu_write_relaxed(vpu, VDPU_REG_CONFIG_DEC_OUT_ENDIAN
+				| VDPU_REG_CONFIG_DEC_STRENDIAN_E
+				| VDPU_REG_CONFIG_DEC_OUTSWAP32_E
+				| VDPU_REG_CONFIG_DEC_INSWAP32_E
+				| VDPU_REG_CONFIG_DEC_STRSWAP32_E,
+				VDPU_REG_DATA_ENDIAN);
+	vdpu_write_relaxed(vpu, VDPU_REG_CONFIG_DEC_MAX_BURST(16)
+				| VDPU_REG_DEC_CTRL0_DEC_AXI_WR_ID(0)
+				| VDPU_REG_CONFIG_DEC_AXI_RD_ID(0xffu),
+				VDPU_REG_AXI_CTRL);
+
+	rockchip_vpu_run_done(ctx);
+
+	rockchip_vpu_watchdog_arm(&vpu->dec_watchdog, ctx,
+				  MB_WIDTH(ctx->dst_fmt.width) *
+				  MB_HEIGHT(ctx->dst_fmt.height));
+
+	/* Start decoding! */
+	vdpu_write(vpu, en_flags | VDPU_REG_INTERRUPT_DEC_E, VDPU_REG_EN_FLAGS);
+	trace_rockchip_vpu_kick(ctx);
+}
@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * VP8 encoding on the RK3399 VEPU.
+ *
+ * The hardware continues the first partition from the frame header
+ * written by rockchip_vpu_vp8_enc.c, and writes the DCT coefficients
+ * in up to two partitions.
+ */
+
+#include <asm/unaligned.h>
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+#include "rockchip_vpu_hw.h"
+#include "rockchip_vpu_trace.h"
+#include "rk3399_vpu_regs.h"
+
+#define VEPU_DMV_PENALTY_REGS		32
+#define VEPU_VP8_INTRA_16X16_REGS	2
+#define VEPU_VP8_INTRA_4X4_REGS		5
+
+/*
+ * Estimated bits of each intra prediction mode, from the default
+ * probabilities: DC, V, H and TM for 16x16 blocks, then B_DC, B_TM,
+ * B_VE, B_HE, B_LD, B_RD, B_VR, B_VL, B_HD and B_HU for 4x4 blocks.
+ */
+static const u8 rk3399_vpu_vp8e_intra_16x16_bits[4] = { 1, 3, 4, 4 };
+static const u8 rk3399_vpu_vp8e_intra_4x4_bits[10] = {
+	2, 2, 3, 4, 5, 5, 5, 5, 5, 5,
+};
+/* Bits of an inter macroblock type over an intra one. */
+#define VP8_INTER_TYPE_BITS		2
+
+/* Bits of a motion vector component difference of magnitude mvd. */
+static u32 rk3399_vpu_vp8e_mv_bits(unsigned int mvd)
+{
+	/* Short tree and sign below 8, long form with sign above. */
+	if (!mvd)
+		return 2;
+	return mvd < 8 ? 5 : 12;
+}
+
+static void rk3399_vpu_vp8e_set_dmv_penalty(struct rockchip_vpu_ctx *ctx,
+					    u32 lambda)
+{
+	unsigned int i, j;
+	u32 pel, qpel, bits;
+
+	/*
+	 * Penalty of each motion vector difference, in full pixels for the
+	 * first table and in quarter pixels for the second one.
+	 */
+	for (i = 0; i < VEPU_DMV_PENALTY_REGS; i++) {
+		pel = 0;
+		qpel = 0;
+		for (j = 0; j < 4; j++) {
+			bits = rk3399_vpu_vp8e_mv_bits(4 * (i * 4 + j));
+			pel |= VEPU_REG_DMV_PENALTY_TABLE_BIT(
+					min_t(u32, bits * lambda, 255), j);
+			bits = rk3399_vpu_vp8e_mv_bits(i * 4 + j);
+			qpel |= VEPU_REG_DMV_Q_PIXEL_PENALTY_TABLE_BIT(
+					min_t(u32, bits * lambda, 255), j);
+		}
+		rockchip_vpu_ctx_reg(ctx, VEPU_REG_DMV_PENALTY_TBL(i), pel);
+		rockchip_vpu_ctx_reg(ctx, VEPU_REG_DMV_Q_PIXEL_PENALTY_TBL(i),
+				     qpel);
+	}
+}
+
+static void rk3399_vpu_vp8e_set_intra_penalty(struct rockchip_vpu_ctx *ctx,
+					      u32 lambda)
+{
+	const u8 *bits;
+	unsigned int i;
+	u32 reg;
+
+	bits = rk3399_vpu_vp8e_intra_16x16_bits;
+	for (i = 0; i < VEPU_VP8_INTRA_16X16_REGS; i++) {
+		reg = VEPU_REG_VP8_INTRA_16X16_PENALTY_0(bits[2 * i] * lambda)
+		    | VEPU_REG_VP8_INTRA_16X16_PENALTY_1(bits[2 * i + 1] *
+							 lambda);
+		rockchip_vpu_ctx_reg(ctx, VEPU_REG_VP8_INTRA_16X16_PENALTY(i),
+				     reg);
+	}
+
+	bits = rk3399_vpu_vp8e_intra_4x4_bits;
+	for (i = 0; i < VEPU_VP8_INTRA_4X4_REGS; i++) {
+		reg = VEPU_REG_VP8_INTRA_4X4_PENALTY_0(bits[2 * i] * lambda)
+		    | VEPU_REG_VP8_INTRA_4x4_PENALTY_1(bits[2 * i + 1] * lambda);
+		rockchip_vpu_ctx_reg(ctx, VEPU_REG_VP8_INTRA_4X4_PENALTY(i),
+				     reg);
+	}
+}
+
+/*
+ * Build the register image of the context. The quantization, frame
+ * header state and partitions change with every frame and are written
+ * by rk3399_vpu_vp8_enc_run().
+ */
+void rk3399_vpu_vp8_enc_prepare(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc = &ctx->vp8_enc;
+	struct rockchip_vpu_vp8_enc_quant quant;
+	u32 reg;
+
+	rockchip_vpu_vp8_enc_prepare(ctx);
+	rockchip_vpu_vp8_enc_quant(vp8_enc->qi_p, &quant);
+
+	/* Switch to VP8 encoder mode before writing registers */
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENCODE_START,
+			     VEPU_REG_ENCODE_FORMAT_VP8);
+
+	reg = VEPU_REG_IN_IMG_CTRL_ROW_LEN(rockchip_vpu_enc_row_len(ctx));
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_INPUT_LUMA_INFO, reg);
+
+	reg = VEPU_REG_IN_IMG_CTRL_FMT(ctx->vpu_src_fmt->enc_fmt);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENC_CTRL1, reg);
+
+	reg = VEPU_REG_OUTPUT_SWAP32
+		| VEPU_REG_OUTPUT_SWAP16
+		| VEPU_REG_OUTPUT_SWAP8
+		| VEPU_REG_INPUT_SWAP8
+		| VEPU_REG_INPUT_SWAP16
+		| VEPU_REG_INPUT_SWAP32;
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_DATA_ENDIAN, reg);
+
+	reg = VEPU_REG_AXI_CTRL_BURST_LEN(16);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_AXI_CTRL, reg);
+
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ENC_CTRL0, 0);
+
+	reg = VEPU_REG_INTER_MODE(VP8_INTER_TYPE_BITS * quant.lambda);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_INTRA_INTER_MODE, reg);
+
+	reg = VEPU_REG_1MV_PENALTY(2 * quant.lambda)
+		| VEPU_REG_QMV_PENALTY(2 * quant.lambda)
+		| VEPU_REG_4MV_PENALTY(2 * quant.lambda);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_MV_PENALTY, reg);
+
+	/* No segmentation, nor loop filter deltas. */
+	reg = VEPU_REG_VP8_INTER_TYPE_BIT_COST(VP8_INTER_TYPE_BITS *
+					       quant.lambda);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_VP8_CONTROL, reg);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_VP8_LOOP_FILTER_REF_DELTA, 0);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_VP8_LOOP_FILTER_MODE_DELTA, 0);
+
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ADDR_CABAC_TBL,
+			     vp8_enc->prob_tbl.dma);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ADDR_VP8_PROB_CNT,
+			     vp8_enc->prob_cnt.dma);
+	rockchip_vpu_ctx_reg(ctx, VEPU_REG_ADDR_OUTPUT_CTRL,
+			     vp8_enc->ctrl_buf.dma);
+	rk3399_vpu_vp8e_set_dmv_penalty(ctx, quant.lambda);
+	rk3399_vpu_vp8e_set_intra_penalty(ctx, quant.lambda);
+
+	ctx->start_reg = VEPU_REG_MB_WIDTH(MB_WIDTH(ctx->src_fmt.width))
+		| VEPU_REG_MB_HEIGHT(MB_HEIGHT(ctx->src_fmt.height))
+		| VEPU_REG_ENCODE_FORMAT_VP8
+		| VEPU_REG_ENCODE_ENABLE;
+}
+
+static void rk3399_vpu_vp8e_set_quant(struct rockchip_vpu_ctx *ctx,
+				      const struct rockchip_vpu_vp8_enc_quant *q)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	static const struct {
+		u32 reg;
+		enum rockchip_vpu_vp8_enc_coeff coeff;
+	} regs[] = {
+		{ VEPU_REG_VP8_SEG0_QUANT_DC_Y1, RK_VPU_VP8_Y1_DC },
+		{ VEPU_REG_VP8_SEG0_QUANT_AC_Y1, RK_VPU_VP8_Y1_AC },
+		{ VEPU_REG_VP8_SEG0_QUANT_DC_Y2, RK_VPU_VP8_Y2_DC },
+		{ VEPU_REG_VP8_SEG0_QUANT_AC_Y2, RK_VPU_VP8_Y2_AC },
+		{ VEPU_REG_VP8_SEG0_QUANT_DC_CHR, RK_VPU_VP8_UV_DC },
+		{ VEPU_REG_VP8_SEG0_QUANT_AC_CHR, RK_VPU_VP8_UV_AC },
+	};
+	unsigned int i, c;
+	u32 reg;
+
+	/* All six registers share the field layout of the first one. */
+	for (i = 0; i < ARRAY_SIZE(regs); i++) {
+		c = regs[i].coeff;
+		reg = VEPU_REG_VP8_SEG0_RND_DC_Y1(q->round[c])
+			| VEPU_REG_VP8_SEG0_ZBIN_DC_Y1(q->zbin[c])
+			| VEPU_REG_VP8_SEG0_QUT_DC_Y1(q->quant[c]);
+		vepu_write_relaxed(vpu, reg, regs[i].reg);
+	}
+
+	reg = VEPU_REG_VP8_MV_REF_IDX1(0)
+		| VEPU_REG_VP8_SEG0_DQUT_DC_Y2(q->dequant[RK_VPU_VP8_Y2_DC])
+		| VEPU_REG_VP8_SEG0_DQUT_AC_Y1(q->dequant[RK_VPU_VP8_Y1_AC])
+		| VEPU_REG_VP8_SEG0_DQUT_DC_Y1(q->dequant[RK_VPU_VP8_Y1_DC]);
+	vepu_write_relaxed(vpu, reg, VEPU_REG_VP8_SEG0_QUANT_DQUT);
+
+	reg = VEPU_REG_VP8_SEG0_DQUT_AC_CHR(q->dequant[RK_VPU_VP8_UV_AC])
+		| VEPU_REG_VP8_SEG0_DQUT_DC_CHR(q->dequant[RK_VPU_VP8_UV_DC])
+		| VEPU_REG_VP8_SEG0_DQUT_AC_Y2(q->dequant[RK_VPU_VP8_Y2_AC]);
+	vepu_write_relaxed(vpu, reg, VEPU_REG_VP8_SEG0_QUANT_DQUT_1);
+}
+
+static void rk3399_vpu_vp8e_set_frame(struct rockchip_vpu_ctx *ctx)
+{
+	const struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc = &ctx->vp8_enc;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	const struct rockchip_vpu_aux_buf *ref, *rec;
+	struct rockchip_vpu_vp8_enc_quant quant;
+	struct vb2_buffer *dst_buf;
+	unsigned int luma_size, i;
+	dma_addr_t dst_dma;
+	u32 reg;
+
+	rockchip_vpu_vp8_enc_quant(vp8_enc->key ? vp8_enc->qi_i :
+						  vp8_enc->qi_p, &quant);
+	rk3399_vpu_vp8e_set_quant(ctx, &quant);
+
+	/* Bool encoder state at the end of the driver written header. */
+	vepu_write_relaxed(vpu, vp8_enc->bool_value,
+			   VEPU_REG_VP8_BOOL_ENC_VALUE);
+	reg = VEPU_REG_VP8_FILTER_SHARPNESS(0)
+		| VEPU_REG_VP8_FILTER_LEVEL(quant.filter_level)
+		| VEPU_REG_VP8_DCT_PARTITION_CNT(ilog2(vp8_enc->num_parts))
+		| VEPU_REG_VP8_BOOL_ENC_VALUE_BITS(vp8_enc->bool_bits)
+		| VEPU_REG_VP8_BOOL_ENC_RANGE(vp8_enc->bool_range);
+	vepu_write_relaxed(vpu, reg, VEPU_REG_VP8_ENC_CTRL2);
+
+	reg = VEPU_REG_STREAM_START_OFFSET(vp8_enc->rem_size * 8)
+		| VEPU_REG_SKIP_MACROBLOCK_PENALTY(0)
+		| VEPU_REG_IN_IMG_CTRL_OVRFLR_D4(
+				rockchip_vpu_enc_overfill_right(ctx))
+		| VEPU_REG_IN_IMG_CTRL_OVRFLB(
+				rockchip_vpu_enc_overfill_bottom(ctx));
+	vepu_write_relaxed(vpu, reg, VEPU_REG_ENC_OVER_FILL_STRM_OFFSET);
+	vepu_write_relaxed(vpu, get_unaligned_be32(&vp8_enc->rem[0]),
+			   VEPU_REG_STR_HDR_REM_MSB);
+	vepu_write_relaxed(vpu, get_unaligned_be32(&vp8_enc->rem[4]),
+			   VEPU_REG_STR_HDR_REM_LSB);
+
+	/* First partition from base, the DCT partitions in their regions. */
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+	dst_dma = vb2_dma_contig_plane_dma_addr(dst_buf, 0);
+	vepu_write_relaxed(vpu, dst_dma + vp8_enc->base,
+			   VEPU_REG_ADDR_OUTPUT_STREAM);
+	vepu_write_relaxed(vpu, vp8_enc->part_offset[0] - vp8_enc->base,
+			   VEPU_REG_STR_BUF_LIMIT);
+	for (i = 0; i < vp8_enc->num_parts; i++)
+		vepu_write_relaxed(vpu, dst_dma + vp8_enc->part_offset[i],
+				   VEPU_REG_ADDR_VP8_DCT_PART(i));
+
+	/* NV12, chroma right after the luma. */
+	luma_size = rockchip_vpu_rounded_luma_size(ctx->src_fmt.width,
+						   ctx->src_fmt.height);
+	ref = &vp8_enc->rec[vp8_enc->ref];
+	rec = &vp8_enc->rec[vp8_enc->ref ^ 1];
+	vepu_write_relaxed(vpu, ref->dma, VEPU_REG_ADDR_REF_LUMA);
+	vepu_write_relaxed(vpu, ref->dma + luma_size, VEPU_REG_ADDR_REF_CHROMA);
+	vepu_write_relaxed(vpu, rec->dma, VEPU_REG_ADDR_REC_LUMA);
+	vepu_write_relaxed(vpu, rec->dma + luma_size, VEPU_REG_ADDR_REC_CHROMA);
+}
+
+void rk3399_vpu_vp8_enc_run(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct vb2_buffer *src_buf, *dst_buf;
+	u32 frame_type;
+
+	if (rockchip_vpu_vp8_enc_prepare_run(ctx)) {
+		rockchip_vpu_watchdog_fail(&vpu->enc_watchdog, ctx);
+		return;
+	}
+
+	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+
+	vepu_write_regs(vpu, ctx->regs, ctx->num_regs);
+	vepu_write_buf_regs(vpu, rockchip_vpu_get_buf(src_buf));
+	vepu_write_buf_regs(vpu, rockchip_vpu_get_buf(dst_buf));
+	rk3399_vpu_vp8e_set_frame(ctx);
+
+	/* Make sure that all registers are written at this point. */
+	wmb();
+
+	/* Kick the watchdog and start encoding */
+	rockchip_vpu_watchdog_arm(&vpu->enc_watchdog, ctx,
+				  MB_WIDTH(ctx->src_fmt.width) *
+				  MB_HEIGHT(ctx->src_fmt.height));
+	frame_type = ctx->vp8_enc.key ? VEPU_REG_FRAME_TYPE_INTRA :
+					VEPU_REG_FRAME_TYPE_INTER;
+	vepu_write(vpu, ctx->start_reg | frame_type, VEPU_REG_ENCODE_START);
+	trace_rockchip_vpu_kick(ctx);
+}
@@ -259,6 +259,7 @@
 #define     VEPU_REG_FRAME_TYPE_INTER			(0 << 6)
 #define     VEPU_REG_FRAME_TYPE_INTRA			(1 << 6)
 #define     VEPU_REG_FRAME_TYPE_MVCINTER		(2 << 6)
+#define     VEPU_REG_ENCODE_FORMAT_VP8			(1 << 4)
 #define     VEPU_REG_ENCODE_FORMAT_JPEG			(2 << 4)
 #define     VEPU_REG_ENCODE_FORMAT_H264			(3 << 4)
 #define     VEPU_REG_ENCODE_ENABLE			BIT(0)
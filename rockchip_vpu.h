@@ -12,6 +12,11 @@
 #ifndef ROCKCHIP_VPU_H_
 #define ROCKCHIP_VPU_H_
 
+#include <linux/bitmap.h>
+#include <linux/devfreq.h>
+#include <linux/hrtimer.h>
+#include <linux/jump_label.h>
+#include <asm/local.h>
 #include <linux/platform_device.h>
 #include <linux/videodev2.h>
 #include <linux/wait.h>
@@ -20,13 +25,16 @@
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-ioctl.h>
+#include <media/v4l2-mem2mem.h>
 #include <media/videobuf2-core.h>
 #include <media/videobuf2-dma-contig.h>
 
 #include "rockchip_vpu_hw.h"
 
 #define ROCKCHIP_VPU_MAX_CLOCKS		4
-#define ROCKCHIP_VPU_MAX_CTRLS		16
+#define ROCKCHIP_VPU_MAX_CTRLS		32
+/* Size of the encoder and decoder register windows, in registers. */
+#define ROCKCHIP_VPU_NUM_REGS		(0x400 / 4)
 
 #define MB_DIM				16
 #define MB_WIDTH(x_size)		DIV_ROUND_UP(x_size, MB_DIM)
@@ -38,7 +46,28 @@
 struct rockchip_vpu_ctx;
 struct rockchip_vpu_codec_ops;
 
+/* Codecs of a variant, one bit per enum rockchip_vpu_codec_mode. */
 #define	RK_VPU_CODEC_JPEG BIT(0)
+#define	RK_VPU_CODEC_H264_DEC BIT(1)
+#define	RK_VPU_CODEC_VP8_DEC BIT(2)
+#define	RK_VPU_CODEC_H264_ENC BIT(3)
+#define	RK_VPU_CODEC_VP8_ENC BIT(4)
+#define	RK_VPU_CODEC_JPEG_DEC BIT(5)
+
+/* Driver specific controls. */
+#define V4L2_CID_ROCKCHIP_VPU_BASE		(V4L2_CID_USER_BASE | 0x1f00)
+#define V4L2_CID_ROCKCHIP_VPU_SCHED_WEIGHT	(V4L2_CID_ROCKCHIP_VPU_BASE + 0)
+#define V4L2_CID_ROCKCHIP_VPU_BATCH_SIZE	(V4L2_CID_ROCKCHIP_VPU_BASE + 1)
+#define V4L2_CID_ROCKCHIP_VPU_LOW_LATENCY	(V4L2_CID_ROCKCHIP_VPU_BASE + 2)
+
+#define RK_VPU_SCHED_WEIGHT_MIN		1
+#define RK_VPU_SCHED_WEIGHT_MAX		1000
+#define RK_VPU_SCHED_WEIGHT_DEFAULT	100
+
+#define RK_VPU_BATCH_SIZE_MAX		32
+
+/* Autosuspend delay until enough jobs were seen to adapt it. */
+#define RK_VPU_AUTOSUSPEND_DEFAULT_MS	100
 
 /**
  * struct rockchip_vpu_variant - information about VPU hardware variant
@@ -52,10 +81,13 @@ struct rockchip_vpu_codec_ops;
  * @codec:        Supported codecs
  * @codec_ops:    Codec ops.
  * @init:         Initialize hardware.
- * @vepu_irq:     encoder interrupt handler
- * @vdpu_irq:     decoder interrupt handler
+ * @vepu_irq:     encoder hard interrupt handler, acking the hardware and
+ *                latching the result with rockchip_vpu_enc_irq_done()
+ * @vdpu_irq:     decoder hard interrupt handler, acking the hardware and
+ *                latching the result with rockchip_vpu_dec_irq_done()
  * @clocks:       array of clock names
  * @num_clocks:   number of clocks in the array
+ * @aclk_max_freq: maximum frequency of the first clock (ACLK), in Hz
  */
 struct rockchip_vpu_variant {
 	unsigned int enc_offset;
@@ -75,6 +107,7 @@ struct rockchip_vpu_variant {
 
 	const char *clk_names[ROCKCHIP_VPU_MAX_CLOCKS];
 	int num_clocks;
+	unsigned long aclk_max_freq;
 };
 
 /**
@@ -83,12 +116,52 @@ struct rockchip_vpu_variant {
  * @RK_VPU_MODE_JPEG_ENC:  JPEG encoder.
  * @RK_VPU_MODE_H264_DEC:  H264 decoder.
  * @RK_VPU_MODE_VP8_DEC:   VP8 decoder.
+ * @RK_VPU_MODE_H264_ENC:  H264 encoder.
+ * @RK_VPU_MODE_VP8_ENC:   VP8 encoder.
+ * @RK_VPU_MODE_JPEG_DEC:  JPEG decoder.
+ * @RK_VPU_MODE_COUNT:     Number of codec modes.
  */
 enum rockchip_vpu_codec_mode {
 	RK_VPU_MODE_NONE = -1,
 	RK_VPU_MODE_JPEG_ENC,
 	RK_VPU_MODE_H264_DEC,
-	RK_VPU_MODE_VP8_DEC
+	RK_VPU_MODE_VP8_DEC,
+	RK_VPU_MODE_H264_ENC,
+	RK_VPU_MODE_VP8_ENC,
+	RK_VPU_MODE_JPEG_DEC,
+	RK_VPU_MODE_COUNT
+};
+
+/**
+ * enum rockchip_vpu_stamp - timestamps taken during the life of a job
+ * @RK_VPU_STAMP_QUEUED:	Last buffer of the job queued.
+ * @RK_VPU_STAMP_RUN:		Job run by the mem2mem core.
+ * @RK_VPU_STAMP_RESUMED:	Device resumed.
+ * @RK_VPU_STAMP_HW_START:	Registers programmed, hardware started.
+ * @RK_VPU_STAMP_IRQ:		Completion interrupt.
+ * @RK_VPU_STAMP_DONE:		Buffers returned to userspace.
+ * @RK_VPU_NUM_STAMPS:		Number of timestamps.
+ */
+enum rockchip_vpu_stamp {
+	RK_VPU_STAMP_QUEUED,
+	RK_VPU_STAMP_RUN,
+	RK_VPU_STAMP_RESUMED,
+	RK_VPU_STAMP_HW_START,
+	RK_VPU_STAMP_IRQ,
+	RK_VPU_STAMP_DONE,
+	RK_VPU_NUM_STAMPS
+};
+
+/* Latency histogram buckets: < 1us, then < 2^n us. */
+#define RK_VPU_HIST_BUCKETS		24U
+
+/**
+ * struct rockchip_vpu_stats - job latency histograms
+ * @hist:	Number of jobs per codec mode, per stage (indexed by the
+ *		timestamp ending the stage) and per log2 bucket.
+ */
+struct rockchip_vpu_stats {
+	u32 hist[RK_VPU_MODE_COUNT][RK_VPU_NUM_STAMPS][RK_VPU_HIST_BUCKETS];
 };
 
 struct rockchip_vpu_ctrl {
@@ -113,23 +186,180 @@ enum rockchip_vpu_plane {
 	PLANE_CR	= 2,
 };
 
+/**
+ * struct rockchip_vpu_reg_shadow - copy of the registers of one block
+ * @val:	Last value written to each register.
+ * @valid:	Registers for which @val matches the hardware.
+ * @ctx:	Context which programmed the registers.
+ *
+ * Relaxed register writes which would not change the value already
+ * present in the hardware are skipped. Registers are dropped from the
+ * shadow when read back or written with a non-relaxed write, because
+ * those are the ones updated by the hardware itself (status, output
+ * size, start bit...). The whole shadow is invalidated when another
+ * context takes the block, on reset and on runtime PM resume.
+ */
+struct rockchip_vpu_reg_shadow {
+	u32 val[ROCKCHIP_VPU_NUM_REGS];
+	DECLARE_BITMAP(valid, ROCKCHIP_VPU_NUM_REGS);
+	const struct rockchip_vpu_ctx *ctx;
+};
+
+/**
+ * struct rockchip_vpu_watchdog - hang detection of one hardware block
+ * @timer:	Deadline of the running job.
+ * @work:	Recovery work, resetting the block and failing the job.
+ * @armed:	Set while a job runs. Cleared by whichever of the interrupt
+ *		handler and the timer completes the job.
+ * @ctx:	Context of the running job.
+ * @mode:	Codec mode of the running job.
+ * @mbs:	Number of macroblocks of the running job.
+ * @progress:	Hardware progress seen at the last deadline.
+ * @start_ns:	Start time of the running job.
+ * @end_ns:	Completion interrupt time of the last job.
+ * @ns_per_mb:	Moving average of the processing time per macroblock,
+ *		per codec mode. The modes of a block differ by an order of
+ *		magnitude, so that a single estimate would time out an
+ *		H.264 frame after a run of JPEG images.
+ */
+struct rockchip_vpu_watchdog {
+	struct hrtimer timer;
+	struct work_struct work;
+	atomic_t armed;
+	struct rockchip_vpu_ctx *ctx;
+	enum rockchip_vpu_codec_mode mode;
+	unsigned int mbs;
+	u32 progress;
+	u64 start_ns;
+	u64 end_ns;
+	u64 ns_per_mb[RK_VPU_MODE_COUNT];
+};
+
+/* Processing time per macroblock estimated for a codec mode. */
+static inline u64
+rockchip_vpu_watchdog_ns_per_mb(const struct rockchip_vpu_watchdog *wd,
+				enum rockchip_vpu_codec_mode mode)
+{
+	if (WARN_ON_ONCE(mode < 0 || mode >= RK_VPU_MODE_COUNT))
+		mode = 0;
+	return READ_ONCE(wd->ns_per_mb[mode]);
+}
+
+/* Context of the job running on the block, NULL if none. */
+static inline struct rockchip_vpu_ctx *
+rockchip_vpu_watchdog_ctx(struct rockchip_vpu_watchdog *wd)
+{
+	return atomic_read(&wd->armed) ? wd->ctx : NULL;
+}
+
+/* Number of register accesses kept per CPU. Must be a power of 2. */
+#define RK_VPU_REG_RING_SIZE		512
+
+#define RK_VPU_REG_TRACE_DEC		BIT(0)
+#define RK_VPU_REG_TRACE_READ		BIT(1)
+
+/**
+ * struct rockchip_vpu_reg_event - register access recorded at debug level 6
+ * @ts:		Time of the access.
+ * @reg:	Register offset.
+ * @flags:	RK_VPU_REG_TRACE_* flags.
+ * @val:	Value written or read.
+ */
+struct rockchip_vpu_reg_event {
+	u64 ts;
+	u16 reg;
+	u16 flags;
+	u32 val;
+};
+
+/**
+ * struct rockchip_vpu_reg_ring - per-CPU ring of register accesses
+ * @head:	Number of events ever recorded. Updated with local
+ *		operations, so that interrupt handlers can record events
+ *		without any lock.
+ * @events:	Last RK_VPU_REG_RING_SIZE events.
+ */
+struct rockchip_vpu_reg_ring {
+	local_t head;
+	struct rockchip_vpu_reg_event events[RK_VPU_REG_RING_SIZE];
+};
+
+/**
+ * struct rockchip_vpu_sched - weighted fair sharing of one hardware block
+ * @ctxs:	List of contexts using the block. Modified with both @lock
+ *		and rockchip_vpu_dev.irqlock held.
+ * @lock:	Video device lock of the block.
+ * @work:	Work retrying contexts deferred by the scheduler.
+ * @min_vtime:	Smallest virtual time among ready contexts.
+ */
+struct rockchip_vpu_sched {
+	struct list_head ctxs;
+	struct mutex *lock;
+	struct work_struct work;
+	u64 min_vtime;
+};
+
 /**
  * struct rockchip_vpu_dev - driver data
  * @v4l2_dev:		V4L2 device to register video devices for.
- * @m2m_enc_dev: M2M Encoder device. Used with M2M functions.
- * @m2m_dev_dev: M2M Decoder device. Used with M2M functions.
+ * @m2m_enc_dev:	M2M Encoder device. Used with M2M functions.
+ * @m2m_dec_dev:	M2M Decoder device. Used with M2M functions.
  * @vfd_enc:		Video device for encoder.
+ * @vfd_dec:		Video device for decoder.
  * @pdev:		Pointer to VPU platform device.
  * @dev:		Pointer to device for convenient logging using
  *			dev_ macros.
  * @clocks:		Array of clock handles.
  * @base:		Mapped address of VPU registers.
  * @enc_base:		Mapped address of VPU encoder register for convenience.
- * @vpu_mutex:		Mutex to synchronize V4L2 calls.
+ * @dec_base:		Mapped address of VPU decoder register for convenience.
+ * @enc_mutex:		Mutex to synchronize V4L2 calls on the encoder.
+ * @dec_mutex:		Mutex to synchronize V4L2 calls on the decoder.
  * @irqlock:		Spinlock to synchronize access to data structures
  *			shared with interrupt handlers.
  * @variant:		Hardware variant-specific parameters.
- * @watchdog_work:	Delayed work for hardware timeout handling.
+ * @enc_watchdog:	Encoder hang detection.
+ * @dec_watchdog:	Decoder hang detection.
+ * @enc_sched:		Scheduler of the encoder contexts.
+ * @dec_sched:		Scheduler of the decoder contexts.
+ * @enc_shadow:		Shadow of the encoder registers.
+ * @dec_shadow:		Shadow of the decoder registers.
+ * @enc_irq:		Encoder interrupt line, 0 if none.
+ * @dec_irq:		Decoder interrupt line, 0 if none.
+ * @enc_irq_bytesused:	Encoder output size latched by the hard IRQ handler.
+ * @enc_irq_result:	Encoder job result latched by the hard IRQ handler.
+ * @dec_irq_bytesused:	Decoder output size latched by the hard IRQ handler.
+ * @dec_irq_result:	Decoder job result latched by the hard IRQ handler.
+ * @stats:		Job latency histograms.
+ * @debugfs:		Debugfs directory of the device.
+ * @reg_rings:		Per-CPU rings of register accesses, for debug level 6.
+ * @pm_delay_ms:	Current autosuspend delay.
+ * @pm_idle_ns:		End time of the last job. Protected by @irqlock.
+ * @pm_gap_ns:		Moving average of the gaps between jobs. Protected
+ *			by @irqlock.
+ * @pm_resumes:		Number of runtime PM resumes.
+ * @devfreq:		Devfreq device scaling ACLK, NULL if ACLK is pinned.
+ * @devfreq_profile:	Devfreq profile of the device.
+ * @devfreq_window_ns:	Start of the current load measurement window.
+ *			Protected by @irqlock.
+ * @devfreq_enc_busy_ns: Encoder time spent on jobs in the window.
+ *			Protected by @irqlock.
+ * @devfreq_dec_busy_ns: Decoder time spent on jobs in the window.
+ *			Protected by @irqlock.
+ * @devfreq_dynamic_opps: The operating points were not found in the device
+ *			tree and were added by the driver.
+ * @h264_dec_tbl:	H.264 decoder table (CABAC, POC and scaling lists),
+ *			shared by the decoder contexts. Allocated when the
+ *			first context starts streaming, under @dec_mutex.
+ * @h264_enc_cabac:	CABAC context states for every QP, shared by the
+ *			H.264 encoder contexts. Allocated when the first
+ *			context starts streaming, under @enc_mutex.
+ * @dmabuf_lock:	Protects the cache of imported buffers.
+ * @dmabuf_lru:		Cached attachments of imported buffers, most
+ *			recently used first.
+ * @dmabuf_hits:	Imported buffers queued with a cached mapping.
+ * @dmabuf_misses:	Imported buffers that had to be mapped.
+ * @dmabuf_evictions:	Cached attachments dropped.
  */
 struct rockchip_vpu_dev {
 	struct v4l2_device v4l2_dev;
@@ -145,24 +375,81 @@ struct rockchip_vpu_dev {
 	void __iomem *enc_base;
 	void __iomem *dec_base;
 
-	struct mutex vpu_mutex;	/* video_device lock */
+	struct mutex enc_mutex;	/* encoder video_device lock */
+	struct mutex dec_mutex;	/* decoder video_device lock */
 	spinlock_t irqlock;
 	const struct rockchip_vpu_variant *variant;
-	struct delayed_work watchdog_work;
+	struct rockchip_vpu_watchdog enc_watchdog;
+	struct rockchip_vpu_watchdog dec_watchdog;
+	struct rockchip_vpu_sched enc_sched;
+	struct rockchip_vpu_sched dec_sched;
+	struct rockchip_vpu_reg_shadow enc_shadow;
+	struct rockchip_vpu_reg_shadow dec_shadow;
+	int enc_irq;
+	int dec_irq;
+	unsigned int enc_irq_bytesused;
+	enum vb2_buffer_state enc_irq_result;
+	unsigned int dec_irq_bytesused;
+	enum vb2_buffer_state dec_irq_result;
+	struct rockchip_vpu_stats stats;
+	struct dentry *debugfs;
+	struct rockchip_vpu_reg_ring __percpu *reg_rings;
+	unsigned int pm_delay_ms;
+	u64 pm_idle_ns;
+	u64 pm_gap_ns;
+	u64 pm_resumes;
+	struct devfreq *devfreq;
+	struct devfreq_dev_profile devfreq_profile;
+	u64 devfreq_window_ns;
+	u64 devfreq_enc_busy_ns;
+	u64 devfreq_dec_busy_ns;
+	bool devfreq_dynamic_opps;
+	struct rockchip_vpu_aux_buf h264_dec_tbl;
+	struct rockchip_vpu_aux_buf h264_enc_cabac;
+	struct mutex dmabuf_lock;
+	struct list_head dmabuf_lru;
+	u64 dmabuf_hits;
+	u64 dmabuf_misses;
+	u64 dmabuf_evictions;
 };
 
 /**
- * struct rockchip_vpu_aux_buf - auxiliary DMA buffer for hardware data
- * @cpu:        CPU pointer to the buffer.
- * @dma:        DMA address of the buffer.
- * @size:       Size of the buffer.
+ * struct rockchip_vpu_reg - entry of a register image
+ * @reg:	Register offset.
+ * @val:	Value to write.
  */
-struct rockchip_vpu_aux_buf {
-	void *cpu;
-	dma_addr_t dma;
-	size_t size;
+struct rockchip_vpu_reg {
+	u32 reg;
+	u32 val;
 };
 
+/* Size of the register images of the contexts and of the buffers. */
+#define RK_VPU_CTX_REGS			128
+#define RK_VPU_BUF_REGS			4
+
+/**
+ * struct rockchip_vpu_buf - private data of the V4L2 buffers
+ * @m2m_buf:	mem2mem buffer. Must be first.
+ * @queued_ns:	Time at which the buffer was queued to the driver.
+ * @regs:	Register image of the buffer (addresses, sizes), built by
+ *		rockchip_vpu_codec_ops.prepare_buf.
+ * @num_regs:	Number of entries in @regs.
+ * @regs_ops:	Codec operations which built @regs, NULL if not built.
+ */
+struct rockchip_vpu_buf {
+	struct v4l2_m2m_buffer m2m_buf;
+	u64 queued_ns;
+	struct rockchip_vpu_reg regs[RK_VPU_BUF_REGS];
+	unsigned int num_regs;
+	const struct rockchip_vpu_codec_ops *regs_ops;
+};
+
+static inline struct rockchip_vpu_buf *rockchip_vpu_get_buf(struct vb2_buffer *vb)
+{
+	return container_of(to_vb2_v4l2_buffer(vb), struct rockchip_vpu_buf,
+			    m2m_buf.vb);
+}
+
 /**
  * struct rockchip_vpu_ctx - Context (instance) private data.
  *
@@ -183,6 +470,49 @@ struct rockchip_vpu_aux_buf {
  * @num_ctrls:		Number of registered controls.
  *
  * @codec_ops:		Set of operations related to codec mode.
+ *
+ * @shadow:		Register shadow of the hardware block used by the context.
+ * @sched:		Scheduler of the hardware block used by the context.
+ * @sched_node:		Entry in the scheduler context list.
+ * @sched_weight:	Share of the hardware block, relative to
+ *			RK_VPU_SCHED_WEIGHT_DEFAULT.
+ * @sched_vtime:	Hardware time used, scaled by the inverse of the weight.
+ * @sched_hw_time_ns:	Hardware time used, in nanoseconds.
+ * @sched_start_ns:	Start time of the running job.
+ * @sched_running:	A job of this context is running on the hardware.
+ * @sched_deferred:	The scheduler refused to queue a job of this context.
+ *
+ * @batch_size:		Maximum number of buffer pairs processed by one job.
+ * @batch_count:	Number of buffer pairs completed by the running job.
+ * @batch_abort:	The running job must stop after the current pair.
+ *
+ * @job_stamps:		Timestamps of the running job, for the latency
+ *			histograms.
+ *
+ * @regs:		Register image of the context, built by
+ *			rockchip_vpu_codec_ops.prepare from the formats and
+ *			controls.
+ * @num_regs:		Number of entries in @regs.
+ * @start_reg:		Value written to start the hardware.
+ * @regs_dirty:		@regs must be rebuilt before the next job.
+ *
+ * @pm_low_latency:	Keep the device powered while streaming.
+ * @pm_held:		A runtime PM reference is held until STREAMOFF.
+ *
+ * @timeperframe:	Frame interval declared with VIDIOC_S_PARM, zero if
+ *			none was declared. Read by the ACLK scaling with
+ *			rockchip_vpu_dev.irqlock held.
+ *
+ * @h264_dec:		H.264 decoder state, set up by
+ *			rockchip_vpu_codec_ops.init.
+ * @vp8_dec:		VP8 decoder state, set up by
+ *			rockchip_vpu_codec_ops.init.
+ * @h264_enc:		H.264 encoder state, set up by
+ *			rockchip_vpu_codec_ops.init.
+ * @vp8_enc:		VP8 encoder state, set up by
+ *			rockchip_vpu_codec_ops.init.
+ * @jpeg_dec:		JPEG decoder state, set up by
+ *			rockchip_vpu_codec_ops.init.
  */
 struct rockchip_vpu_ctx {
 	struct rockchip_vpu_dev *dev;
@@ -190,6 +520,7 @@ struct rockchip_vpu_ctx {
 
 	u32 sequence_cap;
 	u32 sequence_out;
+	enum rockchip_vpu_codec_mode codec_mode;
 
 	/* Format info */
 	const struct rockchip_vpu_fmt *vpu_src_fmt;
@@ -209,8 +540,66 @@ struct rockchip_vpu_ctx {
 
 	const struct rockchip_vpu_codec_ops *codec_ops;
 	struct vb2_buffer *dst_bufs[VIDEO_MAX_FRAME];
+
+	struct rockchip_vpu_reg_shadow *shadow;
+
+	/* Scheduling */
+	struct rockchip_vpu_sched *sched;
+	struct list_head sched_node;
+	u32 sched_weight;
+	u64 sched_vtime;
+	u64 sched_hw_time_ns;
+	u64 sched_start_ns;
+	bool sched_running;
+	bool sched_deferred;
+
+	/* Batching */
+	u32 batch_size;
+	u32 batch_count;
+	bool batch_abort;
+
+	u64 job_stamps[RK_VPU_NUM_STAMPS];
+
+	/* Register image */
+	struct rockchip_vpu_reg regs[RK_VPU_CTX_REGS];
+	unsigned int num_regs;
+	u32 start_reg;
+	bool regs_dirty;
+
+	/* Power management */
+	bool pm_low_latency;
+	bool pm_held;
+
+	struct v4l2_fract timeperframe;
+
+	/* Codec state */
+	union {
+		struct rockchip_vpu_h264_dec_hw_ctx h264_dec;
+		struct rockchip_vpu_vp8_dec_hw_ctx vp8_dec;
+		struct rockchip_vpu_h264_enc_hw_ctx h264_enc;
+		struct rockchip_vpu_vp8_enc_hw_ctx vp8_enc;
+		struct rockchip_vpu_jpeg_dec_hw_ctx jpeg_dec;
+	};
 };
 
+static inline void rockchip_vpu_ctx_reg(struct rockchip_vpu_ctx *ctx,
+					u32 reg, u32 val)
+{
+	if (WARN_ON(ctx->num_regs >= RK_VPU_CTX_REGS))
+		return;
+	ctx->regs[ctx->num_regs].reg = reg;
+	ctx->regs[ctx->num_regs++].val = val;
+}
+
+static inline void rockchip_vpu_buf_reg(struct rockchip_vpu_buf *buf,
+					u32 reg, u32 val)
+{
+	if (WARN_ON(buf->num_regs >= RK_VPU_BUF_REGS))
+		return;
+	buf->regs[buf->num_regs].reg = reg;
+	buf->regs[buf->num_regs++].val = val;
+}
+
 /**
  * struct rockchip_vpu_fmt - information about supported video formats.
  * @name:	Human readable name of the format.
@@ -251,13 +640,24 @@ struct rockchip_vpu_fmt {
  * bit 3 - contents of big controls from userspace
  * bit 4 - detail fmt, ctrl, buffer q/dq information
  * bit 5 - detail function enter/leave trace information
- * bit 6 - register write/read information
+ * bit 6 - register write/read information, recorded in a per-CPU ring
+ *         readable from <debugfs>/<device>/regs
+ *
+ * Each bit flips a static key, so disabled levels cost a patched-out
+ * branch instead of a load and test of the parameter.
  */
+#define ROCKCHIP_VPU_DEBUG_LEVELS	8
+#define ROCKCHIP_VPU_DEBUG_REGS		6
+
 extern int rockchip_vpu_debug;
+extern struct static_key_false rockchip_vpu_debug_keys[ROCKCHIP_VPU_DEBUG_LEVELS];
+
+#define vpu_debug_enabled(level)					\
+	static_branch_unlikely(&rockchip_vpu_debug_keys[level])
 
 #define vpu_debug(level, fmt, args...)				\
 	do {							\
-		if (rockchip_vpu_debug & BIT(level))		\
+		if (vpu_debug_enabled(level))			\
 			pr_info("%s:%d: " fmt,	                \
 				 __func__, __LINE__, ##args);	\
 	} while (0)
@@ -291,17 +691,67 @@ static inline unsigned int rockchip_vpu_rounded_luma_size(unsigned int w,
 
 int rockchip_vpu_enc_ctrls_setup(struct rockchip_vpu_ctx *ctx);
 
+/* Register shadow helpers. */
+static inline bool rockchip_vpu_shadow_hit(struct rockchip_vpu_reg_shadow *shadow,
+					   u32 val, u32 reg)
+{
+	unsigned int i = reg / 4;
+
+	if (test_bit(i, shadow->valid) && shadow->val[i] == val)
+		return true;
+	shadow->val[i] = val;
+	__set_bit(i, shadow->valid);
+	return false;
+}
+
+static inline void rockchip_vpu_shadow_forget(struct rockchip_vpu_reg_shadow *shadow,
+					      u32 reg)
+{
+	__clear_bit(reg / 4, shadow->valid);
+}
+
+static inline void rockchip_vpu_shadow_invalidate(struct rockchip_vpu_reg_shadow *shadow)
+{
+	bitmap_zero(shadow->valid, ROCKCHIP_VPU_NUM_REGS);
+	shadow->ctx = NULL;
+}
+
+/*
+ * Start programming the registers for a job of ctx. The shadow is only
+ * trusted if the previous job came from the same context.
+ */
+static inline void rockchip_vpu_shadow_claim(struct rockchip_vpu_ctx *ctx)
+{
+	if (ctx->shadow->ctx != ctx) {
+		rockchip_vpu_shadow_invalidate(ctx->shadow);
+		ctx->shadow->ctx = ctx;
+	}
+}
+
+void rockchip_vpu_reg_trace(struct rockchip_vpu_dev *vpu, unsigned int flags,
+			    u32 reg, u32 val);
+
+static inline void vpu_trace_reg(struct rockchip_vpu_dev *vpu,
+				 unsigned int flags, u32 reg, u32 val)
+{
+	if (vpu_debug_enabled(ROCKCHIP_VPU_DEBUG_REGS))
+		rockchip_vpu_reg_trace(vpu, flags, reg, val);
+}
+
 /* Register accessors. */
 static inline void vepu_write_relaxed(struct rockchip_vpu_dev *vpu,
 				       u32 val, u32 reg)
 {
-	vpu_debug(6, "MARK: set reg[%03d]: %08x\n", reg / 4, val);
+	if (rockchip_vpu_shadow_hit(&vpu->enc_shadow, val, reg))
+		return;
+	vpu_trace_reg(vpu, 0, reg, val);
 	writel_relaxed(val, vpu->enc_base + reg);
 }
 
 static inline void vepu_write(struct rockchip_vpu_dev *vpu, u32 val, u32 reg)
 {
-	vpu_debug(6, "MARK: set reg[%03d]: %08x\n", reg / 4, val);
+	rockchip_vpu_shadow_forget(&vpu->enc_shadow, reg);
+	vpu_trace_reg(vpu, 0, reg, val);
 	writel(val, vpu->enc_base + reg);
 }
 
@@ -309,7 +759,8 @@ static inline u32 vepu_read(struct rockchip_vpu_dev *vpu, u32 reg)
 {
 	u32 val = readl(vpu->enc_base + reg);
 
-	vpu_debug(6, "MARK: get reg[%03d]: %08x\n", reg / 4, val);
+	rockchip_vpu_shadow_forget(&vpu->enc_shadow, reg);
+	vpu_trace_reg(vpu, RK_VPU_REG_TRACE_READ, reg, val);
 	return val;
 }
 
@@ -317,7 +768,9 @@ static inline void vdpu_write_relaxed(
 	struct rockchip_vpu_dev *vpu,
 	u32 val, u32 reg)
 {
-	vpu_debug(6, "MARK: Decoder - set reg[%03d]: %08x\n", reg / 4, val);
+	if (rockchip_vpu_shadow_hit(&vpu->dec_shadow, val, reg))
+		return;
+	vpu_trace_reg(vpu, RK_VPU_REG_TRACE_DEC, reg, val);
 	writel_relaxed(val, vpu->dec_base + reg);
 }
 
@@ -325,16 +778,51 @@ static inline void vdpu_write(
 	struct rockchip_vpu_dev *vpu,
 	u32 val, u32 reg)
 {
-	vpu_debug(6, "MARK: Decoder - set reg[%03d]: %08x\n", reg / 4, val);
+	rockchip_vpu_shadow_forget(&vpu->dec_shadow, reg);
+	vpu_trace_reg(vpu, RK_VPU_REG_TRACE_DEC, reg, val);
 	writel(val, vpu->dec_base + reg);
 }
 
-static inline void vdpu_read(struct rockchip_vpu_dev *vpu, u32 reg)
+static inline void vepu_write_regs(struct rockchip_vpu_dev *vpu,
+				   const struct rockchip_vpu_reg *regs,
+				   unsigned int num_regs)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_regs; i++)
+		vepu_write_relaxed(vpu, regs[i].val, regs[i].reg);
+}
+
+static inline void vepu_write_buf_regs(struct rockchip_vpu_dev *vpu,
+				       const struct rockchip_vpu_buf *buf)
+{
+	vepu_write_regs(vpu, buf->regs, buf->num_regs);
+}
+
+static inline void vdpu_write_regs(struct rockchip_vpu_dev *vpu,
+				   const struct rockchip_vpu_reg *regs,
+				   unsigned int num_regs)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_regs; i++)
+		vdpu_write_relaxed(vpu, regs[i].val, regs[i].reg);
+}
+
+static inline void vdpu_write_buf_regs(struct rockchip_vpu_dev *vpu,
+				       const struct rockchip_vpu_buf *buf)
+{
+	vdpu_write_regs(vpu, buf->regs, buf->num_regs);
+}
+
+static inline u32 vdpu_read(struct rockchip_vpu_dev *vpu, u32 reg)
 {
 	u32 val = readl(vpu->dec_base + reg);
 
-	vpu_debug(6, "MARK: Decoder - get reg[%03d]: %08x\n", reg / 4, val);
-	writel_relaxed(val, vpu->dec_base + reg);
+	rockchip_vpu_shadow_forget(&vpu->dec_shadow, reg);
+	vpu_trace_reg(vpu, RK_VPU_REG_TRACE_DEC | RK_VPU_REG_TRACE_READ,
+		      reg, val);
+	return val;
 }
 
 
@@ -22,7 +22,7 @@ extern const struct v4l2_ioctl_ops rockchip_vpu_enc_ioctl_ops;
 extern const struct vb2_ops rockchip_vpu_enc_queue_ops;
 
 extern const struct v4l2_ioctl_ops rockchip_vpu_dec_ioctl_ops;
-//extern const struct vb2_ops rockchip_vpu_dec_queue_ops;
+extern const struct vb2_ops rockchip_vpu_dec_queue_ops;
 
 void *rockchip_vpu_find_control_data(struct rockchip_vpu_ctx *ctx,
 				unsigned int id);
@@ -30,5 +30,52 @@ void rockchip_vpu_enc_reset_src_fmt(struct rockchip_vpu_dev *vpu,
 				struct rockchip_vpu_ctx *ctx);
 void rockchip_vpu_enc_reset_dst_fmt(struct rockchip_vpu_dev *vpu,
 				struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_dec_reset_fmts(struct rockchip_vpu_dev *vpu,
+				struct rockchip_vpu_ctx *ctx);
+
+void rockchip_vpu_sched_init(struct rockchip_vpu_sched *sched,
+			     struct mutex *lock);
+void rockchip_vpu_sched_add_ctx(struct rockchip_vpu_sched *sched,
+				struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_sched_del_ctx(struct rockchip_vpu_ctx *ctx);
+int rockchip_vpu_sched_job_ready(void *priv);
+bool rockchip_vpu_sched_may_continue(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_sched_job_start(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_sched_job_done(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_sched_set_weight(struct rockchip_vpu_ctx *ctx, u32 weight);
+
+void rockchip_vpu_prepare_regs(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_prepare_buf_regs(struct rockchip_vpu_ctx *ctx,
+				   struct vb2_buffer *vb);
+
+void rockchip_vpu_pm_init(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_pm_debugfs_init(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_pm_job_start(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_pm_job_end(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_pm_stream_on(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_pm_stream_off(struct rockchip_vpu_ctx *ctx);
+
+extern const struct vb2_mem_ops rockchip_vpu_mem_ops;
+void rockchip_vpu_mem_set_cache_hints(struct vb2_buffer *vb);
+
+void rockchip_vpu_dmabuf_init(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_dmabuf_flush(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_dmabuf_debugfs_init(struct rockchip_vpu_dev *vpu);
+
+void rockchip_vpu_devfreq_init(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_devfreq_cleanup(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_devfreq_job_done(struct rockchip_vpu_dev *vpu,
+				   const struct rockchip_vpu_watchdog *wd);
+void rockchip_vpu_devfreq_set_timeperframe(struct rockchip_vpu_ctx *ctx,
+					   const struct v4l2_fract *tpf);
+
+void rockchip_vpu_debug_init(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_debug_cleanup(struct rockchip_vpu_dev *vpu);
+
+void rockchip_vpu_stats_init(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_stats_cleanup(struct rockchip_vpu_dev *vpu);
+void rockchip_vpu_stats_job_start(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_stats_job_done(struct rockchip_vpu_ctx *ctx,
+				 const struct rockchip_vpu_watchdog *wd);
 
 #endif /* ROCKCHIP_VPU_COMMON_H_ */
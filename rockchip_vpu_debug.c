@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * Debug levels and register access tracing.
+ *
+ * Every bit of the "debug" module parameter is mirrored in a static
+ * key, so that vpu_debug() and the register accessors only pay a
+ * patched-out branch when the level is disabled.
+ *
+ * Register accesses (level 6) are recorded in a per-CPU ring instead of
+ * the kernel log, and dumped from <debugfs>/<device>/regs.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+
+int rockchip_vpu_debug;
+DEFINE_STATIC_KEY_ARRAY_FALSE(rockchip_vpu_debug_keys,
+			      ROCKCHIP_VPU_DEBUG_LEVELS);
+
+static int rockchip_vpu_debug_set(const char *val,
+				  const struct kernel_param *kp)
+{
+	unsigned int i;
+	int ret;
+
+	ret = param_set_int(val, kp);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ROCKCHIP_VPU_DEBUG_LEVELS; i++) {
+		if (rockchip_vpu_debug & BIT(i))
+			static_branch_enable(&rockchip_vpu_debug_keys[i]);
+		else
+			static_branch_disable(&rockchip_vpu_debug_keys[i]);
+	}
+	return 0;
+}
+
+static const struct kernel_param_ops rockchip_vpu_debug_ops = {
+	.set = rockchip_vpu_debug_set,
+	.get = param_get_int,
+};
+
+module_param_cb(debug, &rockchip_vpu_debug_ops, &rockchip_vpu_debug, 0644);
+MODULE_PARM_DESC(debug,
+		 "Debug level - higher value produces more verbose messages");
+
+/* Called from any context, including hard interrupt handlers. */
+void rockchip_vpu_reg_trace(struct rockchip_vpu_dev *vpu, unsigned int flags,
+			    u32 reg, u32 val)
+{
+	struct rockchip_vpu_reg_event *ev;
+	struct rockchip_vpu_reg_ring *ring;
+	long idx;
+
+	if (!vpu->reg_rings)
+		return;
+
+	ring = get_cpu_ptr(vpu->reg_rings);
+	idx = local_inc_return(&ring->head) - 1;
+	ev = &ring->events[idx & (RK_VPU_REG_RING_SIZE - 1)];
+	ev->ts = ktime_get_ns();
+	ev->reg = reg;
+	ev->flags = flags;
+	ev->val = val;
+	put_cpu_ptr(vpu->reg_rings);
+}
+
+static int rockchip_vpu_regs_show(struct seq_file *s, void *data)
+{
+	struct rockchip_vpu_dev *vpu = s->private;
+	struct rockchip_vpu_reg_event *ev;
+	struct rockchip_vpu_reg_ring *ring;
+	long head, first, i;
+	int cpu;
+
+	seq_puts(s, "# cpu timestamp_ns block access reg value\n");
+	for_each_possible_cpu(cpu) {
+		ring = per_cpu_ptr(vpu->reg_rings, cpu);
+		head = local_read(&ring->head);
+		first = max(0L, head - RK_VPU_REG_RING_SIZE);
+		for (i = first; i < head; i++) {
+			ev = &ring->events[i & (RK_VPU_REG_RING_SIZE - 1)];
+			seq_printf(s, "%d %llu %s %s reg[%03d] %08x\n",
+				   cpu, ev->ts,
+				   ev->flags & RK_VPU_REG_TRACE_DEC ?
+				   "vdpu" : "vepu",
+				   ev->flags & RK_VPU_REG_TRACE_READ ?
+				   "get" : "set",
+				   ev->reg / 4, ev->val);
+		}
+	}
+	return 0;
+}
+
+static int rockchip_vpu_regs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rockchip_vpu_regs_show, inode->i_private);
+}
+
+static const struct file_operations rockchip_vpu_regs_fops = {
+	.owner = THIS_MODULE,
+	.open = rockchip_vpu_regs_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Must be called after rockchip_vpu_stats_init() created the directory. */
+void rockchip_vpu_debug_init(struct rockchip_vpu_dev *vpu)
+{
+	if (!vpu->debugfs)
+		return;
+
+	vpu->reg_rings = alloc_percpu(struct rockchip_vpu_reg_ring);
+	if (!vpu->reg_rings) {
+		dev_warn(vpu->dev, "Could not allocate register trace rings\n");
+		return;
+	}
+
+	debugfs_create_file("regs", 0444, vpu->debugfs, vpu,
+			    &rockchip_vpu_regs_fops);
+}
+
+/*
+ * Must be called after the debugfs directory was removed, and once
+ * neither the interrupt handlers nor the watchdogs can run anymore.
+ */
+void rockchip_vpu_debug_cleanup(struct rockchip_vpu_dev *vpu)
+{
+	struct rockchip_vpu_reg_ring __percpu *rings = vpu->reg_rings;
+
+	vpu->reg_rings = NULL;
+	free_percpu(rings);
+}
@@ -5,6 +5,7 @@
 #include <media/v4l2-event.h>
 
 #include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
 
 static const struct rockchip_vpu_fmt *
 rockchip_vpu_find_format(
@@ -23,6 +24,23 @@ rockchip_vpu_find_format(
 	return NULL;
 }
 
+static const struct rockchip_vpu_fmt *
+rockchip_vpu_get_default_fmt(
+	struct rockchip_vpu_ctx* __restrict const ctx,
+	bool bitstream)
+{
+	struct rockchip_vpu_dev *dev = ctx->dev;
+	const struct rockchip_vpu_fmt *formats;
+	unsigned int num_fmts, i;
+
+	formats = dev->variant->dec_fmts;
+	num_fmts = dev->variant->num_dec_fmts;
+	for (i = 0; i < num_fmts; i++)
+		if (bitstream == (formats[i].codec_mode != RK_VPU_MODE_NONE))
+			return &formats[i];
+	return NULL;
+}
+
 static int vidioc_querycap(
 	struct file* __restrict const file,
 	void* __restrict const priv,
@@ -76,18 +94,19 @@ static int vidioc_enum_framesizes(
 static int rockchip_vpu_enum_fmt(
 	struct file* __restrict const file,
 	void* __restrict const priv,
-	struct v4l2_fmtdesc* const f)
+	struct v4l2_fmtdesc* const f,
+	bool bitstream)
 {
 	struct rockchip_vpu_dev *dev = video_drvdata(file);
 	const struct rockchip_vpu_fmt *fmt;
 	const struct rockchip_vpu_fmt *formats;
 	int num_fmts, i, j = 0;
 
-	formats = dev->variant->enc_fmts;
-	num_fmts = dev->variant->num_enc_fmts;
+	formats = dev->variant->dec_fmts;
+	num_fmts = dev->variant->num_dec_fmts;
 	for (i = 0; i < num_fmts; i++) {
-		/* Skip uncompressed formats */
-		if (formats[i].codec_mode == RK_VPU_MODE_NONE)
+		/* Bitstream formats go on OUTPUT, raw ones on CAPTURE */
+		if (bitstream != (formats[i].codec_mode != RK_VPU_MODE_NONE))
 			continue;
 		if (j == f->index) {
 			fmt = &formats[i];
@@ -104,7 +123,7 @@ static int vidioc_enum_fmt_vid_cap_mplane(
 	void* __restrict const priv,
 	struct v4l2_fmtdesc* __restrict const f)
 {
-	return rockchip_vpu_enum_fmt(file, priv, f);
+	return rockchip_vpu_enum_fmt(file, priv, f, false);
 }
 
 static int vidioc_enum_fmt_vid_out_mplane(
@@ -112,7 +131,7 @@ static int vidioc_enum_fmt_vid_out_mplane(
 	void* __restrict const priv,
 	struct v4l2_fmtdesc* __restrict const f)
 {
-	return rockchip_vpu_enum_fmt(file, priv, f);
+	return rockchip_vpu_enum_fmt(file, priv, f, true);
 }
 
 static int vidioc_g_fmt_out(struct file *file, void *priv,
@@ -189,7 +208,7 @@ vidioc_try_fmt_cap(struct file *file, void *priv, struct v4l2_format *f)
 	const struct rockchip_vpu_fmt *fmt;
 	char str[5];
 	struct v4l2_frmsize_stepwise const * __restrict const frame_limits =
-		&(ctx->vpu_dst_fmt->frmsize);
+		&(ctx->vpu_src_fmt->frmsize);
 	__u32 rounded_width, rounded_height;
 	unsigned long dma_align;
 	bool need_alignment;
@@ -215,6 +234,13 @@ vidioc_try_fmt_cap(struct file *file, void *priv, struct v4l2_format *f)
 		return -EINVAL;
 	}
 
+	/* Only 4:2:2 JPEG images decode to 4:2:2 frames. */
+	if (fmt->fourcc == V4L2_PIX_FMT_NV16 &&
+	    ctx->vpu_src_fmt->codec_mode != RK_VPU_MODE_JPEG_DEC) {
+		vpu_err("NV16 is only supported by the JPEG decoder\n");
+		return -EINVAL;
+	}
+
 	/* FIXME Does that make sense ?
 	 * On RockMyy kernels, dma_align == 64
 	 * If the frame is a 1080p video frame, then the height is
@@ -357,6 +383,68 @@ static int vidioc_s_fmt_cap(struct file *file, void *priv, struct v4l2_format *f
 	return 0;
 }
 
+void rockchip_vpu_dec_reset_fmts(struct rockchip_vpu_dev *vpu,
+				struct rockchip_vpu_ctx *ctx)
+{
+	ctx->vpu_src_fmt = rockchip_vpu_get_default_fmt(ctx, true);
+	ctx->vpu_dst_fmt = rockchip_vpu_get_default_fmt(ctx, false);
+
+	memset(&ctx->src_fmt, 0, sizeof(ctx->src_fmt));
+	memset(&ctx->dst_fmt, 0, sizeof(ctx->dst_fmt));
+
+	ctx->src_fmt.pixelformat = ctx->vpu_src_fmt->fourcc;
+	ctx->src_fmt.num_planes = ctx->vpu_src_fmt->num_planes;
+	ctx->src_fmt.field = V4L2_FIELD_NONE;
+
+	ctx->dst_fmt.pixelformat = ctx->vpu_dst_fmt->fourcc;
+	ctx->dst_fmt.num_planes = ctx->vpu_dst_fmt->num_planes;
+	ctx->dst_fmt.field = V4L2_FIELD_NONE;
+}
+
+static struct v4l2_fract *vidioc_parm_timeperframe(struct v4l2_streamparm *a)
+{
+	switch (a->type) {
+	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
+		a->parm.output.capability = V4L2_CAP_TIMEPERFRAME;
+		return &a->parm.output.timeperframe;
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
+		a->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+		return &a->parm.capture.timeperframe;
+	default:
+		return NULL;
+	}
+}
+
+/* A zero frame interval means that none was declared. */
+static int vidioc_g_parm(struct file *file, void *priv,
+			 struct v4l2_streamparm *a)
+{
+	struct rockchip_vpu_ctx *ctx = fh_to_ctx(priv);
+	struct v4l2_fract *tpf = vidioc_parm_timeperframe(a);
+
+	if (!tpf)
+		return -EINVAL;
+	*tpf = ctx->timeperframe;
+	return 0;
+}
+
+/*
+ * The frame rate of both queues is the same. It is only used to choose
+ * the ACLK frequency.
+ */
+static int vidioc_s_parm(struct file *file, void *priv,
+			 struct v4l2_streamparm *a)
+{
+	struct rockchip_vpu_ctx *ctx = fh_to_ctx(priv);
+	struct v4l2_fract *tpf = vidioc_parm_timeperframe(a);
+
+	if (!tpf)
+		return -EINVAL;
+	rockchip_vpu_devfreq_set_timeperframe(ctx, tpf);
+	*tpf = ctx->timeperframe;
+	return 0;
+}
+
 const struct v4l2_ioctl_ops rockchip_vpu_dec_ioctl_ops = {
 	.vidioc_querycap = vidioc_querycap,
 	.vidioc_enum_framesizes = vidioc_enum_framesizes,
@@ -370,6 +458,9 @@ const struct v4l2_ioctl_ops rockchip_vpu_dec_ioctl_ops = {
 	.vidioc_enum_fmt_vid_out_mplane = vidioc_enum_fmt_vid_out_mplane,
 	.vidioc_enum_fmt_vid_cap_mplane = vidioc_enum_fmt_vid_cap_mplane,
 
+	.vidioc_g_parm = vidioc_g_parm,
+	.vidioc_s_parm = vidioc_s_parm,
+
 	.vidioc_reqbufs = v4l2_m2m_ioctl_reqbufs,
 	.vidioc_querybuf = v4l2_m2m_ioctl_querybuf,
 	.vidioc_qbuf = v4l2_m2m_ioctl_qbuf,
@@ -398,7 +489,7 @@ static int rockchip_vpu_queue_setup(struct vb2_queue *vq,
 				  unsigned int sizes[],
 				  struct device *alloc_devs[])
 {
-	struct rockchip_vpu_ctx *ctx = fh_to_ctx(vq->drv_priv);
+	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(vq);
 
 	switch (vq->type) {
 	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
@@ -425,7 +516,7 @@ static int rockchip_vpu_queue_setup(struct vb2_queue *vq,
 
 		sizes[0] = round_up(ctx->dst_fmt.plane_fmt[0].sizeimage, 8);
 
-		if (ctx->vpu_src_fmt->fourcc == V4L2_PIX_FMT_H264)
+		if (ctx->vpu_src_fmt->fourcc == V4L2_PIX_FMT_H264_SLICE)
 			/* Add space for appended motion vectors. */
 			sizes[0] += 64 * MB_WIDTH(ctx->dst_fmt.width)
 					* MB_HEIGHT(ctx->dst_fmt.height);
@@ -444,7 +535,7 @@ static int rockchip_vpu_queue_setup(struct vb2_queue *vq,
 static int rockchip_vpu_buf_prepare(struct vb2_buffer *vb)
 {
 	struct vb2_queue *vq = vb->vb2_queue;
-	struct rockchip_vpu_ctx *ctx = fh_to_ctx(vq->drv_priv);
+	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(vq);
 	int i;
 
 	switch (vq->type) {
@@ -487,6 +578,8 @@ static int rockchip_vpu_buf_prepare(struct vb2_buffer *vb)
 		return -EINVAL;
 	}
 
+	rockchip_vpu_mem_set_cache_hints(vb);
+	rockchip_vpu_prepare_buf_regs(ctx, vb);
 	return 0;
 }
 
@@ -494,7 +587,10 @@ static void rockchip_vpu_buf_queue(struct vb2_buffer *vb)
 {
 	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
 	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct rockchip_vpu_buf *buf =
+		container_of(vbuf, struct rockchip_vpu_buf, m2m_buf.vb);
 
+	buf->queued_ns = ktime_get_ns();
 	v4l2_m2m_buf_queue(ctx->fh.m2m_ctx, vbuf);
 }
 
@@ -504,6 +600,8 @@ static int rockchip_vpu_start_streaming(
 {
 	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(q);
 	enum rockchip_vpu_codec_mode codec_mode;
+	struct vb2_v4l2_buffer *vbuf;
+	int ret;
 
 	/* TODO Does this make any sense for H264 ? */
 	if (V4L2_TYPE_IS_OUTPUT(q->type))
@@ -511,11 +609,25 @@ static int rockchip_vpu_start_streaming(
 	else
 		ctx->sequence_cap = 0;
 
-	/* Set codec_ops for the chosen destination format */
-	codec_mode = ctx->vpu_dst_fmt->codec_mode;
+	/* Set codec_ops for the chosen bitstream (source) format */
+	codec_mode = ctx->vpu_src_fmt->codec_mode;
 
 	vpu_debug(4, "Codec mode = %d\n", codec_mode);
+	ctx->codec_mode = codec_mode;
 	ctx->codec_ops = &ctx->dev->variant->codec_ops[codec_mode];
+
+	/* The codec state lives as long as the bitstream queue streams. */
+	if (V4L2_TYPE_IS_OUTPUT(q->type) && ctx->codec_ops->init) {
+		ret = ctx->codec_ops->init(ctx);
+		if (ret) {
+			while ((vbuf = v4l2_m2m_src_buf_remove(ctx->fh.m2m_ctx)))
+				v4l2_m2m_buf_done(vbuf, VB2_BUF_STATE_QUEUED);
+			return ret;
+		}
+	}
+
+	rockchip_vpu_prepare_regs(ctx);
+	rockchip_vpu_pm_stream_on(ctx);
 	return 0;
 }
 
@@ -524,6 +636,10 @@ static void rockchip_vpu_stop_streaming(
 {
 	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(q);
 
+	rockchip_vpu_pm_stream_off(ctx);
+	if (V4L2_TYPE_IS_OUTPUT(q->type) && ctx->codec_ops->exit)
+		ctx->codec_ops->exit(ctx);
+
 	/* The mem2mem framework calls v4l2_m2m_cancel_job before
 	 * .stop_streaming, so there isn't any job running and
 	 * it is safe to return all the buffers.
@@ -537,16 +653,26 @@ static void rockchip_vpu_stop_streaming(
 			vbuf = v4l2_m2m_dst_buf_remove(ctx->fh.m2m_ctx);
 		if (!vbuf)
 			break;
+		v4l2_ctrl_request_complete(vbuf->vb2_buf.req_obj.req,
+					   &ctx->ctrl_handler);
 		v4l2_m2m_buf_done(vbuf, VB2_BUF_STATE_ERROR);
 	}
 }
 
+static void rockchip_vpu_buf_request_complete(struct vb2_buffer *vb)
+{
+	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
+
+	v4l2_ctrl_request_complete(vb->req_obj.req, &ctx->ctrl_handler);
+}
+
 const struct vb2_ops rockchip_vpu_dec_queue_ops = {
 	.queue_setup = rockchip_vpu_queue_setup,
 	.buf_prepare = rockchip_vpu_buf_prepare,
 	.buf_queue = rockchip_vpu_buf_queue,
 	.start_streaming = rockchip_vpu_start_streaming,
 	.stop_streaming = rockchip_vpu_stop_streaming,
+	.buf_request_complete = rockchip_vpu_buf_request_complete,
 	.wait_prepare = vb2_ops_wait_prepare,
 	.wait_finish = vb2_ops_wait_finish,
 };
@@ -0,0 +1,302 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * ACLK frequency scaling.
+ *
+ * The VPU is registered with devfreq, which polls the load of the
+ * device: the time the busiest hardware block spent processing jobs,
+ * measured by the watchdogs from the start of the hardware to the
+ * interrupt. The simple_ondemand governor picks a frequency from that
+ * load.
+ *
+ * That frequency is then raised, if needed, to the one the streaming
+ * contexts need to sustain the frame rate they declared with
+ * VIDIOC_S_PARM: the macroblocks they process per second, times the
+ * time per macroblock measured by the watchdog of their block, scaled
+ * from the current frequency and given some headroom. Contexts which
+ * declared no frame rate only count through the load.
+ *
+ * With the aclk_pinned module parameter set, or when devfreq is not
+ * available, ACLK stays at the maximum frequency of the variant, which
+ * gives the lowest and most deterministic latency.
+ */
+
+#include <linux/clk.h>
+#include <linux/devfreq.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/pm_opp.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+
+#define RK_VPU_DEVFREQ_POLL_MS		50
+/* Headroom over the frequency needed by the declared frame rates. */
+#define RK_VPU_DEVFREQ_HEADROOM_NUM	5
+#define RK_VPU_DEVFREQ_HEADROOM_DEN	4
+/* Operating points used when the device tree provides none. */
+#define RK_VPU_DEVFREQ_NUM_STEPS	4
+
+static bool rockchip_vpu_aclk_pinned;
+module_param_named(aclk_pinned, rockchip_vpu_aclk_pinned, bool, 0644);
+MODULE_PARM_DESC(aclk_pinned,
+		 "Keep ACLK at its maximum frequency, for deterministic latency");
+
+/*
+ * Hardware time per second needed by the declared frame rates, at the
+ * current frequency. Must be called with vpu->irqlock held.
+ */
+static u64
+rockchip_vpu_devfreq_busy_ns_per_s(struct rockchip_vpu_sched *sched,
+				   const struct rockchip_vpu_watchdog *wd)
+{
+	struct rockchip_vpu_ctx *ctx;
+	const struct v4l2_pix_format_mplane *fmt;
+	u64 busy_ns_per_s = 0;
+
+	list_for_each_entry(ctx, &sched->ctxs, sched_node) {
+		if (!ctx->timeperframe.numerator ||
+		    !vb2_is_streaming(&ctx->fh.m2m_ctx->out_q_ctx.q))
+			continue;
+		/* The raw side of the context sets the amount of work. */
+		fmt = sched == &ctx->dev->enc_sched ?
+		      &ctx->src_fmt : &ctx->dst_fmt;
+		busy_ns_per_s += div_u64((u64)MB_WIDTH(fmt->width) *
+					 MB_HEIGHT(fmt->height) *
+					 ctx->timeperframe.denominator,
+					 ctx->timeperframe.numerator) *
+				 rockchip_vpu_watchdog_ns_per_mb(wd,
+							ctx->codec_mode);
+	}
+	return busy_ns_per_s;
+}
+
+/* Frequency needed by the frame rates declared on one hardware block. */
+static unsigned long
+rockchip_vpu_devfreq_block_floor(struct rockchip_vpu_dev *vpu,
+				 struct rockchip_vpu_sched *sched,
+				 struct rockchip_vpu_watchdog *wd,
+				 unsigned long cur_freq)
+{
+	unsigned long flags;
+	u64 busy_ns_per_s;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	busy_ns_per_s = rockchip_vpu_devfreq_busy_ns_per_s(sched, wd);
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+
+	busy_ns_per_s = div_u64(busy_ns_per_s * RK_VPU_DEVFREQ_HEADROOM_NUM,
+				RK_VPU_DEVFREQ_HEADROOM_DEN);
+	return div_u64(busy_ns_per_s * (cur_freq / USEC_PER_SEC),
+		       NSEC_PER_USEC);
+}
+
+static unsigned long rockchip_vpu_devfreq_floor(struct rockchip_vpu_dev *vpu)
+{
+	unsigned long cur_freq = clk_get_rate(vpu->clocks[0].clk);
+
+	/* Both blocks run concurrently off the same ACLK. */
+	return max(rockchip_vpu_devfreq_block_floor(vpu, &vpu->enc_sched,
+						    &vpu->enc_watchdog,
+						    cur_freq),
+		   rockchip_vpu_devfreq_block_floor(vpu, &vpu->dec_sched,
+						    &vpu->dec_watchdog,
+						    cur_freq));
+}
+
+static int rockchip_vpu_devfreq_target(struct device *dev,
+				       unsigned long *freq, u32 flags)
+{
+	struct rockchip_vpu_dev *vpu = dev_get_drvdata(dev);
+	unsigned long floor;
+	struct dev_pm_opp *opp;
+	int ret;
+
+	/* Round the raised frequencies up to the next operating point. */
+	if (READ_ONCE(rockchip_vpu_aclk_pinned)) {
+		*freq = vpu->variant->aclk_max_freq;
+		flags &= ~DEVFREQ_FLAG_LEAST_UPPER_BOUND;
+	} else {
+		floor = rockchip_vpu_devfreq_floor(vpu);
+		if (floor > *freq) {
+			*freq = floor;
+			flags &= ~DEVFREQ_FLAG_LEAST_UPPER_BOUND;
+		}
+	}
+
+	opp = devfreq_recommended_opp(dev, freq, flags);
+	if (IS_ERR(opp))
+		return PTR_ERR(opp);
+	dev_pm_opp_put(opp);
+
+	if (*freq == clk_get_rate(vpu->clocks[0].clk))
+		return 0;
+
+	ret = clk_set_rate(vpu->clocks[0].clk, *freq);
+	if (ret) {
+		dev_err(dev, "Could not set ACLK to %lu Hz\n", *freq);
+		return ret;
+	}
+	vpu_debug(1, "ACLK %lu Hz\n", *freq);
+	return 0;
+}
+
+static int rockchip_vpu_devfreq_get_dev_status(struct device *dev,
+					       struct devfreq_dev_status *stat)
+{
+	struct rockchip_vpu_dev *vpu = dev_get_drvdata(dev);
+	unsigned long flags;
+	u64 now, busy;
+
+	now = ktime_get_ns();
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	stat->total_time = now - vpu->devfreq_window_ns;
+	busy = max(vpu->devfreq_enc_busy_ns, vpu->devfreq_dec_busy_ns);
+	/* Jobs straddling two windows are accounted in the second one. */
+	stat->busy_time = min_t(u64, busy, stat->total_time);
+	vpu->devfreq_window_ns = now;
+	vpu->devfreq_enc_busy_ns = 0;
+	vpu->devfreq_dec_busy_ns = 0;
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+
+	stat->current_frequency = clk_get_rate(vpu->clocks[0].clk);
+	return 0;
+}
+
+static int rockchip_vpu_devfreq_get_cur_freq(struct device *dev,
+					     unsigned long *freq)
+{
+	struct rockchip_vpu_dev *vpu = dev_get_drvdata(dev);
+
+	*freq = clk_get_rate(vpu->clocks[0].clk);
+	return 0;
+}
+
+/* Called from the IRQ thread, once the hardware finished a job. */
+void rockchip_vpu_devfreq_job_done(struct rockchip_vpu_dev *vpu,
+				   const struct rockchip_vpu_watchdog *wd)
+{
+	unsigned long flags;
+	u64 busy = wd->end_ns - wd->start_ns;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	if (wd == &vpu->enc_watchdog)
+		vpu->devfreq_enc_busy_ns += busy;
+	else
+		vpu->devfreq_dec_busy_ns += busy;
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+}
+
+/* Called from VIDIOC_S_PARM. A zero interval withdraws the declaration. */
+void rockchip_vpu_devfreq_set_timeperframe(struct rockchip_vpu_ctx *ctx,
+					   const struct v4l2_fract *tpf)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	if (tpf->numerator && tpf->denominator) {
+		ctx->timeperframe = *tpf;
+	} else {
+		ctx->timeperframe.numerator = 0;
+		ctx->timeperframe.denominator = 0;
+	}
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+
+	vpu_debug(1, "ctx %p frame interval %u/%u\n", ctx,
+		  tpf->numerator, tpf->denominator);
+}
+
+static unsigned long rockchip_vpu_devfreq_step(struct rockchip_vpu_dev *vpu,
+					       unsigned int i)
+{
+	return vpu->variant->aclk_max_freq / RK_VPU_DEVFREQ_NUM_STEPS * i;
+}
+
+static int rockchip_vpu_devfreq_add_opps(struct rockchip_vpu_dev *vpu)
+{
+	unsigned int i;
+	int ret;
+
+	if (!dev_pm_opp_of_add_table(vpu->dev))
+		return 0;
+
+	for (i = 1; i <= RK_VPU_DEVFREQ_NUM_STEPS; i++) {
+		ret = dev_pm_opp_add(vpu->dev,
+				     rockchip_vpu_devfreq_step(vpu, i), 0);
+		if (ret) {
+			while (--i)
+				dev_pm_opp_remove(vpu->dev,
+					rockchip_vpu_devfreq_step(vpu, i));
+			return ret;
+		}
+	}
+	vpu->devfreq_dynamic_opps = true;
+	return 0;
+}
+
+static void rockchip_vpu_devfreq_remove_opps(struct rockchip_vpu_dev *vpu)
+{
+	unsigned int i;
+
+	if (!vpu->devfreq_dynamic_opps) {
+		dev_pm_opp_of_remove_table(vpu->dev);
+		return;
+	}
+
+	for (i = 1; i <= RK_VPU_DEVFREQ_NUM_STEPS; i++)
+		dev_pm_opp_remove(vpu->dev, rockchip_vpu_devfreq_step(vpu, i));
+	vpu->devfreq_dynamic_opps = false;
+}
+
+/*
+ * Must be called once the driver data is set. Failures are not fatal:
+ * ACLK then stays at its maximum frequency.
+ */
+void rockchip_vpu_devfreq_init(struct rockchip_vpu_dev *vpu)
+{
+	struct devfreq_dev_profile *profile = &vpu->devfreq_profile;
+	struct devfreq *devfreq;
+	int ret;
+
+	ret = clk_set_rate(vpu->clocks[0].clk, vpu->variant->aclk_max_freq);
+	if (ret)
+		dev_warn(vpu->dev, "Could not set ACLK to %lu Hz\n",
+			 vpu->variant->aclk_max_freq);
+
+	ret = rockchip_vpu_devfreq_add_opps(vpu);
+	if (ret) {
+		dev_warn(vpu->dev, "Could not add operating points\n");
+		return;
+	}
+
+	vpu->devfreq_window_ns = ktime_get_ns();
+
+	profile->initial_freq = vpu->variant->aclk_max_freq;
+	profile->polling_ms = RK_VPU_DEVFREQ_POLL_MS;
+	profile->target = rockchip_vpu_devfreq_target;
+	profile->get_dev_status = rockchip_vpu_devfreq_get_dev_status;
+	profile->get_cur_freq = rockchip_vpu_devfreq_get_cur_freq;
+
+	devfreq = devfreq_add_device(vpu->dev, profile, "simple_ondemand",
+				     NULL);
+	if (IS_ERR(devfreq)) {
+		dev_warn(vpu->dev, "Could not register with devfreq (%ld), ACLK pinned\n",
+			 PTR_ERR(devfreq));
+		rockchip_vpu_devfreq_remove_opps(vpu);
+		return;
+	}
+	vpu->devfreq = devfreq;
+}
+
+void rockchip_vpu_devfreq_cleanup(struct rockchip_vpu_dev *vpu)
+{
+	if (!vpu->devfreq)
+		return;
+
+	devfreq_remove_device(vpu->devfreq);
+	vpu->devfreq = NULL;
+	rockchip_vpu_devfreq_remove_opps(vpu);
+}
@@ -0,0 +1,444 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * Cache of the imported DMA-BUF buffers.
+ *
+ * vb2 maps an imported buffer on every QBUF and unmaps it on every
+ * DQBUF, and attaches it again whenever a buffer index is queued with
+ * another dma-buf than the last time. Zero-copy pipelines cycle through
+ * the same few dma-bufs, so their attachments and device mappings are
+ * kept in an LRU list, keyed on the dma-buf and the DMA direction. When
+ * a cached mapping is reused, only the cache maintenance is done again,
+ * when the buffer is prepared and when it is done, unless the flags of
+ * the buffer say that the CPU did not touch it.
+ *
+ * The memory operations wrap those of dma-contig, which still handles
+ * the buffers allocated by the driver. The vb2 memory operations only
+ * know the device, so the cache is shared by all the contexts.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <media/videobuf2-dma-contig.h>
+#include <media/videobuf2-v4l2.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+
+/* Entries kept in the cache once no buffer uses them any more. */
+#define RK_VPU_DMABUF_IDLE_ENTRIES	16
+
+/**
+ * struct rockchip_vpu_dmabuf - cached attachment of a dma-buf
+ * @node:	Entry in rockchip_vpu_dev.dmabuf_lru, most recently used
+ *		first.
+ * @vpu:	Device the dma-buf is attached to.
+ * @dbuf:	Imported dma-buf. The entry holds a reference on it.
+ * @attach:	Attachment of @dbuf to the device.
+ * @sgt:	Device mapping of @attach, NULL until the first QBUF.
+ * @dir:	DMA direction of @sgt.
+ * @dma_addr:	Device address of the buffer.
+ * @contig_size: Size of the buffer mapped contiguously from @dma_addr.
+ * @vaddr:	Kernel mapping, NULL until the driver needs one.
+ * @users:	Number of vb2 planes attached to the entry.
+ */
+struct rockchip_vpu_dmabuf {
+	struct list_head node;
+	struct rockchip_vpu_dev *vpu;
+	struct dma_buf *dbuf;
+	struct dma_buf_attachment *attach;
+	struct sg_table *sgt;
+	enum dma_data_direction dir;
+	dma_addr_t dma_addr;
+	unsigned long contig_size;
+	void *vaddr;
+	unsigned int users;
+};
+
+/**
+ * struct rockchip_vpu_mem - memory of a vb2 plane
+ * @dc:		dma-contig buffer, for the buffers allocated by the
+ *		driver.
+ * @entry:	Cache entry, for the imported buffers.
+ * @size:	Size of the plane, for the imported buffers.
+ * @skip_clean:	Do not clean the CPU caches before the hardware runs.
+ * @skip_invalidate: Do not invalidate the CPU caches once the hardware
+ *		is done.
+ */
+struct rockchip_vpu_mem {
+	void *dc;
+	struct rockchip_vpu_dmabuf *entry;
+	unsigned long size;
+	bool skip_clean;
+	bool skip_invalidate;
+};
+
+static unsigned long rockchip_vpu_dmabuf_contig_size(struct sg_table *sgt)
+{
+	dma_addr_t expected = sg_dma_address(sgt->sgl);
+	unsigned long size = 0;
+	struct scatterlist *s;
+	unsigned int i;
+
+	for_each_sg(sgt->sgl, s, sgt->nents, i) {
+		if (sg_dma_address(s) != expected)
+			break;
+		expected += sg_dma_len(s);
+		size += sg_dma_len(s);
+	}
+	return size;
+}
+
+static void rockchip_vpu_dmabuf_destroy(struct rockchip_vpu_dmabuf *entry)
+{
+	list_del(&entry->node);
+	if (entry->vaddr)
+		dma_buf_vunmap(entry->dbuf, entry->vaddr);
+	if (entry->sgt)
+		dma_buf_unmap_attachment(entry->attach, entry->sgt,
+					 entry->dir);
+	dma_buf_detach(entry->dbuf, entry->attach);
+	dma_buf_put(entry->dbuf);
+	kfree(entry);
+}
+
+/*
+ * Destroy the least recently used entries that no buffer uses, beyond
+ * the first @keep ones. Called with the cache lock held.
+ */
+static void rockchip_vpu_dmabuf_trim(struct rockchip_vpu_dev *vpu,
+				     unsigned int keep)
+{
+	struct rockchip_vpu_dmabuf *entry, *tmp;
+	unsigned int idle = 0;
+
+	list_for_each_entry_safe(entry, tmp, &vpu->dmabuf_lru, node) {
+		if (entry->users || idle++ < keep)
+			continue;
+		rockchip_vpu_dmabuf_destroy(entry);
+		vpu->dmabuf_evictions++;
+	}
+}
+
+static struct rockchip_vpu_dmabuf *
+rockchip_vpu_dmabuf_get(struct rockchip_vpu_dev *vpu, struct device *dev,
+			struct dma_buf *dbuf, enum dma_data_direction dir)
+{
+	struct rockchip_vpu_dmabuf *entry;
+
+	list_for_each_entry(entry, &vpu->dmabuf_lru, node) {
+		if (entry->dbuf == dbuf && entry->dir == dir)
+			goto found;
+	}
+
+	entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return ERR_PTR(-ENOMEM);
+
+	entry->attach = dma_buf_attach(dbuf, dev);
+	if (IS_ERR(entry->attach)) {
+		struct dma_buf_attachment *attach = entry->attach;
+
+		kfree(entry);
+		return ERR_CAST(attach);
+	}
+	get_dma_buf(dbuf);
+	entry->vpu = vpu;
+	entry->dbuf = dbuf;
+	entry->dir = dir;
+	list_add(&entry->node, &vpu->dmabuf_lru);
+
+found:
+	entry->users++;
+	list_move(&entry->node, &vpu->dmabuf_lru);
+	return entry;
+}
+
+static void *rockchip_vpu_mem_alloc(struct device *dev, unsigned long attrs,
+				    unsigned long size,
+				    enum dma_data_direction dma_dir,
+				    gfp_t gfp_flags)
+{
+	struct rockchip_vpu_mem *mem;
+	void *dc;
+
+	mem = kzalloc(sizeof(*mem), GFP_KERNEL);
+	if (!mem)
+		return ERR_PTR(-ENOMEM);
+
+	dc = vb2_dma_contig_memops.alloc(dev, attrs, size, dma_dir, gfp_flags);
+	if (IS_ERR(dc)) {
+		kfree(mem);
+		return dc;
+	}
+
+	mem->dc = dc;
+	return mem;
+}
+
+static void rockchip_vpu_mem_put(void *buf_priv)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+
+	vb2_dma_contig_memops.put(mem->dc);
+	kfree(mem);
+}
+
+static struct dma_buf *rockchip_vpu_mem_get_dmabuf(void *buf_priv,
+						   unsigned long flags)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+
+	return vb2_dma_contig_memops.get_dmabuf(mem->dc, flags);
+}
+
+static int rockchip_vpu_mem_mmap(void *buf_priv, struct vm_area_struct *vma)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+
+	return vb2_dma_contig_memops.mmap(mem->dc, vma);
+}
+
+static unsigned int rockchip_vpu_mem_num_users(void *buf_priv)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+
+	return mem->dc ? vb2_dma_contig_memops.num_users(mem->dc) : 0;
+}
+
+static void *rockchip_vpu_mem_cookie(void *buf_priv)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+
+	if (mem->dc)
+		return vb2_dma_contig_memops.cookie(mem->dc);
+	return &mem->entry->dma_addr;
+}
+
+static void *rockchip_vpu_mem_vaddr(void *buf_priv)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+	struct rockchip_vpu_dmabuf *entry = mem->entry;
+	void *vaddr;
+
+	if (mem->dc)
+		return vb2_dma_contig_memops.vaddr(mem->dc);
+
+	mutex_lock(&entry->vpu->dmabuf_lock);
+	if (!entry->vaddr)
+		entry->vaddr = dma_buf_vmap(entry->dbuf);
+	vaddr = entry->vaddr;
+	mutex_unlock(&entry->vpu->dmabuf_lock);
+	return vaddr;
+}
+
+static void *rockchip_vpu_mem_attach_dmabuf(struct device *dev,
+					    struct dma_buf *dbuf,
+					    unsigned long size,
+					    enum dma_data_direction dma_dir)
+{
+	struct rockchip_vpu_dev *vpu = dev_get_drvdata(dev);
+	struct rockchip_vpu_dmabuf *entry;
+	struct rockchip_vpu_mem *mem;
+
+	if (dbuf->size < size)
+		return ERR_PTR(-EFAULT);
+
+	mem = kzalloc(sizeof(*mem), GFP_KERNEL);
+	if (!mem)
+		return ERR_PTR(-ENOMEM);
+
+	mutex_lock(&vpu->dmabuf_lock);
+	entry = rockchip_vpu_dmabuf_get(vpu, dev, dbuf, dma_dir);
+	mutex_unlock(&vpu->dmabuf_lock);
+	if (IS_ERR(entry)) {
+		kfree(mem);
+		return entry;
+	}
+
+	mem->entry = entry;
+	mem->size = size;
+	return mem;
+}
+
+static void rockchip_vpu_mem_detach_dmabuf(void *buf_priv)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+	struct rockchip_vpu_dev *vpu = mem->entry->vpu;
+
+	mutex_lock(&vpu->dmabuf_lock);
+	mem->entry->users--;
+	rockchip_vpu_dmabuf_trim(vpu, RK_VPU_DMABUF_IDLE_ENTRIES);
+	mutex_unlock(&vpu->dmabuf_lock);
+	kfree(mem);
+}
+
+static int rockchip_vpu_mem_map_dmabuf(void *buf_priv)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+	struct rockchip_vpu_dmabuf *entry = mem->entry;
+	struct rockchip_vpu_dev *vpu = entry->vpu;
+	struct sg_table *sgt;
+	int ret = 0;
+
+	mutex_lock(&vpu->dmabuf_lock);
+	if (entry->sgt) {
+		vpu->dmabuf_hits++;
+	} else {
+		sgt = dma_buf_map_attachment(entry->attach, entry->dir);
+		if (IS_ERR(sgt)) {
+			ret = -EINVAL;
+			goto out;
+		}
+		entry->sgt = sgt;
+		entry->dma_addr = sg_dma_address(sgt->sgl);
+		entry->contig_size = rockchip_vpu_dmabuf_contig_size(sgt);
+		vpu->dmabuf_misses++;
+	}
+
+	/* The hardware takes a single address per plane. */
+	if (entry->contig_size < mem->size) {
+		vpu_err("imported buffer is not contiguous\n");
+		ret = -EFAULT;
+	}
+out:
+	mutex_unlock(&vpu->dmabuf_lock);
+	return ret;
+}
+
+/* The mapping is kept until the entry is evicted. */
+static void rockchip_vpu_mem_unmap_dmabuf(void *buf_priv)
+{
+}
+
+static void rockchip_vpu_mem_prepare(void *buf_priv)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+	struct rockchip_vpu_dmabuf *entry = mem->entry;
+
+	if (mem->dc) {
+		vb2_dma_contig_memops.prepare(mem->dc);
+		return;
+	}
+
+	if (!mem->skip_clean)
+		dma_sync_sg_for_device(entry->attach->dev, entry->sgt->sgl,
+				       entry->sgt->orig_nents, entry->dir);
+}
+
+/* Called from vb2_buffer_done(), possibly in interrupt context. */
+static void rockchip_vpu_mem_finish(void *buf_priv)
+{
+	struct rockchip_vpu_mem *mem = buf_priv;
+	struct rockchip_vpu_dmabuf *entry = mem->entry;
+
+	if (mem->dc) {
+		vb2_dma_contig_memops.finish(mem->dc);
+		return;
+	}
+
+	if (!mem->skip_invalidate && entry->dir != DMA_TO_DEVICE)
+		dma_sync_sg_for_cpu(entry->attach->dev, entry->sgt->sgl,
+				    entry->sgt->orig_nents, entry->dir);
+}
+
+const struct vb2_mem_ops rockchip_vpu_mem_ops = {
+	.alloc = rockchip_vpu_mem_alloc,
+	.put = rockchip_vpu_mem_put,
+	.get_dmabuf = rockchip_vpu_mem_get_dmabuf,
+	.mmap = rockchip_vpu_mem_mmap,
+	.num_users = rockchip_vpu_mem_num_users,
+	.cookie = rockchip_vpu_mem_cookie,
+	.vaddr = rockchip_vpu_mem_vaddr,
+	.attach_dmabuf = rockchip_vpu_mem_attach_dmabuf,
+	.detach_dmabuf = rockchip_vpu_mem_detach_dmabuf,
+	.map_dmabuf = rockchip_vpu_mem_map_dmabuf,
+	.unmap_dmabuf = rockchip_vpu_mem_unmap_dmabuf,
+	.prepare = rockchip_vpu_mem_prepare,
+	.finish = rockchip_vpu_mem_finish,
+};
+
+/*
+ * Called from buf_prepare, before the planes are synced: producers and
+ * consumers that are DMA devices let userspace skip the cache
+ * maintenance of imported buffers with V4L2_BUF_FLAG_NO_CACHE_CLEAN and
+ * V4L2_BUF_FLAG_NO_CACHE_INVALIDATE. The buffers allocated by the
+ * driver are coherent and never need it.
+ */
+void rockchip_vpu_mem_set_cache_hints(struct vb2_buffer *vb)
+{
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct rockchip_vpu_mem *mem;
+	unsigned int i;
+
+	for (i = 0; i < vb->num_planes; i++) {
+		mem = vb->planes[i].mem_priv;
+		mem->skip_clean = vbuf->flags & V4L2_BUF_FLAG_NO_CACHE_CLEAN;
+		mem->skip_invalidate = vbuf->flags &
+				       V4L2_BUF_FLAG_NO_CACHE_INVALIDATE;
+	}
+}
+
+void rockchip_vpu_dmabuf_init(struct rockchip_vpu_dev *vpu)
+{
+	mutex_init(&vpu->dmabuf_lock);
+	INIT_LIST_HEAD(&vpu->dmabuf_lru);
+}
+
+/*
+ * Drop the entries no buffer uses, so that closed dma-bufs are not kept
+ * alive by the cache. Called when a context is released.
+ */
+void rockchip_vpu_dmabuf_flush(struct rockchip_vpu_dev *vpu)
+{
+	mutex_lock(&vpu->dmabuf_lock);
+	rockchip_vpu_dmabuf_trim(vpu, 0);
+	mutex_unlock(&vpu->dmabuf_lock);
+}
+
+static int rockchip_vpu_dmabuf_show(struct seq_file *s, void *data)
+{
+	struct rockchip_vpu_dev *vpu = s->private;
+	struct rockchip_vpu_dmabuf *entry;
+	unsigned int entries = 0;
+
+	mutex_lock(&vpu->dmabuf_lock);
+	list_for_each_entry(entry, &vpu->dmabuf_lru, node)
+		entries++;
+	seq_printf(s, "entries: %u\n", entries);
+	seq_printf(s, "hits: %llu\n", vpu->dmabuf_hits);
+	seq_printf(s, "misses: %llu\n", vpu->dmabuf_misses);
+	seq_printf(s, "evictions: %llu\n", vpu->dmabuf_evictions);
+	mutex_unlock(&vpu->dmabuf_lock);
+	return 0;
+}
+
+static int rockchip_vpu_dmabuf_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rockchip_vpu_dmabuf_show, inode->i_private);
+}
+
+static const struct file_operations rockchip_vpu_dmabuf_fops = {
+	.owner = THIS_MODULE,
+	.open = rockchip_vpu_dmabuf_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Must be called after rockchip_vpu_stats_init() created the directory. */
+void rockchip_vpu_dmabuf_debugfs_init(struct rockchip_vpu_dev *vpu)
+{
+	if (!vpu->debugfs)
+		return;
+
+	debugfs_create_file("dmabuf", 0444, vpu->debugfs, vpu,
+			    &rockchip_vpu_dmabuf_fops);
+}
@@ -15,6 +15,10 @@
 #endif
 
 #include <linux/clk.h>
+#include <linux/dma-mapping.h>
+#include <linux/interrupt.h>
+#include <linux/iommu.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/platform_device.h>
@@ -33,17 +37,14 @@
 #include "rockchip_vpu.h"
 #include "rockchip_vpu_hw.h"
 
-#define DRIVER_NAME "rockchip-vpu"
+#define CREATE_TRACE_POINTS
+#include "rockchip_vpu_trace.h"
 
-int rockchip_vpu_debug;
-module_param_named(debug, rockchip_vpu_debug, int, 0644);
-MODULE_PARM_DESC(debug,
-		 "Debug level - higher value produces more verbose messages");
+#define DRIVER_NAME "rockchip-vpu"
 
-static void rockchip_vpu_job_finish(struct rockchip_vpu_dev *vpu,
-		struct rockchip_vpu_ctx *ctx,
-		unsigned int bytesused,
-		enum vb2_buffer_state result)
+static void rockchip_vpu_buf_finish(struct rockchip_vpu_ctx *ctx,
+				    unsigned int bytesused,
+				    enum vb2_buffer_state result)
 {
 	struct vb2_v4l2_buffer *src, *dst;
 
@@ -67,56 +68,288 @@ static void rockchip_vpu_job_finish(struct rockchip_vpu_dev *vpu,
 	if (bytesused)
 		dst->vb2_buf.planes[0].bytesused = bytesused;
 
+	trace_rockchip_vpu_job_finish(ctx, src->vb2_buf.index,
+				      dst->vb2_buf.index, dst->sequence, result);
 	v4l2_m2m_buf_done(src, result);
 	v4l2_m2m_buf_done(dst, result);
+}
+
+static void rockchip_vpu_job_end(struct rockchip_vpu_dev *vpu,
+				 struct v4l2_m2m_dev *m2m_dev,
+				 struct rockchip_vpu_ctx *ctx)
+{
+	ctx->batch_count = 0;
+	ctx->batch_abort = false;
+	v4l2_m2m_job_finish(m2m_dev, ctx->fh.m2m_ctx);
+
+	rockchip_vpu_pm_job_end(vpu);
+}
+
+static void rockchip_vpu_job_finish(struct rockchip_vpu_dev *vpu,
+		struct v4l2_m2m_dev *m2m_dev,
+		struct rockchip_vpu_ctx *ctx,
+		unsigned int bytesused,
+		enum vb2_buffer_state result)
+{
+	rockchip_vpu_buf_finish(ctx, bytesused, result);
+	rockchip_vpu_job_end(vpu, m2m_dev, ctx);
+}
+
+/*
+ * Rebuild the register image of the context. The control handler lock
+ * is held, so that the image is built from the current control values
+ * even if a control is being changed.
+ */
+void rockchip_vpu_prepare_regs(struct rockchip_vpu_ctx *ctx)
+{
+	if (!ctx->codec_ops || !ctx->codec_ops->prepare)
+		return;
+
+	mutex_lock(ctx->ctrl_handler.lock);
+	WRITE_ONCE(ctx->regs_dirty, false);
+	ctx->num_regs = 0;
+	ctx->codec_ops->prepare(ctx);
+	mutex_unlock(ctx->ctrl_handler.lock);
+}
+
+/* Build the register image of a buffer, for the current codec. */
+void rockchip_vpu_prepare_buf_regs(struct rockchip_vpu_ctx *ctx,
+				   struct vb2_buffer *vb)
+{
+	struct rockchip_vpu_buf *buf = rockchip_vpu_get_buf(vb);
+
+	buf->num_regs = 0;
+	buf->regs_ops = NULL;
+	if (!ctx->codec_ops || !ctx->codec_ops->prepare_buf)
+		return;
+
+	ctx->codec_ops->prepare_buf(ctx, vb);
+	buf->regs_ops = ctx->codec_ops;
+}
+
+/*
+ * Program and start the hardware for the next buffer pair of ctx. The
+ * register images are normally built beforehand, at STREAMON and
+ * buf_prepare time. Buffers prepared before the codec was known, and
+ * contexts whose controls changed, are caught up here.
+ *
+ * When the source buffer belongs to a media request, its controls are
+ * applied before rockchip_vpu_codec_ops.run, which must call
+ * rockchip_vpu_run_done() once it no longer needs them.
+ */
+void rockchip_vpu_run(struct rockchip_vpu_ctx *ctx)
+{
+	struct vb2_buffer *src, *dst;
+	struct media_request *req;
+
+	if (READ_ONCE(ctx->regs_dirty))
+		rockchip_vpu_prepare_regs(ctx);
+
+	src = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	dst = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+	if (rockchip_vpu_get_buf(src)->regs_ops != ctx->codec_ops)
+		rockchip_vpu_prepare_buf_regs(ctx, src);
+	if (rockchip_vpu_get_buf(dst)->regs_ops != ctx->codec_ops)
+		rockchip_vpu_prepare_buf_regs(ctx, dst);
+
+	req = src->req_obj.req;
+	if (req)
+		v4l2_ctrl_request_setup(req, &ctx->ctrl_handler);
+
+	rockchip_vpu_sched_job_start(ctx);
+	rockchip_vpu_shadow_claim(ctx);
+	ctx->codec_ops->run(ctx);
+}
+
+/*
+ * Called by rockchip_vpu_codec_ops.run once the registers are written,
+ * before the hardware is started, so that the request controls are
+ * completed before the buffers.
+ */
+void rockchip_vpu_run_done(struct rockchip_vpu_ctx *ctx)
+{
+	struct vb2_buffer *src = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+
+	if (src->req_obj.req)
+		v4l2_ctrl_request_complete(src->req_obj.req,
+					   &ctx->ctrl_handler);
+}
+
+/*
+ * In batching mode, a single mem2mem job processes up to batch_size
+ * buffer pairs of the same context. The next pair is started straight
+ * from the completion path, keeping the runtime PM reference and
+ * skipping the round trip through the mem2mem scheduler. The batch
+ * still yields to the weighted fair scheduler: it ends when another
+ * ready context becomes more deserving.
+ */
+static bool rockchip_vpu_batch_next(struct rockchip_vpu_ctx *ctx,
+				    enum vb2_buffer_state result)
+{
+	struct v4l2_m2m_ctx *m2m_ctx = ctx->fh.m2m_ctx;
+
+	if (result != VB2_BUF_STATE_DONE || READ_ONCE(ctx->batch_abort))
+		return false;
+	if (++ctx->batch_count >= ctx->batch_size)
+		return false;
+	if (!v4l2_m2m_num_src_bufs_ready(m2m_ctx) ||
+	    !v4l2_m2m_num_dst_bufs_ready(m2m_ctx))
+		return false;
+	return rockchip_vpu_sched_may_continue(ctx);
+}
 
-	v4l2_m2m_job_finish(vpu->m2m_enc_dev, ctx->fh.m2m_ctx);
+/*
+ * The encoder (VEPU) and the decoder (VDPU) have their own register
+ * windows, interrupt lines and mem2mem devices, so each of them tracks
+ * its current job and its watchdog independently. This allows an
+ * encoding job and a decoding job to be processed at the same time.
+ *
+ * Interrupts are split in two halves. The variant hard IRQ handler only
+ * acks the hardware and latches the result through
+ * rockchip_vpu_{enc,dec}_irq_done(). Buffer completion, job finishing
+ * and starting the next batched frame happen in the IRQ thread.
+ */
+static irqreturn_t rockchip_vpu_irq_done(struct rockchip_vpu_watchdog *wd,
+					 unsigned int *latched_bytesused,
+					 enum vb2_buffer_state *latched_result,
+					 unsigned int bytesused,
+					 enum vb2_buffer_state result)
+{
+	/* If the watchdog already took over the job, it completes it. */
+	if (!rockchip_vpu_watchdog_disarm(wd, result == VB2_BUF_STATE_DONE))
+		return IRQ_HANDLED;
 
-	pm_runtime_mark_last_busy(vpu->dev);
-	pm_runtime_put_autosuspend(vpu->dev);
+	*latched_bytesused = bytesused;
+	*latched_result = result;
+	return IRQ_WAKE_THREAD;
+}
+
+irqreturn_t rockchip_vpu_enc_irq_done(struct rockchip_vpu_dev *vpu,
+				      unsigned int bytesused,
+				      enum vb2_buffer_state result)
+{
+	return rockchip_vpu_irq_done(&vpu->enc_watchdog,
+				     &vpu->enc_irq_bytesused,
+				     &vpu->enc_irq_result,
+				     bytesused, result);
+}
+
+irqreturn_t rockchip_vpu_dec_irq_done(struct rockchip_vpu_dev *vpu,
+				      unsigned int bytesused,
+				      enum vb2_buffer_state result)
+{
+	return rockchip_vpu_irq_done(&vpu->dec_watchdog,
+				     &vpu->dec_irq_bytesused,
+				     &vpu->dec_irq_result,
+				     bytesused, result);
 }
 
-void rockchip_vpu_irq_done(struct rockchip_vpu_dev *vpu,
-			   unsigned int bytesused,
-			   enum vb2_buffer_state result)
+static void rockchip_vpu_irq_thread(struct rockchip_vpu_dev *vpu,
+				    struct v4l2_m2m_dev *m2m_dev,
+				    struct rockchip_vpu_watchdog *wd,
+				    unsigned int bytesused,
+				    enum vb2_buffer_state result)
 {
 	struct rockchip_vpu_ctx *ctx =
-		(struct rockchip_vpu_ctx *)v4l2_m2m_get_curr_priv(vpu->m2m_enc_dev);
+		(struct rockchip_vpu_ctx *)v4l2_m2m_get_curr_priv(m2m_dev);
 
-	/* Atomic watchdog cancel. The worker may still be
-	 * running after calling this.
-	 */
-	cancel_delayed_work(&vpu->watchdog_work);
-	if (ctx)
-		rockchip_vpu_job_finish(vpu, ctx, bytesused, result);
+	rockchip_vpu_watchdog_sync(wd);
+	if (!ctx)
+		return;
+
+	rockchip_vpu_devfreq_job_done(vpu, wd);
+	rockchip_vpu_sched_job_done(ctx);
+	if (ctx->codec_ops->done)
+		bytesused = ctx->codec_ops->done(ctx, bytesused, result);
+	rockchip_vpu_buf_finish(ctx, bytesused, result);
+	if (result == VB2_BUF_STATE_DONE)
+		rockchip_vpu_stats_job_done(ctx, wd);
+	if (rockchip_vpu_batch_next(ctx, result)) {
+		rockchip_vpu_stats_job_start(ctx);
+		rockchip_vpu_run(ctx);
+		return;
+	}
+	rockchip_vpu_job_end(vpu, m2m_dev, ctx);
 }
 
-void rockchip_vpu_watchdog(struct work_struct *work)
+irqreturn_t rockchip_vpu_enc_irq_thread(int irq, void *dev_id)
+{
+	struct rockchip_vpu_dev *vpu = dev_id;
+
+	rockchip_vpu_irq_thread(vpu, vpu->m2m_enc_dev, &vpu->enc_watchdog,
+				vpu->enc_irq_bytesused, vpu->enc_irq_result);
+	return IRQ_HANDLED;
+}
+
+irqreturn_t rockchip_vpu_dec_irq_thread(int irq, void *dev_id)
+{
+	struct rockchip_vpu_dev *vpu = dev_id;
+
+	rockchip_vpu_irq_thread(vpu, vpu->m2m_dec_dev, &vpu->dec_watchdog,
+				vpu->dec_irq_bytesused, vpu->dec_irq_result);
+	return IRQ_HANDLED;
+}
+
+static void rockchip_vpu_watchdog(struct rockchip_vpu_dev *vpu,
+				  struct v4l2_m2m_dev *m2m_dev)
 {
-	struct rockchip_vpu_dev *vpu;
 	struct rockchip_vpu_ctx *ctx;
 
-	vpu = container_of(to_delayed_work(work),
-			   struct rockchip_vpu_dev, watchdog_work);
-	ctx = (struct rockchip_vpu_ctx *)v4l2_m2m_get_curr_priv(vpu->m2m_enc_dev);
+	ctx = (struct rockchip_vpu_ctx *)v4l2_m2m_get_curr_priv(m2m_dev);
 	if (ctx) {
 		vpu_err("frame processing timed out!\n");
+		trace_rockchip_vpu_watchdog(ctx);
 		ctx->codec_ops->reset(ctx);
-		rockchip_vpu_job_finish(vpu, ctx, 0, VB2_BUF_STATE_ERROR);
+		trace_rockchip_vpu_reset(ctx);
+		rockchip_vpu_shadow_invalidate(ctx->shadow);
+		rockchip_vpu_sched_job_done(ctx);
+		if (ctx->codec_ops->done)
+			ctx->codec_ops->done(ctx, 0, VB2_BUF_STATE_ERROR);
+		rockchip_vpu_job_finish(vpu, m2m_dev, ctx, 0,
+					VB2_BUF_STATE_ERROR);
 	}
 }
 
+void rockchip_vpu_enc_watchdog(struct work_struct *work)
+{
+	struct rockchip_vpu_dev *vpu;
+
+	vpu = container_of(work, struct rockchip_vpu_dev, enc_watchdog.work);
+	rockchip_vpu_watchdog(vpu, vpu->m2m_enc_dev);
+}
+
+void rockchip_vpu_dec_watchdog(struct work_struct *work)
+{
+	struct rockchip_vpu_dev *vpu;
+
+	vpu = container_of(work, struct rockchip_vpu_dev, dec_watchdog.work);
+	rockchip_vpu_watchdog(vpu, vpu->m2m_dec_dev);
+}
+
 static void device_run(void *priv)
 {
 	struct rockchip_vpu_ctx *ctx = priv;
 
-	pm_runtime_get_sync(ctx->dev->dev);
+	trace_rockchip_vpu_device_run(ctx);
+	rockchip_vpu_stats_job_start(ctx);
+	rockchip_vpu_pm_job_start(ctx);
+	ctx->job_stamps[RK_VPU_STAMP_RESUMED] = ktime_get_ns();
 
-	ctx->codec_ops->run(ctx);
+	rockchip_vpu_run(ctx);
+}
+
+static void job_abort(void *priv)
+{
+	struct rockchip_vpu_ctx *ctx = priv;
+
+	/* Let the running frame complete, but stop batching after it. */
+	WRITE_ONCE(ctx->batch_abort, true);
 }
 
 static struct v4l2_m2m_ops vpu_m2m_ops = {
 	.device_run = device_run,
+	.job_ready = rockchip_vpu_sched_job_ready,
+	.job_abort = job_abort,
 };
 
 static int
@@ -129,12 +362,12 @@ enc_queue_init(void *priv, struct vb2_queue *src_vq, struct vb2_queue *dst_vq)
 	src_vq->io_modes = VB2_MMAP | VB2_DMABUF;
 	src_vq->drv_priv = ctx;
 	src_vq->ops = &rockchip_vpu_enc_queue_ops;
-	src_vq->mem_ops = &vb2_dma_contig_memops;
+	src_vq->mem_ops = &rockchip_vpu_mem_ops;
 	src_vq->dma_attrs = DMA_ATTR_ALLOC_SINGLE_PAGES |
 			    DMA_ATTR_NO_KERNEL_MAPPING;
-	src_vq->buf_struct_size = sizeof(struct v4l2_m2m_buffer);
+	src_vq->buf_struct_size = sizeof(struct rockchip_vpu_buf);
 	src_vq->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
-	src_vq->lock = &ctx->dev->vpu_mutex;
+	src_vq->lock = &ctx->dev->enc_mutex;
 	src_vq->dev = ctx->dev->v4l2_dev.dev;
 
 	ret = vb2_queue_init(src_vq);
@@ -145,20 +378,255 @@ enc_queue_init(void *priv, struct vb2_queue *src_vq, struct vb2_queue *dst_vq)
 	dst_vq->io_modes = VB2_MMAP | VB2_DMABUF;
 	dst_vq->drv_priv = ctx;
 	dst_vq->ops = &rockchip_vpu_enc_queue_ops;
-	dst_vq->mem_ops = &vb2_dma_contig_memops;
-	dst_vq->dma_attrs = DMA_ATTR_ALLOC_SINGLE_PAGES;
-	dst_vq->buf_struct_size = sizeof(struct v4l2_m2m_buffer);
+	dst_vq->mem_ops = &rockchip_vpu_mem_ops;
+	/*
+	 * The CPU only writes the headers and reads the bitstream once,
+	 * sequentially: map the buffers write-combined, with no cache to
+	 * maintain.
+	 */
+	dst_vq->dma_attrs = DMA_ATTR_ALLOC_SINGLE_PAGES |
+			    DMA_ATTR_WRITE_COMBINE;
+	dst_vq->buf_struct_size = sizeof(struct rockchip_vpu_buf);
 	dst_vq->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
-	dst_vq->lock = &ctx->dev->vpu_mutex;
+	dst_vq->lock = &ctx->dev->enc_mutex;
 	dst_vq->dev = ctx->dev->v4l2_dev.dev;
 
 	return vb2_queue_init(dst_vq);
 }
 
+static int
+dec_queue_init(void *priv, struct vb2_queue *src_vq, struct vb2_queue *dst_vq)
+{
+	struct rockchip_vpu_ctx *ctx = priv;
+	int ret;
+
+	src_vq->type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	src_vq->io_modes = VB2_MMAP | VB2_DMABUF;
+	src_vq->drv_priv = ctx;
+	src_vq->ops = &rockchip_vpu_dec_queue_ops;
+	src_vq->mem_ops = &rockchip_vpu_mem_ops;
+	src_vq->dma_attrs = DMA_ATTR_ALLOC_SINGLE_PAGES;
+	src_vq->buf_struct_size = sizeof(struct rockchip_vpu_buf);
+	src_vq->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+	src_vq->lock = &ctx->dev->dec_mutex;
+	src_vq->dev = ctx->dev->v4l2_dev.dev;
+	src_vq->supports_requests = true;
+
+	ret = vb2_queue_init(src_vq);
+	if (ret)
+		return ret;
+
+	dst_vq->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	dst_vq->io_modes = VB2_MMAP | VB2_DMABUF;
+	dst_vq->drv_priv = ctx;
+	dst_vq->ops = &rockchip_vpu_dec_queue_ops;
+	dst_vq->mem_ops = &rockchip_vpu_mem_ops;
+	dst_vq->dma_attrs = DMA_ATTR_ALLOC_SINGLE_PAGES |
+			    DMA_ATTR_NO_KERNEL_MAPPING;
+	dst_vq->buf_struct_size = sizeof(struct rockchip_vpu_buf);
+	dst_vq->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+	dst_vq->lock = &ctx->dev->dec_mutex;
+	dst_vq->dev = ctx->dev->v4l2_dev.dev;
+
+	return vb2_queue_init(dst_vq);
+}
+
+static int rockchip_vpu_s_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct rockchip_vpu_ctx *ctx = container_of(ctrl->handler,
+			struct rockchip_vpu_ctx, ctrl_handler);
+
+	switch (ctrl->id) {
+	case V4L2_CID_ROCKCHIP_VPU_SCHED_WEIGHT:
+		rockchip_vpu_sched_set_weight(ctx, ctrl->val);
+		break;
+	case V4L2_CID_ROCKCHIP_VPU_BATCH_SIZE:
+		WRITE_ONCE(ctx->batch_size, ctrl->val);
+		break;
+	case V4L2_CID_ROCKCHIP_VPU_LOW_LATENCY:
+		/* Applies from the next STREAMON. */
+		WRITE_ONCE(ctx->pm_low_latency, ctrl->val);
+		break;
+	case V4L2_CID_JPEG_QUANTIZATION:
+	case V4L2_CID_MPEG_VIDEO_H264_ENTROPY_MODE:
+	case V4L2_CID_MPEG_VIDEO_GOP_SIZE:
+	case V4L2_CID_MPEG_VIDEO_H264_I_FRAME_QP:
+	case V4L2_CID_MPEG_VIDEO_H264_P_FRAME_QP:
+	case V4L2_CID_MPEG_VIDEO_VPX_NUM_PARTITIONS:
+	case V4L2_CID_MPEG_VIDEO_VPX_I_FRAME_QP:
+	case V4L2_CID_MPEG_VIDEO_VPX_P_FRAME_QP:
+		/* The new values only become current after s_ctrl. */
+		WRITE_ONCE(ctx->regs_dirty, true);
+		break;
+	case V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME:
+		if (ctx->codec_mode == RK_VPU_MODE_H264_ENC)
+			WRITE_ONCE(ctx->h264_enc.force_idr, true);
+		else if (ctx->codec_mode == RK_VPU_MODE_VP8_ENC)
+			WRITE_ONCE(ctx->vp8_enc.force_key, true);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static const struct v4l2_ctrl_ops rockchip_vpu_ctrl_ops = {
+	.s_ctrl = rockchip_vpu_s_ctrl,
+};
+
 static struct rockchip_vpu_ctrl controls[] = {
 	{
 		.id = V4L2_CID_JPEG_QUANTIZATION,
 		.codec = RK_VPU_CODEC_JPEG,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+		},
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_H264_SPS,
+		.codec = RK_VPU_CODEC_H264_DEC,
+		.required = true,
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_H264_PPS,
+		.codec = RK_VPU_CODEC_H264_DEC,
+		.required = true,
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_H264_SCALING_MATRIX,
+		.codec = RK_VPU_CODEC_H264_DEC,
+		.required = true,
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAMS,
+		.codec = RK_VPU_CODEC_H264_DEC,
+		.required = true,
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAMS,
+		.codec = RK_VPU_CODEC_H264_DEC,
+		.required = true,
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_VP8_FRAME_HEADER,
+		.codec = RK_VPU_CODEC_VP8_DEC,
+		.required = true,
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_H264_ENTROPY_MODE,
+		.codec = RK_VPU_CODEC_H264_ENC,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.max = V4L2_MPEG_VIDEO_H264_ENTROPY_MODE_CABAC,
+			.def = V4L2_MPEG_VIDEO_H264_ENTROPY_MODE_CAVLC,
+		},
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_GOP_SIZE,
+		.codec = RK_VPU_CODEC_H264_ENC | RK_VPU_CODEC_VP8_ENC,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.min = 1,
+			.max = 65535,
+			.step = 1,
+			.def = 30,
+		},
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_H264_I_FRAME_QP,
+		.codec = RK_VPU_CODEC_H264_ENC,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.min = 0,
+			.max = 51,
+			.step = 1,
+			.def = 26,
+		},
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_H264_P_FRAME_QP,
+		.codec = RK_VPU_CODEC_H264_ENC,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.min = 0,
+			.max = 51,
+			.step = 1,
+			.def = 28,
+		},
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_VPX_NUM_PARTITIONS,
+		.codec = RK_VPU_CODEC_VP8_ENC,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.max = V4L2_CID_MPEG_VIDEO_VPX_2_PARTITIONS,
+			.def = V4L2_CID_MPEG_VIDEO_VPX_1_PARTITION,
+		},
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_VPX_I_FRAME_QP,
+		.codec = RK_VPU_CODEC_VP8_ENC,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.min = 0,
+			.max = 127,
+			.step = 1,
+			.def = 30,
+		},
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_VPX_P_FRAME_QP,
+		.codec = RK_VPU_CODEC_VP8_ENC,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.min = 0,
+			.max = 127,
+			.step = 1,
+			.def = 34,
+		},
+	},
+	{
+		.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME,
+		.codec = RK_VPU_CODEC_H264_ENC | RK_VPU_CODEC_VP8_ENC,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+		},
+	},
+	{
+		.id = V4L2_CID_ROCKCHIP_VPU_SCHED_WEIGHT,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.name = "Hardware Scheduling Weight",
+			.type = V4L2_CTRL_TYPE_INTEGER,
+			.min = RK_VPU_SCHED_WEIGHT_MIN,
+			.max = RK_VPU_SCHED_WEIGHT_MAX,
+			.step = 1,
+			.def = RK_VPU_SCHED_WEIGHT_DEFAULT,
+		},
+	},
+	{
+		.id = V4L2_CID_ROCKCHIP_VPU_BATCH_SIZE,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.name = "Frames per Hardware Job",
+			.type = V4L2_CTRL_TYPE_INTEGER,
+			.min = 1,
+			.max = RK_VPU_BATCH_SIZE_MAX,
+			.step = 1,
+			.def = 1,
+		},
+	},
+	{
+		.id = V4L2_CID_ROCKCHIP_VPU_LOW_LATENCY,
+		.cfg = {
+			.ops = &rockchip_vpu_ctrl_ops,
+			.name = "Keep Powered While Streaming",
+			.type = V4L2_CTRL_TYPE_BOOLEAN,
+			.min = 0,
+			.max = 1,
+			.step = 1,
+			.def = 0,
+		},
 	},
 };
 
@@ -193,7 +661,9 @@ static int rockchip_vpu_ctrls_setup(struct rockchip_vpu_dev *vpu,
 	}
 
 	for (i = 0, j = 0; i < num_ctrls; i++) {
-		if (!(vpu->variant->codec & controls[i].codec))
+		/* Controls without a codec apply to every context. */
+		if (controls[i].codec &&
+		    !(vpu->variant->codec & controls[i].codec))
 			continue;
 		controls[i].cfg.id = controls[i].id;
 		ctx->ctrls[j++] = v4l2_ctrl_new_custom(&ctx->ctrl_handler,
@@ -212,6 +682,62 @@ static int rockchip_vpu_ctrls_setup(struct rockchip_vpu_dev *vpu,
 	return 0;
 }
 
+/*
+ * A request carries exactly one bitstream buffer, along with every
+ * control the codec of its context requires.
+ */
+static int rockchip_vpu_request_validate(struct media_request *req)
+{
+	struct media_request_object *obj;
+	struct v4l2_ctrl_handler *hdl;
+	struct rockchip_vpu_ctx *ctx = NULL;
+	unsigned int count, i;
+	u32 codec;
+
+	list_for_each_entry(obj, &req->objects, list) {
+		struct vb2_buffer *vb;
+
+		if (vb2_request_object_is_buffer(obj)) {
+			vb = container_of(obj, struct vb2_buffer, req_obj);
+			ctx = vb2_get_drv_priv(vb->vb2_queue);
+			break;
+		}
+	}
+	if (!ctx)
+		return -ENOENT;
+
+	count = vb2_request_buffer_cnt(req);
+	if (!count)
+		return -ENOENT;
+	if (count > 1)
+		return -EINVAL;
+
+	hdl = v4l2_ctrl_request_hdl_find(req, &ctx->ctrl_handler);
+	if (!hdl) {
+		vpu_err("missing codec controls\n");
+		return -ENOENT;
+	}
+
+	codec = BIT(ctx->vpu_src_fmt->codec_mode);
+	for (i = 0; i < ARRAY_SIZE(controls); i++) {
+		if (!controls[i].required || !(controls[i].codec & codec))
+			continue;
+		if (!v4l2_ctrl_request_hdl_ctrl_find(hdl, controls[i].id)) {
+			vpu_err("missing control %#x\n", controls[i].id);
+			v4l2_ctrl_request_hdl_put(hdl);
+			return -ENOENT;
+		}
+	}
+	v4l2_ctrl_request_hdl_put(hdl);
+
+	return vb2_request_validate(req);
+}
+
+static const struct media_device_ops rockchip_vpu_media_ops = {
+	.req_validate = rockchip_vpu_request_validate,
+	.req_queue = v4l2_m2m_request_queue,
+};
+
 /*
  * V4L2 file operations.
  */
@@ -240,6 +766,9 @@ static int rockchip_vpu_open(struct file *filp)
 	if (vdev == vpu->vfd_enc)
 		ctx->fh.m2m_ctx = v4l2_m2m_ctx_init(vpu->m2m_enc_dev, ctx,
 						    &enc_queue_init);
+	else if (vdev == vpu->vfd_dec && vpu->variant->num_dec_fmts)
+		ctx->fh.m2m_ctx = v4l2_m2m_ctx_init(vpu->m2m_dec_dev, ctx,
+						    &dec_queue_init);
 	else
 		ctx->fh.m2m_ctx = ERR_PTR(-ENODEV);
 	if (IS_ERR(ctx->fh.m2m_ctx)) {
@@ -255,6 +784,12 @@ static int rockchip_vpu_open(struct file *filp)
 	if (vdev == vpu->vfd_enc) {
 		rockchip_vpu_enc_reset_dst_fmt(vpu, ctx);
 		rockchip_vpu_enc_reset_src_fmt(vpu, ctx);
+		rockchip_vpu_sched_add_ctx(&vpu->enc_sched, ctx);
+		ctx->shadow = &vpu->enc_shadow;
+	} else {
+		rockchip_vpu_dec_reset_fmts(vpu, ctx);
+		rockchip_vpu_sched_add_ctx(&vpu->dec_sched, ctx);
+		ctx->shadow = &vpu->dec_shadow;
 	}
 
 	ret = rockchip_vpu_ctrls_setup(vpu, ctx);
@@ -266,6 +801,7 @@ static int rockchip_vpu_open(struct file *filp)
 	return 0;
 
 err_fh_free:
+	rockchip_vpu_sched_del_ctx(ctx);
 	v4l2_fh_del(&ctx->fh);
 	v4l2_fh_exit(&ctx->fh);
 	kfree(ctx);
@@ -281,7 +817,9 @@ static int rockchip_vpu_release(struct file *filp)
 	 * No need for extra locking because this was the last reference
 	 * to this file.
 	 */
+	rockchip_vpu_sched_del_ctx(ctx);
 	v4l2_m2m_ctx_release(ctx->fh.m2m_ctx);
+	rockchip_vpu_dmabuf_flush(ctx->dev);
 	v4l2_fh_del(&ctx->fh);
 	v4l2_fh_exit(&ctx->fh);
 	v4l2_ctrl_handler_free(&ctx->ctrl_handler);
@@ -318,6 +856,8 @@ static int rockchip_vpu_video_register_device(
 	struct rockchip_vpu_dev* __restrict const vpu,
 	struct video_device** __restrict const dst,
 	struct v4l2_m2m_dev* __restrict const m2m_dev,
+	struct mutex* __restrict const lock,
+	const struct v4l2_ioctl_ops* __restrict const ioctl_ops,
 	int const media_controller_function,
 	char const *  __restrict const name_suffix)
 {
@@ -342,11 +882,12 @@ static int rockchip_vpu_video_register_device(
 	}
 
 	*vfd = rockchip_vfd_common_props;
-	/* Using the same Mutex and SpinLock, since I think that
-	 * Rockchip VPU can only do one operation at a time, be it
-	 * encoding or decoding.
+	/* The encoder and the decoder are separate hardware blocks,
+	 * each with its own mem2mem device, so they get their own
+	 * lock and can be used concurrently.
 	 */
-	vfd->lock = &vpu->vpu_mutex;
+	vfd->lock = lock;
+	vfd->ioctl_ops = ioctl_ops;
 	vfd->v4l2_dev = &vpu->v4l2_dev;
 	snprintf(vfd->name, sizeof(vfd->name), "%s-%s",
 		match->compatible, name_suffix);
@@ -382,7 +923,8 @@ static int rockchip_vpu_video_register_encoder_device(
 {
 	return rockchip_vpu_video_register_device(
 		vpu, &vpu->vfd_enc,
-		vpu->m2m_enc_dev, MEDIA_ENT_F_PROC_VIDEO_ENCODER,
+		vpu->m2m_enc_dev, &vpu->enc_mutex,
+		&rockchip_vpu_enc_ioctl_ops, MEDIA_ENT_F_PROC_VIDEO_ENCODER,
 		"enc");
 }
 
@@ -391,7 +933,8 @@ static int rockchip_vpu_video_register_decoder_device(
 {
 	return rockchip_vpu_video_register_device(
 		vpu, &vpu->vfd_dec,
-		vpu->m2m_dec_dev, MEDIA_ENT_F_PROC_VIDEO_DECODER,
+		vpu->m2m_dec_dev, &vpu->dec_mutex,
+		&rockchip_vpu_dec_ioctl_ops, MEDIA_ENT_F_PROC_VIDEO_DECODER,
 		"dec");
 }
 
@@ -410,9 +953,13 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 	vpu->dev = &pdev->dev;
 	vpu->pdev = pdev;
 
-	/* Init a mutex and spinlock */
-	mutex_init(&vpu->vpu_mutex);
+	/* Init the encoder and decoder mutexes and the spinlock */
+	mutex_init(&vpu->enc_mutex);
+	mutex_init(&vpu->dec_mutex);
 	spin_lock_init(&vpu->irqlock);
+	rockchip_vpu_sched_init(&vpu->enc_sched, &vpu->enc_mutex);
+	rockchip_vpu_sched_init(&vpu->dec_sched, &vpu->dec_mutex);
+	rockchip_vpu_dmabuf_init(vpu);
 
 	/* Try to match rockchip,rk3399-vpu or rockchip,rk3288-vpu */
 	match = of_match_node(of_rockchip_vpu_match, pdev->dev.of_node);
@@ -424,8 +971,9 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 	/* Use the "variant" data associated with the current match */
 	vpu->variant = match->data;
 
-	/* Init a watchdog */
-	INIT_DELAYED_WORK(&vpu->watchdog_work, rockchip_vpu_watchdog);
+	/* Init a watchdog for each hardware block */
+	rockchip_vpu_watchdog_init(&vpu->enc_watchdog, rockchip_vpu_enc_watchdog);
+	rockchip_vpu_watchdog_init(&vpu->dec_watchdog, rockchip_vpu_dec_watchdog);
 
 	/* Initialize the clocks */
 	for (i = 0; i < vpu->variant->num_clocks; i++)
@@ -447,9 +995,9 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 	vpu->dec_base = vpu->base + vpu->variant->dec_offset;
 
 	/* Set up the device for DMA transfers */
-	ret = dma_set_coherent_mask(vpu->dev, DMA_BIT_MASK(32));
+	ret = dma_set_mask_and_coherent(vpu->dev, DMA_BIT_MASK(32));
 	if (ret) {
-		dev_err(vpu->dev, "Could not set DMA coherent mask.\n");
+		dev_err(vpu->dev, "Could not set DMA mask.\n");
 		return ret;
 	}
 
@@ -463,12 +1011,15 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 			return -ENXIO;
 		}
 
-		ret = devm_request_irq(vpu->dev, irq, vpu->variant->vepu_irq,
-				       0, dev_name(vpu->dev), vpu);
+		ret = devm_request_threaded_irq(vpu->dev, irq,
+						vpu->variant->vepu_irq,
+						rockchip_vpu_enc_irq_thread,
+						0, dev_name(vpu->dev), vpu);
 		if (ret) {
 			dev_err(vpu->dev, "Could not request vepu IRQ.\n");
 			return ret;
 		}
+		vpu->enc_irq = irq;
 	}
 
 	if (vpu->variant->vdpu_irq) {
@@ -480,12 +1031,15 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 			return -ENXIO;
 		}
 
-		ret = devm_request_irq(vpu->dev, irq, vpu->variant->vdpu_irq,
-			0, dev_name(vpu->dev), vpu);
+		ret = devm_request_threaded_irq(vpu->dev, irq,
+						vpu->variant->vdpu_irq,
+						rockchip_vpu_dec_irq_thread,
+						0, dev_name(vpu->dev), vpu);
 		if (ret) {
 			dev_err(vpu->dev, "Could not request vdpu IRQ.\n");
 			return ret;
 		}
+		vpu->dec_irq = irq;
 	}
 
 	/* Let the rk3xxx_init function take care of specificities */
@@ -495,9 +1049,8 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 		return ret;
 	}
 
-	/* Set up the Power Management Auto Suspend (??) */
-	pm_runtime_set_autosuspend_delay(vpu->dev, 100);
-	pm_runtime_use_autosuspend(vpu->dev);
+	/* Set up the Power Management Auto Suspend */
+	rockchip_vpu_pm_init(vpu);
 	pm_runtime_enable(vpu->dev);
 
 	/* Prepare the clocks */
@@ -507,6 +1060,20 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 		return ret;
 	}
 
+	/*
+	 * The hardware takes a single address per plane. Behind the IOMMU,
+	 * the buffers are allocated from ordinary pages and mapped to one
+	 * IOVA range, as long as the mappings are not split in segments.
+	 */
+	if (iommu_get_domain_for_dev(vpu->dev)) {
+		ret = vb2_dma_contig_set_max_seg_size(vpu->dev,
+						      DMA_BIT_MASK(32));
+		if (ret)
+			goto err_clk_unprepare;
+	} else {
+		dev_info(vpu->dev, "No IOMMU, buffers come from CMA\n");
+	}
+
 	/* Register the V4L2 device */
 	ret = v4l2_device_register(&pdev->dev, &vpu->v4l2_dev);
 	if (ret) {
@@ -534,6 +1101,7 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 	vpu->mdev.dev = vpu->dev;
 	strlcpy(vpu->mdev.model, DRIVER_NAME, sizeof(vpu->mdev.model));
 	media_device_init(&vpu->mdev);
+	vpu->mdev.ops = &rockchip_vpu_media_ops;
 	vpu->v4l2_dev.mdev = &vpu->mdev;
 
 	ret = rockchip_vpu_video_register_encoder_device(vpu);
@@ -553,10 +1121,16 @@ static int rockchip_vpu_probe(struct platform_device *pdev)
 		v4l2_err(&vpu->v4l2_dev, "Failed to register mem2mem media device\n");
 		goto err_video_decoder_dev_unreg;
 	}
+
+	rockchip_vpu_stats_init(vpu);
+	rockchip_vpu_debug_init(vpu);
+	rockchip_vpu_pm_debugfs_init(vpu);
+	rockchip_vpu_dmabuf_debugfs_init(vpu);
+	rockchip_vpu_devfreq_init(vpu);
 	return 0;
 
 err_video_decoder_dev_unreg:
-	if (vpu->vfd_enc) {
+	if (vpu->vfd_dec) {
 		video_unregister_device(vpu->vfd_dec);
 		video_device_release(vpu->vfd_dec);
 	}
@@ -572,6 +1146,7 @@ err_m2m_enc_dev_rel:
 err_v4l2_unreg:
 	v4l2_device_unregister(&vpu->v4l2_dev);
 err_clk_unprepare:
+	vb2_dma_contig_clear_max_seg_size(vpu->dev);
 	clk_bulk_unprepare(vpu->variant->num_clocks, vpu->clocks);
 	pm_runtime_disable(vpu->dev);
 	return ret;
@@ -583,15 +1158,43 @@ static int rockchip_vpu_remove(struct platform_device *pdev)
 
 	v4l2_info(&vpu->v4l2_dev, "Removing %s\n", pdev->name);
 
+	rockchip_vpu_devfreq_cleanup(vpu);
+	rockchip_vpu_stats_cleanup(vpu);
+
+	/*
+	 * The interrupt handlers are only freed by devres after this
+	 * returns. Disable them first: their threads may start the next
+	 * batched job, arming the watchdog again, and trace the registers
+	 * they access.
+	 */
+	if (vpu->enc_irq)
+		disable_irq(vpu->enc_irq);
+	if (vpu->dec_irq)
+		disable_irq(vpu->dec_irq);
+
+	cancel_work_sync(&vpu->enc_sched.work);
+	cancel_work_sync(&vpu->dec_sched.work);
+	rockchip_vpu_watchdog_stop(&vpu->enc_watchdog);
+	rockchip_vpu_watchdog_stop(&vpu->dec_watchdog);
+	rockchip_vpu_debug_cleanup(vpu);
+
 	media_device_unregister(&vpu->mdev);
+	v4l2_m2m_unregister_media_controller(vpu->m2m_dec_dev);
 	v4l2_m2m_unregister_media_controller(vpu->m2m_enc_dev);
+	v4l2_m2m_release(vpu->m2m_dec_dev);
 	v4l2_m2m_release(vpu->m2m_enc_dev);
 	media_device_cleanup(&vpu->mdev);
+	if (vpu->vfd_dec) {
+		video_unregister_device(vpu->vfd_dec);
+		video_device_release(vpu->vfd_dec);
+	}
 	if (vpu->vfd_enc) {
 		video_unregister_device(vpu->vfd_enc);
 		video_device_release(vpu->vfd_enc);
 	}
 	v4l2_device_unregister(&vpu->v4l2_dev);
+	rockchip_vpu_dmabuf_flush(vpu);
+	vb2_dma_contig_clear_max_seg_size(vpu->dev);
 	clk_bulk_unprepare(vpu->variant->num_clocks, vpu->clocks);
 	pm_runtime_disable(vpu->dev);
 	return 0;
@@ -609,6 +1212,13 @@ static int __maybe_unused rockchip_vpu_runtime_resume(struct device *dev)
 {
 	struct rockchip_vpu_dev *vpu = dev_get_drvdata(dev);
 
+	vpu->pm_resumes++;
+	vpu_debug(1, "runtime resume %llu\n", vpu->pm_resumes);
+
+	/* The power domain may have been off, losing the registers. */
+	rockchip_vpu_shadow_invalidate(&vpu->enc_shadow);
+	rockchip_vpu_shadow_invalidate(&vpu->dec_shadow);
+
 	return clk_bulk_enable(vpu->variant->num_clocks, vpu->clocks);
 }
 
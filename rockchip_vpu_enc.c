@@ -16,6 +16,7 @@
 
 #include <linux/interrupt.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/pm_runtime.h>
 #include <linux/videodev2.h>
@@ -30,6 +31,15 @@
 #include "rockchip_vpu_hw.h"
 #include "rockchip_vpu_common.h"
 
+/* Keeps the rows of all the planes, even 4:2:0 chroma, 64-bit aligned. */
+#define RK_VPU_ENC_STRIDE_ALIGN		16
+/* Largest row length of the source, in pixels. */
+#define RK_VPU_ENC_MAX_ROW_LEN		0x3fff
+/* The hardware reads the planes from 64-bit aligned addresses. */
+#define RK_VPU_ENC_OFFSET_ALIGN		8
+/* Unit of the columns the hardware adds right of the source, in pixels. */
+#define RK_VPU_ENC_OVERFILL_R_UNIT	4
+
 static const struct rockchip_vpu_fmt *
 rockchip_vpu_find_format(struct rockchip_vpu_ctx *ctx, u32 fourcc)
 {
@@ -182,19 +192,111 @@ static int vidioc_g_fmt_cap(struct file *file, void *priv,
 	return 0;
 }
 
+/* Single plane holding the luma, then the chroma, of a 4:2:0 image. */
+static bool rockchip_vpu_enc_is_contig_420(const struct rockchip_vpu_fmt *fmt)
+{
+	return fmt->num_planes == 1 &&
+	       (fmt->enc_fmt == RK3288_VPU_ENC_FMT_YUV420P ||
+		fmt->enc_fmt == RK3288_VPU_ENC_FMT_YUV420SP);
+}
+
+/* Depth of the first plane, without the chroma of the contiguous formats. */
+static unsigned int
+rockchip_vpu_enc_luma_depth(const struct rockchip_vpu_fmt *fmt)
+{
+	return rockchip_vpu_enc_is_contig_420(fmt) ? 8 : fmt->depth[0];
+}
+
+/*
+ * The hardware takes a single row length, in pixels, for all the planes:
+ * the stride asked for the first plane is rounded up so that every row
+ * of every plane starts on a 64-bit boundary, and the strides of the
+ * chroma planes follow from it.
+ */
 static void calculate_plane_sizes(const struct rockchip_vpu_fmt *fmt,
 				  struct v4l2_pix_format_mplane *pix_mp)
 {
-	unsigned int w = pix_mp->width;
+	unsigned int depth = rockchip_vpu_enc_luma_depth(fmt);
 	unsigned int h = pix_mp->height;
+	struct v4l2_plane_pix_format *plane;
+	unsigned int stride;
 	int i;
 
+	stride = max(pix_mp->plane_fmt[0].bytesperline,
+		     pix_mp->width * depth / 8);
+	stride = round_up(stride, RK_VPU_ENC_STRIDE_ALIGN);
+	stride = min(stride, round_down(RK_VPU_ENC_MAX_ROW_LEN * depth / 8,
+					RK_VPU_ENC_STRIDE_ALIGN));
+
 	for (i = 0; i < fmt->num_planes; ++i) {
-		memset(pix_mp->plane_fmt[i].reserved, 0,
-		       sizeof(pix_mp->plane_fmt[i].reserved));
-		pix_mp->plane_fmt[i].bytesperline = w * fmt->depth[i] / 8;
-		pix_mp->plane_fmt[i].sizeimage = h *
-					pix_mp->plane_fmt[i].bytesperline;
+		plane = &pix_mp->plane_fmt[i];
+		memset(plane->reserved, 0, sizeof(plane->reserved));
+		/* The chroma planes of 4:2:0 images have half the rows. */
+		plane->bytesperline = i ? stride * fmt->depth[i] * 2 / depth :
+				      stride;
+		plane->sizeimage = stride * h * fmt->depth[i] / depth;
+	}
+}
+
+/* Row length of the source, in pixels, as programmed in the hardware. */
+unsigned int rockchip_vpu_enc_row_len(const struct rockchip_vpu_ctx *ctx)
+{
+	return ctx->src_fmt.plane_fmt[0].bytesperline * 8 /
+	       rockchip_vpu_enc_luma_depth(ctx->vpu_src_fmt);
+}
+
+/*
+ * Columns the hardware adds right of the source to complete the last
+ * macroblocks, in units of RK_VPU_ENC_OVERFILL_R_UNIT pixels.
+ */
+unsigned int
+rockchip_vpu_enc_overfill_right(const struct rockchip_vpu_ctx *ctx)
+{
+	unsigned int w = ctx->src_fmt.width;
+
+	return (round_up(w, MB_DIM) - w) / RK_VPU_ENC_OVERFILL_R_UNIT;
+}
+
+/* Rows the hardware adds below the source to complete the last macroblocks. */
+unsigned int
+rockchip_vpu_enc_overfill_bottom(const struct rockchip_vpu_ctx *ctx)
+{
+	unsigned int h = ctx->src_fmt.height;
+
+	return round_up(h, MB_DIM) - h;
+}
+
+/*
+ * Get the addresses of the luma, Cb and Cr planes of a source buffer,
+ * for rockchip_vpu_codec_ops.prepare_buf. The data of each plane starts
+ * at its data_offset. The chroma planes of the contiguous 4:2:0 formats
+ * follow the luma plane, the packed formats have all the components at
+ * the same address.
+ */
+void rockchip_vpu_enc_src_addrs(struct rockchip_vpu_ctx *ctx,
+				struct vb2_buffer *vb, dma_addr_t *addrs)
+{
+	const struct v4l2_pix_format_mplane *pix_fmt = &ctx->src_fmt;
+	const struct rockchip_vpu_fmt *fmt = ctx->vpu_src_fmt;
+	unsigned int luma_size, i;
+
+	for (i = 0; i < fmt->num_planes; i++)
+		addrs[i] = vb2_dma_contig_plane_dma_addr(vb, i) +
+			   vb->planes[i].data_offset;
+
+	if (fmt->num_planes == 2) {
+		addrs[PLANE_CR] = addrs[PLANE_CB];
+	} else if (rockchip_vpu_enc_is_contig_420(fmt)) {
+		luma_size = pix_fmt->plane_fmt[0].bytesperline *
+			    pix_fmt->height;
+		addrs[PLANE_CB] = addrs[PLANE_Y] + luma_size;
+		if (fmt->enc_fmt == RK3288_VPU_ENC_FMT_YUV420P)
+			addrs[PLANE_CR] = addrs[PLANE_CB] + luma_size / 4;
+		else
+			addrs[PLANE_CR] = addrs[PLANE_CB];
+	} else if (fmt->num_planes == 1) {
+		addrs[PLANE_CB] = addrs[PLANE_Y];
+		addrs[PLANE_CR] = addrs[PLANE_Y];
 	}
 }
 
@@ -235,10 +337,7 @@ vidioc_try_fmt_out(struct file *file, void *priv, struct v4l2_format *f)
 	struct rockchip_vpu_ctx *ctx = fh_to_ctx(priv);
 	struct v4l2_pix_format_mplane *pix_mp = &f->fmt.pix_mp;
 	const struct rockchip_vpu_fmt *fmt;
-	unsigned long dma_align;
-	bool need_alignment;
 	char str[5];
-	int i;
 
 	vpu_debug(4, "%s\n", fmt2str(pix_mp->pixelformat, str));
 
@@ -256,32 +355,17 @@ vidioc_try_fmt_out(struct file *file, void *priv, struct v4l2_format *f)
 	pix_mp->height = clamp(pix_mp->height,
 			ctx->vpu_dst_fmt->frmsize.min_height,
 			ctx->vpu_dst_fmt->frmsize.max_height);
-	/* Round up to macroblocks. */
-	pix_mp->width = round_up(pix_mp->width, MB_DIM);
-	pix_mp->height = round_up(pix_mp->height, MB_DIM);
+	/*
+	 * The hardware completes the macroblocks of the last column and row
+	 * itself, so that the buffers hold the exact image: the width only
+	 * needs to be a whole number of overfill units, the height to be
+	 * even for the 4:2:0 chroma.
+	 */
+	pix_mp->width = round_up(pix_mp->width, RK_VPU_ENC_OVERFILL_R_UNIT);
+	pix_mp->height = round_up(pix_mp->height, 2);
 
 	/* Fill remaining fields */
 	calculate_plane_sizes(fmt, pix_mp);
-
-	dma_align = dma_get_cache_alignment();
-	need_alignment = false;
-	for (i = 0; i < fmt->num_planes; i++) {
-		if (!IS_ALIGNED(pix_mp->plane_fmt[i].sizeimage,
-				dma_align)) {
-			need_alignment = true;
-			break;
-		}
-	}
-	if (!need_alignment)
-		return 0;
-
-	pix_mp->height = round_up(pix_mp->height, dma_align * 4 / MB_DIM);
-	if (pix_mp->height > ctx->vpu_dst_fmt->frmsize.max_height) {
-		vpu_err("Aligned height higher than maximum.\n");
-		return -EINVAL;
-	}
-	/* Fill in remaining fields, again */
-	calculate_plane_sizes(fmt, pix_mp);
 	return 0;
 }
 
@@ -366,6 +450,16 @@ vidioc_s_fmt_out(struct file *file, void *priv, struct v4l2_format *f)
 	if (ret)
 		return ret;
 
+	/*
+	 * Neither may the size, as the H.264 and VP8 reconstruction and
+	 * reference buffers are sized from it when the CAPTURE queue starts
+	 * streaming.
+	 */
+	if (vb2_is_busy(peer_vq) &&
+	    (pix_mp->width != ctx->src_fmt.width ||
+	     pix_mp->height != ctx->src_fmt.height))
+		return -EBUSY;
+
 	ctx->vpu_src_fmt = rockchip_vpu_find_format(ctx, pix_mp->pixelformat);
 	ctx->src_fmt = *pix_mp;
 
@@ -430,6 +524,50 @@ vidioc_s_fmt_cap(struct file *file, void *priv, struct v4l2_format *f)
 	return 0;
 }
 
+static struct v4l2_fract *vidioc_parm_timeperframe(struct v4l2_streamparm *a)
+{
+	switch (a->type) {
+	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
+		a->parm.output.capability = V4L2_CAP_TIMEPERFRAME;
+		return &a->parm.output.timeperframe;
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
+		a->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+		return &a->parm.capture.timeperframe;
+	default:
+		return NULL;
+	}
+}
+
+/* A zero frame interval means that none was declared. */
+static int vidioc_g_parm(struct file *file, void *priv,
+			 struct v4l2_streamparm *a)
+{
+	struct rockchip_vpu_ctx *ctx = fh_to_ctx(priv);
+	struct v4l2_fract *tpf = vidioc_parm_timeperframe(a);
+
+	if (!tpf)
+		return -EINVAL;
+	*tpf = ctx->timeperframe;
+	return 0;
+}
+
+/*
+ * The frame rate of both queues is the same. It is only used to choose
+ * the ACLK frequency.
+ */
+static int vidioc_s_parm(struct file *file, void *priv,
+			 struct v4l2_streamparm *a)
+{
+	struct rockchip_vpu_ctx *ctx = fh_to_ctx(priv);
+	struct v4l2_fract *tpf = vidioc_parm_timeperframe(a);
+
+	if (!tpf)
+		return -EINVAL;
+	rockchip_vpu_devfreq_set_timeperframe(ctx, tpf);
+	*tpf = ctx->timeperframe;
+	return 0;
+}
+
 const struct v4l2_ioctl_ops rockchip_vpu_enc_ioctl_ops = {
 	.vidioc_querycap = vidioc_querycap,
 	.vidioc_enum_framesizes = vidioc_enum_framesizes,
@@ -443,6 +581,9 @@ const struct v4l2_ioctl_ops rockchip_vpu_enc_ioctl_ops = {
 	.vidioc_enum_fmt_vid_out_mplane = vidioc_enum_fmt_vid_out_mplane,
 	.vidioc_enum_fmt_vid_cap_mplane = vidioc_enum_fmt_vid_cap_mplane,
 
+	.vidioc_g_parm = vidioc_g_parm,
+	.vidioc_s_parm = vidioc_s_parm,
+
 	.vidioc_reqbufs = v4l2_m2m_ioctl_reqbufs,
 	.vidioc_querybuf = v4l2_m2m_ioctl_querybuf,
 	.vidioc_qbuf = v4l2_m2m_ioctl_qbuf,
@@ -505,7 +646,7 @@ static int rockchip_vpu_buf_prepare(struct vb2_buffer *vb)
 	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(vq);
 	const struct rockchip_vpu_fmt *vpu_fmt;
 	struct v4l2_pix_format_mplane *pixfmt;
-	unsigned int sz;
+	unsigned int sz, offset;
 	int ret = 0;
 	int i;
 
@@ -533,15 +674,27 @@ static int rockchip_vpu_buf_prepare(struct vb2_buffer *vb)
 
 	for (i = 0; i < vpu_fmt->num_planes; ++i) {
 		sz = pixfmt->plane_fmt[i].sizeimage;
-		vpu_debug(4, "plane %d size: %ld, sizeimage: %u\n",
-			  i, vb2_plane_size(vb, i), sz);
-		if (vb2_plane_size(vb, i) < sz) {
+		/* Only set by userspace on the OUTPUT queue. */
+		offset = vb->planes[i].data_offset;
+		vpu_debug(4, "plane %d size: %ld, offset: %u, sizeimage: %u\n",
+			  i, vb2_plane_size(vb, i), offset, sz);
+		if (!IS_ALIGNED(offset, RK_VPU_ENC_OFFSET_ALIGN)) {
+			vpu_err("plane %d offset is not 64-bit aligned\n", i);
+			ret = -EINVAL;
+			break;
+		}
+		if (offset > vb2_plane_size(vb, i) ||
+		    vb2_plane_size(vb, i) - offset < sz) {
 			vpu_err("plane %d is too small for output\n", i);
 			ret = -EINVAL;
 			break;
 		}
 	}
 
+	if (!ret) {
+		rockchip_vpu_mem_set_cache_hints(vb);
+		rockchip_vpu_prepare_buf_regs(ctx, vb);
+	}
 	return ret;
 }
 
@@ -549,7 +702,10 @@ static void rockchip_vpu_buf_queue(struct vb2_buffer *vb)
 {
 	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
 	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct rockchip_vpu_buf *buf =
+		container_of(vbuf, struct rockchip_vpu_buf, m2m_buf.vb);
 
+	buf->queued_ns = ktime_get_ns();
 	v4l2_m2m_buf_queue(ctx->fh.m2m_ctx, vbuf);
 }
 
@@ -557,6 +713,8 @@ static int rockchip_vpu_start_streaming(struct vb2_queue *q, unsigned int count)
 {
 	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(q);
 	enum rockchip_vpu_codec_mode codec_mode;
+	struct vb2_v4l2_buffer *vbuf;
+	int ret;
 
 	if (V4L2_TYPE_IS_OUTPUT(q->type))
 		ctx->sequence_out = 0;
@@ -567,8 +725,22 @@ static int rockchip_vpu_start_streaming(struct vb2_queue *q, unsigned int count)
 	codec_mode = ctx->vpu_dst_fmt->codec_mode;
 
 	vpu_debug(4, "Codec mode = %d\n", codec_mode);
+	ctx->codec_mode = codec_mode;
 	ctx->codec_ops = &ctx->dev->variant->codec_ops[codec_mode];
 
+	/* The codec state lives as long as the bitstream queue streams. */
+	if (!V4L2_TYPE_IS_OUTPUT(q->type) && ctx->codec_ops->init) {
+		ret = ctx->codec_ops->init(ctx);
+		if (ret) {
+			while ((vbuf = v4l2_m2m_dst_buf_remove(ctx->fh.m2m_ctx)))
+				v4l2_m2m_buf_done(vbuf, VB2_BUF_STATE_QUEUED);
+			return ret;
+		}
+	}
+
+	rockchip_vpu_prepare_regs(ctx);
+	rockchip_vpu_pm_stream_on(ctx);
+
 	return 0;
 }
 
@@ -576,6 +748,10 @@ static void rockchip_vpu_stop_streaming(struct vb2_queue *q)
 {
 	struct rockchip_vpu_ctx *ctx = vb2_get_drv_priv(q);
 
+	rockchip_vpu_pm_stream_off(ctx);
+	if (!V4L2_TYPE_IS_OUTPUT(q->type) && ctx->codec_ops->exit)
+		ctx->codec_ops->exit(ctx);
+
 	/* The mem2mem framework calls v4l2_m2m_cancel_job before
 	 * .stop_streaming, so there isn't any job running and
 	 * it is safe to return all the buffers.
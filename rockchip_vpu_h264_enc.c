@@ -0,0 +1,486 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * H.264 encoding helpers shared by the variants.
+ *
+ * The encoder is stateful: it produces an Annex B byte stream, with a
+ * single slice per frame. The hardware writes the slice headers and
+ * data, the SPS and PPS are written by the driver before every IDR
+ * frame. The other frames are P frames, predicted from the previous
+ * reconstructed frame, which the hardware writes alongside the stream.
+ *
+ * The QP is fixed for each frame type, and the mode decision biases of
+ * the hardware are derived from the QP of the P frames.
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+#include "rockchip_vpu_hw.h"
+
+#define H264_NAL_SPS			7
+#define H264_NAL_PPS			8
+#define H264_NUM_QPS			52
+#define H264_NUM_CABAC_CTXS		460
+/* Contexts per table of the hardware, padded from 460. */
+#define H264_CABAC_TBL_CTXS		464
+
+/* The hardware writes frame_num on 16 bits. */
+#define H264_LOG2_MAX_FRAME_NUM		16
+
+/* Bits saved by 16x16 intra prediction over 16 4x4 modes. */
+#define H264_INTRA4X4_MODE_BITS		32
+/* Bits of a 4x4 intra mode which is not the predicted one. */
+#define H264_REM_MODE_BITS		3
+/* Bits of an intra macroblock type over an inter one. */
+#define H264_INTRA_MB_BITS		16
+/* Bits of a motion vector difference. */
+#define H264_MVD_BITS			2
+/* Header and motion vector bits of the partitions over 16x16. */
+#define H264_SPLIT_16X8_BITS		8
+#define H264_SPLIT_8X8_BITS		24
+#define H264_SPLIT_4X4_BITS		48
+
+/*
+ * Lagrangian multiplier of the mode decisions, 2^((qp - 12) / 6), close
+ * to the SAD one of the reference encoder.
+ */
+static const u8 rockchip_vpu_h264_enc_lambda[H264_NUM_QPS] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 6, 6, 7, 8, 9,
+	10, 11, 13, 14, 16, 18, 20, 23, 25, 29, 32, 36, 40, 45, 51, 57,
+	64, 72, 81, 91,
+};
+
+/* Limits of the frame size and macroblock rate of each level. */
+static const struct {
+	u8 level_idc;
+	u32 max_fs;
+	u32 max_mbps;
+} rockchip_vpu_h264_enc_levels[] = {
+	{ 10, 99, 1485 },
+	{ 11, 396, 3000 },
+	{ 12, 396, 6000 },
+	{ 13, 396, 11880 },
+	{ 20, 396, 11880 },
+	{ 21, 792, 19800 },
+	{ 22, 1620, 20250 },
+	{ 30, 1620, 40500 },
+	{ 31, 3600, 108000 },
+	{ 32, 5120, 216000 },
+	{ 40, 8192, 245760 },
+	{ 42, 8704, 522240 },
+	{ 50, 22080, 589824 },
+	{ 51, 36864, 983040 },
+};
+
+struct rockchip_vpu_h264_enc_bs {
+	u8 buf[32];
+	unsigned int bits;
+};
+
+static void rockchip_vpu_h264_enc_put_bits(struct rockchip_vpu_h264_enc_bs *bs,
+					   u32 val, unsigned int n)
+{
+	while (n--) {
+		if (WARN_ON(bs->bits >= sizeof(bs->buf) * 8))
+			return;
+		if ((val >> n) & 1)
+			bs->buf[bs->bits / 8] |= 0x80 >> (bs->bits % 8);
+		bs->bits++;
+	}
+}
+
+static void rockchip_vpu_h264_enc_put_ue(struct rockchip_vpu_h264_enc_bs *bs,
+					 u32 val)
+{
+	unsigned int len = fls(val + 1);
+
+	rockchip_vpu_h264_enc_put_bits(bs, 0, len - 1);
+	rockchip_vpu_h264_enc_put_bits(bs, val + 1, len);
+}
+
+static void rockchip_vpu_h264_enc_put_se(struct rockchip_vpu_h264_enc_bs *bs,
+					 s32 val)
+{
+	rockchip_vpu_h264_enc_put_ue(bs, val > 0 ? 2 * val - 1 : -2 * val);
+}
+
+/*
+ * Write the NAL unit of type with payload bs, start code included, and
+ * return its size. dst must have room for the emulation prevention
+ * bytes.
+ */
+static unsigned int
+rockchip_vpu_h264_enc_put_nal(u8 *dst, unsigned int type,
+			      struct rockchip_vpu_h264_enc_bs *bs)
+{
+	unsigned int i, len, n = 0, zeros = 0;
+
+	/* rbsp_trailing_bits() */
+	rockchip_vpu_h264_enc_put_bits(bs, 1, 1);
+	len = DIV_ROUND_UP(bs->bits, 8);
+
+	dst[n++] = 0;
+	dst[n++] = 0;
+	dst[n++] = 0;
+	dst[n++] = 1;
+	/* nal_ref_idc is 3, as for all the parameter sets. */
+	dst[n++] = (3 << 5) | type;
+	for (i = 0; i < len; i++) {
+		if (zeros == 2 && bs->buf[i] <= 3) {
+			dst[n++] = 3;
+			zeros = 0;
+		}
+		zeros = bs->buf[i] ? 0 : zeros + 1;
+		dst[n++] = bs->buf[i];
+	}
+	return n;
+}
+
+/* Lowest level allowing the frame size and rate of the context. */
+static u8 rockchip_vpu_h264_enc_level(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct v4l2_fract tpf;
+	unsigned long flags;
+	unsigned int i;
+	u64 mbps;
+	u32 mbs;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	tpf = ctx->timeperframe;
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+	/* Without a declared frame rate, assume 30 frames per second. */
+	if (!tpf.numerator) {
+		tpf.numerator = 1;
+		tpf.denominator = 30;
+	}
+
+	mbs = MB_WIDTH(ctx->src_fmt.width) * MB_HEIGHT(ctx->src_fmt.height);
+	mbps = div_u64((u64)mbs * tpf.denominator, tpf.numerator);
+	for (i = 0; i < ARRAY_SIZE(rockchip_vpu_h264_enc_levels) - 1; i++) {
+		if (mbs <= rockchip_vpu_h264_enc_levels[i].max_fs &&
+		    mbps <= rockchip_vpu_h264_enc_levels[i].max_mbps)
+			break;
+	}
+	return rockchip_vpu_h264_enc_levels[i].level_idc;
+}
+
+static unsigned int rockchip_vpu_h264_enc_put_sps(struct rockchip_vpu_ctx *ctx,
+						  u8 *dst)
+{
+	const struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	struct rockchip_vpu_h264_enc_bs bs = {};
+	unsigned int crop_right, crop_bottom;
+
+	/* Constrained baseline profile with CAVLC, main profile with CABAC. */
+	if (h264_enc->cabac) {
+		rockchip_vpu_h264_enc_put_bits(&bs, 77, 8);
+		rockchip_vpu_h264_enc_put_bits(&bs, 0x40, 8);
+	} else {
+		rockchip_vpu_h264_enc_put_bits(&bs, 66, 8);
+		rockchip_vpu_h264_enc_put_bits(&bs, 0xc0, 8);
+	}
+	rockchip_vpu_h264_enc_put_bits(&bs, rockchip_vpu_h264_enc_level(ctx), 8);
+	/* seq_parameter_set_id */
+	rockchip_vpu_h264_enc_put_ue(&bs, 0);
+	rockchip_vpu_h264_enc_put_ue(&bs, H264_LOG2_MAX_FRAME_NUM - 4);
+	/* pic_order_cnt_type 2: the POC follows frame_num. */
+	rockchip_vpu_h264_enc_put_ue(&bs, 2);
+	/* max_num_ref_frames */
+	rockchip_vpu_h264_enc_put_ue(&bs, 1);
+	/* gaps_in_frame_num_value_allowed_flag */
+	rockchip_vpu_h264_enc_put_bits(&bs, 0, 1);
+	rockchip_vpu_h264_enc_put_ue(&bs, MB_WIDTH(ctx->src_fmt.width) - 1);
+	rockchip_vpu_h264_enc_put_ue(&bs, MB_HEIGHT(ctx->src_fmt.height) - 1);
+	/* frame_mbs_only_flag, direct_8x8_inference_flag */
+	rockchip_vpu_h264_enc_put_bits(&bs, 1, 1);
+	rockchip_vpu_h264_enc_put_bits(&bs, 1, 1);
+	/*
+	 * frame_cropping_flag: crop what the hardware added to complete the
+	 * last macroblocks, in units of 2 pixels for 4:2:0 frames.
+	 */
+	crop_right = round_up(ctx->src_fmt.width, MB_DIM) - ctx->src_fmt.width;
+	crop_bottom = round_up(ctx->src_fmt.height, MB_DIM) -
+		      ctx->src_fmt.height;
+	rockchip_vpu_h264_enc_put_bits(&bs, crop_right || crop_bottom, 1);
+	if (crop_right || crop_bottom) {
+		rockchip_vpu_h264_enc_put_ue(&bs, 0);
+		rockchip_vpu_h264_enc_put_ue(&bs, crop_right / 2);
+		rockchip_vpu_h264_enc_put_ue(&bs, 0);
+		rockchip_vpu_h264_enc_put_ue(&bs, crop_bottom / 2);
+	}
+	/* vui_parameters_present_flag */
+	rockchip_vpu_h264_enc_put_bits(&bs, 0, 1);
+
+	return rockchip_vpu_h264_enc_put_nal(dst, H264_NAL_SPS, &bs);
+}
+
+static unsigned int rockchip_vpu_h264_enc_put_pps(struct rockchip_vpu_ctx *ctx,
+						  u8 *dst)
+{
+	const struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	struct rockchip_vpu_h264_enc_bs bs = {};
+
+	/* pic_parameter_set_id, seq_parameter_set_id */
+	rockchip_vpu_h264_enc_put_ue(&bs, 0);
+	rockchip_vpu_h264_enc_put_ue(&bs, 0);
+	rockchip_vpu_h264_enc_put_bits(&bs, h264_enc->cabac, 1);
+	/* bottom_field_pic_order_in_frame_present_flag */
+	rockchip_vpu_h264_enc_put_bits(&bs, 0, 1);
+	/* num_slice_groups_minus1 */
+	rockchip_vpu_h264_enc_put_ue(&bs, 0);
+	/* num_ref_idx_l0_default_active_minus1, and for l1 */
+	rockchip_vpu_h264_enc_put_ue(&bs, 0);
+	rockchip_vpu_h264_enc_put_ue(&bs, 0);
+	/* weighted_pred_flag, weighted_bipred_idc */
+	rockchip_vpu_h264_enc_put_bits(&bs, 0, 1);
+	rockchip_vpu_h264_enc_put_bits(&bs, 0, 2);
+	/* pic_init_qp_minus26, pic_init_qs_minus26, chroma_qp_index_offset */
+	rockchip_vpu_h264_enc_put_se(&bs, (s32)h264_enc->qp_i - 26);
+	rockchip_vpu_h264_enc_put_se(&bs, 0);
+	rockchip_vpu_h264_enc_put_se(&bs, 0);
+	/*
+	 * deblocking_filter_control_present_flag, constrained_intra_pred_flag
+	 * and redundant_pic_cnt_present_flag.
+	 */
+	rockchip_vpu_h264_enc_put_bits(&bs, 1, 1);
+	rockchip_vpu_h264_enc_put_bits(&bs, 0, 1);
+	rockchip_vpu_h264_enc_put_bits(&bs, 0, 1);
+
+	return rockchip_vpu_h264_enc_put_nal(dst, H264_NAL_PPS, &bs);
+}
+
+/*
+ * Fill the CABAC context states of every QP, for I slices then for P
+ * slices with cabac_init_idc 0, from the initialization pairs of the
+ * decoder table.
+ */
+static void rockchip_vpu_h264_enc_cabac_init(u8 *tbl)
+{
+	unsigned int qp, type, i, idx;
+	int m, n, state;
+	u16 pair;
+
+	for (qp = 0; qp < H264_NUM_QPS; qp++) {
+		for (type = 0; type < 2; type++) {
+			for (i = 0; i < H264_NUM_CABAC_CTXS; i++) {
+				idx = type * H264_NUM_CABAC_CTXS + i;
+				pair = rockchip_vpu_h264_cabac_table[idx / 2] >>
+				       (idx & 1 ? 0 : 16);
+				m = (s8)(pair >> 8);
+				n = (s8)pair;
+				state = clamp(((m * (int)qp) >> 4) + n, 1, 126);
+				if (state <= 63)
+					tbl[i] = (63 - state) << 1;
+				else
+					tbl[i] = ((state - 64) << 1) | 1;
+			}
+			tbl += H264_CABAC_TBL_CTXS;
+		}
+	}
+}
+
+/*
+ * Called from start_streaming, with the encoder lock held, which
+ * serializes the allocation of the CABAC table shared by the contexts.
+ */
+int rockchip_vpu_h264_enc_init(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	struct device *dev = ctx->dev->dev;
+	struct rockchip_vpu_aux_buf *aux;
+	unsigned int i;
+
+	aux = &ctx->dev->h264_enc_cabac;
+	if (!aux->cpu) {
+		/* Freed with the device. */
+		aux->size = ROCKCHIP_VPU_CABAC_TABLE_SIZE;
+		aux->cpu = dmam_alloc_coherent(dev, aux->size, &aux->dma,
+					       GFP_KERNEL);
+		if (!aux->cpu)
+			return -ENOMEM;
+		memset(aux->cpu, 0, aux->size);
+		rockchip_vpu_h264_enc_cabac_init(aux->cpu);
+	}
+
+	/* NV12, never accessed by the CPU. */
+	for (i = 0; i < ARRAY_SIZE(h264_enc->rec); i++) {
+		aux = &h264_enc->rec[i];
+		aux->size = rockchip_vpu_rounded_luma_size(ctx->src_fmt.width,
+							   ctx->src_fmt.height);
+		aux->size += aux->size / 2;
+		aux->cpu = dma_alloc_attrs(dev, aux->size, &aux->dma,
+					   GFP_KERNEL,
+					   DMA_ATTR_NO_KERNEL_MAPPING);
+		if (!aux->cpu)
+			goto err_free_rec;
+	}
+
+	h264_enc->ref = 0;
+	h264_enc->frame_num = 0;
+	h264_enc->idr_pic_id = 0;
+	h264_enc->force_idr = true;
+	return 0;
+
+err_free_rec:
+	while (i--) {
+		aux = &h264_enc->rec[i];
+		dma_free_attrs(dev, aux->size, aux->cpu, aux->dma,
+			       DMA_ATTR_NO_KERNEL_MAPPING);
+	}
+	return -ENOMEM;
+}
+
+void rockchip_vpu_h264_enc_exit(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	struct device *dev = ctx->dev->dev;
+	struct rockchip_vpu_aux_buf *aux;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(h264_enc->rec); i++) {
+		aux = &h264_enc->rec[i];
+		dma_free_attrs(dev, aux->size, aux->cpu, aux->dma,
+			       DMA_ATTR_NO_KERNEL_MAPPING);
+		aux->cpu = NULL;
+	}
+}
+
+/*
+ * Take the controls of the context and build its SPS and PPS. Called
+ * from rockchip_vpu_codec_ops.prepare, with the control lock held. When
+ * the parameter sets change, the next frame starts a new IDR period, so
+ * that the stream never refers to parameter sets it does not carry yet.
+ */
+void rockchip_vpu_h264_enc_prepare(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	u8 hdr[RK_VPU_H264_ENC_HDR_SIZE] = {};
+	unsigned int size;
+	s32 *val;
+
+	val = rockchip_vpu_find_control_data(ctx,
+			V4L2_CID_MPEG_VIDEO_H264_ENTROPY_MODE);
+	h264_enc->cabac = *val == V4L2_MPEG_VIDEO_H264_ENTROPY_MODE_CABAC;
+	val = rockchip_vpu_find_control_data(ctx, V4L2_CID_MPEG_VIDEO_GOP_SIZE);
+	h264_enc->gop_size = *val;
+	val = rockchip_vpu_find_control_data(ctx,
+			V4L2_CID_MPEG_VIDEO_H264_I_FRAME_QP);
+	h264_enc->qp_i = *val;
+	val = rockchip_vpu_find_control_data(ctx,
+			V4L2_CID_MPEG_VIDEO_H264_P_FRAME_QP);
+	h264_enc->qp_p = *val;
+
+	size = rockchip_vpu_h264_enc_put_sps(ctx, hdr);
+	size += rockchip_vpu_h264_enc_put_pps(ctx, hdr + size);
+	/* Zero bytes are allowed after a NAL unit of a byte stream. */
+	size = round_up(size, 8);
+
+	if (size != h264_enc->hdr_size || memcmp(hdr, h264_enc->hdr, size))
+		WRITE_ONCE(h264_enc->force_idr, true);
+	memcpy(h264_enc->hdr, hdr, size);
+	h264_enc->hdr_size = size;
+}
+
+/*
+ * Pick the type of the next frame. IDR frames get the SPS and PPS at the
+ * beginning of the capture buffer, the hardware writes the slice after
+ * them, from stream_offset, and restart frame_num from 0. A forced IDR
+ * is consumed here, so that a request made while an IDR frame is being
+ * encoded applies to the next frame.
+ */
+int rockchip_vpu_h264_enc_prepare_run(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	struct vb2_buffer *dst_buf;
+	void *vaddr;
+
+	h264_enc->idr = xchg(&h264_enc->force_idr, false) ||
+			h264_enc->frame_num >= h264_enc->gop_size;
+	h264_enc->stream_offset = 0;
+	if (!h264_enc->idr)
+		return 0;
+
+	h264_enc->frame_num = 0;
+
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+	vaddr = vb2_plane_vaddr(dst_buf, 0);
+	if (!vaddr || vb2_plane_size(dst_buf, 0) <= h264_enc->hdr_size) {
+		vpu_err("no room for the parameter sets\n");
+		return -EINVAL;
+	}
+
+	memcpy(vaddr, h264_enc->hdr, h264_enc->hdr_size);
+	h264_enc->stream_offset = h264_enc->hdr_size;
+	return 0;
+}
+
+/*
+ * The reconstructed frame becomes the reference of the next one. After
+ * a failure, it may be corrupted, so the next frame is an IDR frame.
+ */
+unsigned int rockchip_vpu_h264_enc_done(struct rockchip_vpu_ctx *ctx,
+					unsigned int bytesused,
+					enum vb2_buffer_state result)
+{
+	struct rockchip_vpu_h264_enc_hw_ctx *h264_enc = &ctx->h264_enc;
+	struct vb2_v4l2_buffer *dst;
+
+	if (result != VB2_BUF_STATE_DONE) {
+		WRITE_ONCE(h264_enc->force_idr, true);
+		return bytesused;
+	}
+
+	dst = to_vb2_v4l2_buffer(v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx));
+	dst->flags &= ~(V4L2_BUF_FLAG_KEYFRAME | V4L2_BUF_FLAG_PFRAME);
+	if (h264_enc->idr) {
+		dst->flags |= V4L2_BUF_FLAG_KEYFRAME;
+		h264_enc->idr_pic_id = (h264_enc->idr_pic_id + 1) & 0xf;
+	} else {
+		dst->flags |= V4L2_BUF_FLAG_PFRAME;
+	}
+	h264_enc->frame_num++;
+	h264_enc->ref ^= 1;
+
+	return h264_enc->stream_offset + bytesused;
+}
+
+/*
+ * Mode decision biases at qp: the estimated bits of each choice, scaled
+ * by the Lagrangian multiplier.
+ */
+void rockchip_vpu_h264_enc_penalties(unsigned int qp,
+			struct rockchip_vpu_h264_enc_penalties *penalties)
+{
+	u32 lambda = rockchip_vpu_h264_enc_lambda[min_t(unsigned int, qp,
+							    H264_NUM_QPS - 1)];
+
+	penalties->intra16_favor = H264_INTRA4X4_MODE_BITS * lambda;
+	penalties->prev_mode_favor = min_t(u32, H264_REM_MODE_BITS * lambda,
+					   255);
+	penalties->inter_favor = H264_INTRA_MB_BITS * lambda;
+	/* Skipping is cheap at low QPs only if the prediction is good. */
+	penalties->skip = min_t(u32, 256 / lambda, 255);
+	penalties->mv = H264_MVD_BITS * lambda;
+	penalties->split_16x8 = min_t(u32, H264_SPLIT_16X8_BITS * lambda,
+				      1023);
+	penalties->split_8x8 = min_t(u32, H264_SPLIT_8X8_BITS * lambda,
+				     1023);
+	penalties->split_4x4 = min_t(u32, H264_SPLIT_4X4_BITS * lambda, 511);
+}
+
+/* Bits of a motion vector difference component of magnitude mvd. */
+u32 rockchip_vpu_h264_enc_mvd_bits(unsigned int mvd)
+{
+	/* Signed Exp-Golomb code. */
+	return mvd ? 2 * fls(2 * mvd) - 1 : 1;
+}
@@ -11,6 +11,8 @@
 
 #include <linux/interrupt.h>
 #include <linux/v4l2-controls.h>
+#include <media/h264-ctrls.h>
+#include <media/vp8-ctrls.h>
 #include <media/videobuf2-core.h>
 
 #define ROCKCHIP_HEADER_SIZE		1280
@@ -19,25 +21,354 @@
 #define ROCKCHIP_JPEG_QUANT_ELE_SIZE	64
 
 #define ROCKCHIP_VPU_CABAC_TABLE_SIZE	(52 * 2 * 464)
+/* VP8 probability table, 8 byte rows as filled by rockchip_vpu_vp8.c. */
+#define ROCKCHIP_VPU_VP8_PROB_TBL_SIZE	((55 + 96) * 8)
 
 struct rockchip_vpu_dev;
 struct rockchip_vpu_ctx;
+struct rockchip_vpu_watchdog;
 struct rockchip_vpu_buf;
 struct rockchip_vpu_variant;
 
+/**
+ * struct rockchip_vpu_aux_buf - auxiliary DMA buffer for hardware data
+ * @cpu:        CPU pointer to the buffer.
+ * @dma:        DMA address of the buffer.
+ * @size:       Size of the buffer.
+ */
+struct rockchip_vpu_aux_buf {
+	void *cpu;
+	dma_addr_t dma;
+	size_t size;
+};
+
+/* Max. number of DPB pictures supported by hardware. */
+#define RK_VPU_H264_DPB_SIZE		16
+
+/**
+ * struct rockchip_vpu_h264_dec_ctrls - H.264 decoder controls of a job
+ * @decode:	Decode parameters, with the DPB.
+ * @scaling:	Scaling matrices.
+ * @slices:	Slice parameters. Only the first slice is used, the
+ *		hardware parses the others from the bitstream.
+ * @sps:	Sequence parameter set.
+ * @pps:	Picture parameter set.
+ */
+struct rockchip_vpu_h264_dec_ctrls {
+	const struct v4l2_ctrl_h264_decode_params *decode;
+	const struct v4l2_ctrl_h264_scaling_matrix *scaling;
+	const struct v4l2_ctrl_h264_slice_params *slices;
+	const struct v4l2_ctrl_h264_sps *sps;
+	const struct v4l2_ctrl_h264_pps *pps;
+};
+
+/**
+ * struct rockchip_vpu_h264_dec_reflists - initial H.264 reference lists
+ * @p:		P reference list, as DPB indices.
+ * @b0:		B reference list 0, as DPB indices.
+ * @b1:		B reference list 1, as DPB indices.
+ */
+struct rockchip_vpu_h264_dec_reflists {
+	u8 p[RK_VPU_H264_DPB_SIZE];
+	u8 b0[RK_VPU_H264_DPB_SIZE];
+	u8 b1[RK_VPU_H264_DPB_SIZE];
+};
+
+/**
+ * struct rockchip_vpu_h264_dec_hw_ctx - H.264 decoder state of a context
+ * @dpb:	DPB as programmed in the hardware. Entries keep their slot
+ *		from one frame to the next, unlike the DPB given by
+ *		userspace.
+ * @reflists:	Initial reference lists of the running job.
+ * @ctrls:	Controls of the running job.
+ */
+struct rockchip_vpu_h264_dec_hw_ctx {
+	struct v4l2_h264_dpb_entry dpb[RK_VPU_H264_DPB_SIZE];
+	struct rockchip_vpu_h264_dec_reflists reflists;
+	struct rockchip_vpu_h264_dec_ctrls ctrls;
+};
+
+/**
+ * struct rockchip_vpu_vp8_dec_hw_ctx - VP8 decoder state of a context
+ * @segment_map:	Segment map, kept by the hardware from one frame to
+ *			the next.
+ * @prob_tbl:		Probability tables of the running job.
+ */
+struct rockchip_vpu_vp8_dec_hw_ctx {
+	struct rockchip_vpu_aux_buf segment_map;
+	struct rockchip_vpu_aux_buf prob_tbl;
+};
+
+/* Room for the SPS and PPS written before the IDR frames. */
+#define RK_VPU_H264_ENC_HDR_SIZE	64
+
+/**
+ * struct rockchip_vpu_h264_enc_hw_ctx - H.264 encoder state of a context
+ * @rec:		Reconstructed frames. One holds the reference of
+ *			the running job, the hardware writes the other one.
+ * @hdr:		SPS and PPS, padded with zero bytes to a multiple of
+ *			8 bytes, since the hardware writes the slices from an
+ *			aligned address.
+ * @hdr_size:		Size of @hdr.
+ * @gop_size:		Distance between IDR frames.
+ * @qp_i:		QP of the IDR frames, also the initial QP of the PPS.
+ * @qp_p:		QP of the P frames.
+ * @cabac:		CABAC entropy coding, instead of CAVLC.
+ * @ref:		Index in @rec of the reference frame.
+ * @frame_num:		frame_num of the next frame.
+ * @idr_pic_id:		idr_pic_id of the next IDR frame.
+ * @idr:		The running job encodes an IDR frame.
+ * @stream_offset:	Offset of the slices of the running job in the
+ *			capture buffer, after @hdr for IDR frames.
+ * @force_idr:		The next frame must be an IDR frame.
+ */
+struct rockchip_vpu_h264_enc_hw_ctx {
+	struct rockchip_vpu_aux_buf rec[2];
+	u8 hdr[RK_VPU_H264_ENC_HDR_SIZE];
+	unsigned int hdr_size;
+	u32 gop_size;
+	u32 qp_i;
+	u32 qp_p;
+	bool cabac;
+	unsigned int ref;
+	u32 frame_num;
+	u32 idr_pic_id;
+	bool idr;
+	unsigned int stream_offset;
+	bool force_idr;
+};
+
+/* Partitions of DCT coefficients the encoder can split a frame in. */
+#define RK_VPU_VP8_ENC_MAX_PARTS	2
+
+/**
+ * struct rockchip_vpu_vp8_enc_hw_ctx - VP8 encoder state of a context
+ * @prob_tbl:		Probabilities of the running job, read by the
+ *			hardware.
+ * @prob_cnt:		Branch counts of the coefficient tokens of the last
+ *			frame, written by the hardware.
+ * @ctrl_buf:		Sizes of the partitions of the last frame, written
+ *			by the hardware.
+ * @rec:		Reconstructed frames. One holds the reference of
+ *			the running job, the hardware writes the other one.
+ * @hdr:		Frame header of the running job. Its entropy header
+ *			carries the probabilities from one frame to the next.
+ * @gop_size:		Distance between key frames.
+ * @qi_i:		Quantizer index of the key frames.
+ * @qi_p:		Quantizer index of the inter frames.
+ * @num_parts:		Number of DCT partitions.
+ * @ref:		Index in @rec of the reference frame.
+ * @frame_num:		Frames since the last key frame.
+ * @key:		The running job encodes a key frame.
+ * @counts_valid:	@prob_cnt holds the counts of the previous frame.
+ * @hdr_size:		Size of the uncompressed chunk of the running job,
+ *			before the first partition.
+ * @base:		Offset in the capture buffer from which the hardware
+ *			writes the first partition.
+ * @bool_value:		Bool encoder state after the part of the first
+ *			partition written by the driver: bottom of the
+ *			interval, bits pending in it and range.
+ * @bool_bits:		See @bool_value.
+ * @bool_range:		See @bool_value.
+ * @rem:		Bytes of the first partition after @base, written by
+ *			the hardware from its registers.
+ * @rem_size:		Number of bytes in @rem.
+ * @part_offset:	Offsets of the DCT partitions in the capture buffer.
+ * @part_limit:		Room for each DCT partition.
+ * @force_key:		The next frame must be a key frame.
+ */
+struct rockchip_vpu_vp8_enc_hw_ctx {
+	struct rockchip_vpu_aux_buf prob_tbl;
+	struct rockchip_vpu_aux_buf prob_cnt;
+	struct rockchip_vpu_aux_buf ctrl_buf;
+	struct rockchip_vpu_aux_buf rec[2];
+	struct v4l2_ctrl_vp8_frame_header hdr;
+	u32 gop_size;
+	u32 qi_i;
+	u32 qi_p;
+	unsigned int num_parts;
+	unsigned int ref;
+	u32 frame_num;
+	bool key;
+	bool counts_valid;
+	unsigned int hdr_size;
+	unsigned int base;
+	u32 bool_value;
+	u32 bool_bits;
+	u32 bool_range;
+	u8 rem[8];
+	unsigned int rem_size;
+	unsigned int part_offset[RK_VPU_VP8_ENC_MAX_PARTS];
+	unsigned int part_limit;
+	bool force_key;
+};
+
+/**
+ * enum rockchip_vpu_vp8_enc_coeff - VP8 coefficient types
+ * @RK_VPU_VP8_Y1_DC:	DC of the luma blocks without a Y2 block.
+ * @RK_VPU_VP8_Y1_AC:	AC of the luma blocks.
+ * @RK_VPU_VP8_Y2_DC:	DC of the Y2 block.
+ * @RK_VPU_VP8_Y2_AC:	AC of the Y2 block.
+ * @RK_VPU_VP8_UV_DC:	DC of the chroma blocks.
+ * @RK_VPU_VP8_UV_AC:	AC of the chroma blocks.
+ * @RK_VPU_VP8_NUM_COEFFS: Number of coefficient types.
+ */
+enum rockchip_vpu_vp8_enc_coeff {
+	RK_VPU_VP8_Y1_DC,
+	RK_VPU_VP8_Y1_AC,
+	RK_VPU_VP8_Y2_DC,
+	RK_VPU_VP8_Y2_AC,
+	RK_VPU_VP8_UV_DC,
+	RK_VPU_VP8_UV_AC,
+	RK_VPU_VP8_NUM_COEFFS
+};
+
+/**
+ * struct rockchip_vpu_vp8_enc_quant - VP8 quantization of a frame
+ * @dequant:		Dequantization factor of each coefficient type.
+ * @quant:		Its reciprocal, in 1/65536.
+ * @zbin:		Dead zone, in coefficient units.
+ * @round:		Rounding, in coefficient units.
+ * @lambda:		Lagrangian multiplier of the mode decisions.
+ * @filter_level:	Loop filter level.
+ */
+struct rockchip_vpu_vp8_enc_quant {
+	u32 dequant[RK_VPU_VP8_NUM_COEFFS];
+	u32 quant[RK_VPU_VP8_NUM_COEFFS];
+	u32 zbin[RK_VPU_VP8_NUM_COEFFS];
+	u32 round[RK_VPU_VP8_NUM_COEFFS];
+	u32 lambda;
+	u32 filter_level;
+};
+
+/* Huffman tables of each class the decoder can use at once. */
+#define RK_VPU_JPEG_DEC_NUM_HUFF	2
+#define RK_VPU_JPEG_DEC_NUM_QTBL	4
+#define RK_VPU_JPEG_DEC_NUM_COMPS	3
+#define RK_VPU_JPEG_DC_VALS		12
+#define RK_VPU_JPEG_AC_VALS		162
+
+/**
+ * struct rockchip_vpu_jpeg_huff - Huffman table of a JPEG image
+ * @bits:		Number of codes of each length, from 1 to 16 bits.
+ * @vals:		Symbols, by increasing code length.
+ * @valid:		The table was defined by the image.
+ */
+struct rockchip_vpu_jpeg_huff {
+	u8 bits[16];
+	u8 vals[RK_VPU_JPEG_AC_VALS];
+	bool valid;
+};
+
+/**
+ * struct rockchip_vpu_jpeg_dec_hdr - headers of a baseline JPEG image
+ * @width:		Width of the image, in pixels.
+ * @height:		Height of the image, in pixels.
+ * @h_samp:		Horizontal sampling factor of the luma.
+ * @v_samp:		Vertical sampling factor of the luma.
+ * @restart_interval:	MCUs between two restart markers, 0 if none.
+ * @qtbl_sel:		Quantization table of each component.
+ * @dc_sel:		DC Huffman table of each component.
+ * @ac_sel:		AC Huffman table of each component.
+ * @scan_offset:	Offset of the entropy-coded data in the image.
+ * @qtbl:		Quantization tables, in zigzag order.
+ * @qtbl_valid:		Bitmask of the quantization tables defined.
+ * @dc:			DC Huffman tables.
+ * @ac:			AC Huffman tables.
+ */
+struct rockchip_vpu_jpeg_dec_hdr {
+	u16 width;
+	u16 height;
+	u8 h_samp;
+	u8 v_samp;
+	u16 restart_interval;
+	u8 qtbl_sel[RK_VPU_JPEG_DEC_NUM_COMPS];
+	u8 dc_sel[RK_VPU_JPEG_DEC_NUM_COMPS];
+	u8 ac_sel[RK_VPU_JPEG_DEC_NUM_COMPS];
+	unsigned int scan_offset;
+	u8 qtbl[RK_VPU_JPEG_DEC_NUM_QTBL][64];
+	u8 qtbl_valid;
+	struct rockchip_vpu_jpeg_huff dc[RK_VPU_JPEG_DEC_NUM_HUFF];
+	struct rockchip_vpu_jpeg_huff ac[RK_VPU_JPEG_DEC_NUM_HUFF];
+};
+
+/**
+ * struct rockchip_vpu_jpeg_dec_hw_ctx - JPEG decoder state of a context
+ * @tbl:		Quantization tables of the components, then the
+ *			symbols of the AC and DC Huffman tables, read by the
+ *			hardware.
+ * @hdr:		Headers of the running job, parsed from the source
+ *			buffer.
+ */
+struct rockchip_vpu_jpeg_dec_hw_ctx {
+	struct rockchip_vpu_aux_buf tbl;
+	struct rockchip_vpu_jpeg_dec_hdr hdr;
+};
+
+/**
+ * struct rockchip_vpu_h264_enc_penalties - H.264 mode decision biases
+ * @intra16_favor:	Favor of 16x16 over 4x4 intra prediction.
+ * @prev_mode_favor:	Favor of the predicted 4x4 intra prediction mode.
+ * @inter_favor:	Favor of inter over intra prediction.
+ * @skip:		Skipped macroblock penalty.
+ * @mv:			Motion vector penalty.
+ * @split_16x8:		Penalty of 16x8 and 8x16 partitions.
+ * @split_8x8:		Penalty of 8x8 partitions.
+ * @split_4x4:		Penalty of 8x4, 4x8 and 4x4 partitions.
+ *
+ * All are in SAD units, and clamped to the smallest register field
+ * holding them on either variant.
+ */
+struct rockchip_vpu_h264_enc_penalties {
+	u32 intra16_favor;
+	u32 prev_mode_favor;
+	u32 inter_favor;
+	u32 skip;
+	u32 mv;
+	u32 split_16x8;
+	u32 split_8x8;
+	u32 split_4x4;
+};
+
 /**
  * struct rockchip_vpu_codec_ops - codec mode specific operations
  *
- * @run:	Start single {en,de)coding job. Called from atomic context
- *		to indicate that a pair of buffers is ready and the hardware
- *		should be programmed and started.
- * @done:	Read back processing results and additional data from hardware.
+ * @init:	Optional. Allocate the codec state of a context, when
+ *		streaming starts on its bitstream queue.
+ * @exit:	Optional. Free what @init allocated, when streaming stops
+ *		on the bitstream queue.
+ * @run:	Start single {en,de}coding job. Called when a pair of
+ *		buffers is ready and the hardware should be programmed and
+ *		started, from device_run() or, for batched jobs, from the
+ *		IRQ thread. Both run in process context, and @run may sleep:
+ *		it takes the control handler lock to refresh the register
+ *		image, and parses headers. Never call it with a spinlock
+ *		held.
+ * @done:	Optional. Called once the hardware finished a job, or when
+ *		it timed out, before its buffers are returned. Returns the
+ *		payload of the capture buffer, from the one read back by the
+ *		interrupt handler.
  * @reset:	Reset the hardware in case of a timeout.
+ * @prepare:	Optional. Build the register image of the context
+ *		(rockchip_vpu_ctx.regs) from its formats and controls.
+ *		Called from process context, outside of the job path.
+ * @prepare_buf: Optional. Build the register image of a buffer
+ *		(rockchip_vpu_buf.regs), from buf_prepare.
+ * @progress:	Optional. Return a counter which changes while the hardware
+ *		makes progress on the running job, such as the number of
+ *		macroblocks processed. Called from atomic context.
  */
 struct rockchip_vpu_codec_ops {
+	int (*init)(struct rockchip_vpu_ctx *ctx);
+	void (*exit)(struct rockchip_vpu_ctx *ctx);
 	void (*run)(struct rockchip_vpu_ctx *ctx);
-	void (*done)(struct rockchip_vpu_ctx *ctx, enum vb2_buffer_state);
+	unsigned int (*done)(struct rockchip_vpu_ctx *ctx,
+			     unsigned int bytesused,
+			     enum vb2_buffer_state result);
 	void (*reset)(struct rockchip_vpu_ctx *ctx);
+	void (*prepare)(struct rockchip_vpu_ctx *ctx);
+	void (*prepare_buf)(struct rockchip_vpu_ctx *ctx, struct vb2_buffer *vb);
+	u32 (*progress)(struct rockchip_vpu_ctx *ctx);
 };
 
 /**
@@ -53,19 +384,89 @@ enum rockchip_vpu_enc_fmt {
 extern const struct rockchip_vpu_variant rk3399_vpu_variant;
 extern const struct rockchip_vpu_variant rk3288_vpu_variant;
 
-void rockchip_vpu_watchdog(struct work_struct *work);
+void rockchip_vpu_enc_watchdog(struct work_struct *work);
+void rockchip_vpu_dec_watchdog(struct work_struct *work);
+void rockchip_vpu_watchdog_init(struct rockchip_vpu_watchdog *wd,
+				work_func_t recover);
+void rockchip_vpu_watchdog_arm(struct rockchip_vpu_watchdog *wd,
+			       struct rockchip_vpu_ctx *ctx,
+			       unsigned int mbs);
+bool rockchip_vpu_watchdog_disarm(struct rockchip_vpu_watchdog *wd,
+				  bool done);
+void rockchip_vpu_watchdog_sync(struct rockchip_vpu_watchdog *wd);
+void rockchip_vpu_watchdog_fail(struct rockchip_vpu_watchdog *wd,
+				struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_watchdog_stop(struct rockchip_vpu_watchdog *wd);
 void rockchip_vpu_run(struct rockchip_vpu_ctx *ctx);
-void rockchip_vpu_irq_done(struct rockchip_vpu_dev *vpu,
-			   unsigned int bytesused,
-			   enum vb2_buffer_state result);
+void rockchip_vpu_run_done(struct rockchip_vpu_ctx *ctx);
+irqreturn_t rockchip_vpu_enc_irq_done(struct rockchip_vpu_dev *vpu,
+				      unsigned int bytesused,
+				      enum vb2_buffer_state result);
+irqreturn_t rockchip_vpu_dec_irq_done(struct rockchip_vpu_dev *vpu,
+				      unsigned int bytesused,
+				      enum vb2_buffer_state result);
+irqreturn_t rockchip_vpu_enc_irq_thread(int irq, void *dev_id);
+irqreturn_t rockchip_vpu_dec_irq_thread(int irq, void *dev_id);
+void rockchip_vpu_enc_src_addrs(struct rockchip_vpu_ctx *ctx,
+				struct vb2_buffer *vb, dma_addr_t *addrs);
+unsigned int rockchip_vpu_enc_row_len(const struct rockchip_vpu_ctx *ctx);
+unsigned int
+rockchip_vpu_enc_overfill_right(const struct rockchip_vpu_ctx *ctx);
+unsigned int
+rockchip_vpu_enc_overfill_bottom(const struct rockchip_vpu_ctx *ctx);
 
 void rk3288_vpu_jpeg_enc_run(struct rockchip_vpu_ctx *ctx);
+void rk3288_vpu_jpeg_enc_prepare(struct rockchip_vpu_ctx *ctx);
 void rk3399_vpu_jpeg_enc_run(struct rockchip_vpu_ctx *ctx);
+void rk3399_vpu_jpeg_enc_prepare(struct rockchip_vpu_ctx *ctx);
 
+extern const u32 rockchip_vpu_h264_cabac_table[];
+int rockchip_vpu_h264_dec_init(struct rockchip_vpu_ctx *ctx);
+int rockchip_vpu_h264_dec_prepare_run(struct rockchip_vpu_ctx *ctx);
+dma_addr_t rockchip_vpu_h264_get_ref_buf(struct rockchip_vpu_ctx *ctx,
+					 unsigned int dpb_idx);
 void rk3288_vpu_h264_dec_run(struct rockchip_vpu_ctx *ctx);
 void rk3399_vpu_h264_dec_run(struct rockchip_vpu_ctx *ctx);
 
+int rockchip_vpu_h264_enc_init(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_h264_enc_exit(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_h264_enc_prepare(struct rockchip_vpu_ctx *ctx);
+int rockchip_vpu_h264_enc_prepare_run(struct rockchip_vpu_ctx *ctx);
+unsigned int rockchip_vpu_h264_enc_done(struct rockchip_vpu_ctx *ctx,
+					unsigned int bytesused,
+					enum vb2_buffer_state result);
+void rockchip_vpu_h264_enc_penalties(unsigned int qp,
+			struct rockchip_vpu_h264_enc_penalties *penalties);
+u32 rockchip_vpu_h264_enc_mvd_bits(unsigned int mvd);
+void rk3288_vpu_h264_enc_run(struct rockchip_vpu_ctx *ctx);
+void rk3288_vpu_h264_enc_prepare(struct rockchip_vpu_ctx *ctx);
+void rk3399_vpu_h264_enc_run(struct rockchip_vpu_ctx *ctx);
+void rk3399_vpu_h264_enc_prepare(struct rockchip_vpu_ctx *ctx);
+
+extern const s32 rockchip_vpu_vp8_dec_mc_filter[8][6];
+int rockchip_vpu_vp8_dec_init(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_vp8_dec_exit(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_vp8_prob_update(u8 *tbl,
+				  const struct v4l2_ctrl_vp8_frame_header *hdr);
+dma_addr_t rockchip_vpu_vp8_get_ref(struct rockchip_vpu_ctx *ctx, u64 ts);
 void rk3288_vpu_vp8_dec_run(struct rockchip_vpu_ctx *ctx);
 void rk3399_vpu_vp8_dec_run(struct rockchip_vpu_ctx *ctx);
 
+int rockchip_vpu_vp8_enc_init(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_vp8_enc_exit(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_vp8_enc_prepare(struct rockchip_vpu_ctx *ctx);
+int rockchip_vpu_vp8_enc_prepare_run(struct rockchip_vpu_ctx *ctx);
+unsigned int rockchip_vpu_vp8_enc_done(struct rockchip_vpu_ctx *ctx,
+				       unsigned int bytesused,
+				       enum vb2_buffer_state result);
+void rockchip_vpu_vp8_enc_quant(unsigned int qi,
+				struct rockchip_vpu_vp8_enc_quant *quant);
+void rk3399_vpu_vp8_enc_run(struct rockchip_vpu_ctx *ctx);
+void rk3399_vpu_vp8_enc_prepare(struct rockchip_vpu_ctx *ctx);
+
+int rockchip_vpu_jpeg_dec_init(struct rockchip_vpu_ctx *ctx);
+void rockchip_vpu_jpeg_dec_exit(struct rockchip_vpu_ctx *ctx);
+int rockchip_vpu_jpeg_dec_prepare_run(struct rockchip_vpu_ctx *ctx);
+void rk3288_vpu_jpeg_dec_run(struct rockchip_vpu_ctx *ctx);
+
 #endif /* ROCKCHIP_VPU_HW_H_ */
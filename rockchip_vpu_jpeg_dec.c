@@ -0,0 +1,456 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * Baseline JPEG decoding helpers shared by the variants.
+ *
+ * Unlike the other decoders, the JPEG decoder does not use requests:
+ * the headers of an image are short and self-contained, so the driver
+ * parses them from the source buffer before every job. The hardware
+ * reads the quantization tables and the Huffman symbols from a table
+ * in memory, and the number of Huffman codes of each length from its
+ * registers.
+ */
+
+#include <linux/dma-mapping.h>
+#include <asm/unaligned.h>
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-v4l2.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_hw.h"
+
+#define JPEG_MARKER_SOF0	0xc0
+#define JPEG_MARKER_DHT		0xc4
+#define JPEG_MARKER_SOI		0xd8
+#define JPEG_MARKER_SOS		0xda
+#define JPEG_MARKER_DQT		0xdb
+#define JPEG_MARKER_DRI		0xdd
+
+/* Start of frame markers of the processes other than baseline. */
+#define JPEG_MARKER_IS_SOF(m) \
+	((m) >= 0xc0 && (m) <= 0xcf && (m) != JPEG_MARKER_DHT && \
+	 (m) != 0xc8 && (m) != 0xcc)
+
+/* Markers without a length: TEM, RSTn, SOI and EOI. */
+#define JPEG_MARKER_IS_STANDALONE(m) \
+	((m) == 0x01 || ((m) >= 0xd0 && (m) <= 0xd9))
+
+/*
+ * Table read by the hardware: the quantization table of each component,
+ * then the symbols of the two AC Huffman tables and of the two DC ones,
+ * zero padded to their maximum size.
+ */
+#define JPEG_TBL_AC_OFFSET	(RK_VPU_JPEG_DEC_NUM_COMPS * 64)
+#define JPEG_TBL_DC_OFFSET	(JPEG_TBL_AC_OFFSET + \
+				 RK_VPU_JPEG_DEC_NUM_HUFF * RK_VPU_JPEG_AC_VALS)
+#define JPEG_TBL_END		(JPEG_TBL_DC_OFFSET + \
+				 RK_VPU_JPEG_DEC_NUM_HUFF * RK_VPU_JPEG_DC_VALS)
+#define JPEG_TBL_SIZE		round_up(JPEG_TBL_END, 8)
+
+/*
+ * Huffman tables of ITU-T T.81 annex K.3, used by the images leaving
+ * them out, such as the frames of Motion JPEG streams.
+ */
+static const u8 jpeg_dc_bits[RK_VPU_JPEG_DEC_NUM_HUFF][16] = {
+	{ 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+	{ 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+};
+
+static const u8 jpeg_dc_vals[RK_VPU_JPEG_DC_VALS] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+};
+
+static const u8 jpeg_ac_bits[RK_VPU_JPEG_DEC_NUM_HUFF][16] = {
+	{ 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+	{ 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+};
+
+static const u8 jpeg_ac_vals[RK_VPU_JPEG_DEC_NUM_HUFF][RK_VPU_JPEG_AC_VALS] = {
+	{
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+		0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+		0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+		0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+		0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+		0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+		0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+		0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+		0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+		0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+		0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+		0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+		0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+		0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+		0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+		0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+		0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+		0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+		0xf9, 0xfa,
+	},
+	{
+		0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+		0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+		0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+		0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+		0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+		0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+		0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+		0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+		0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+		0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+		0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+		0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+		0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+		0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+		0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+		0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+		0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+		0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+		0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+		0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+		0xf9, 0xfa,
+	},
+};
+
+/* Component identifiers of the frame header, matched by the scan. */
+struct rockchip_vpu_jpeg_parser {
+	struct rockchip_vpu_jpeg_dec_hdr *hdr;
+	u8 comp_id[RK_VPU_JPEG_DEC_NUM_COMPS];
+	bool sof;
+};
+
+/*
+ * Only 4:2:0 and 4:2:2 images with 8-bit samples, whose chroma
+ * components are subsampled, are supported.
+ */
+static int rockchip_vpu_jpeg_parse_sof(struct rockchip_vpu_jpeg_parser *p,
+				       const u8 *seg, unsigned int len)
+{
+	struct rockchip_vpu_jpeg_dec_hdr *hdr = p->hdr;
+	unsigned int i;
+	u8 h, v;
+
+	if (len < 6 + 3 * RK_VPU_JPEG_DEC_NUM_COMPS || seg[0] != 8 ||
+	    seg[5] != RK_VPU_JPEG_DEC_NUM_COMPS)
+		return -EINVAL;
+
+	hdr->height = get_unaligned_be16(&seg[1]);
+	hdr->width = get_unaligned_be16(&seg[3]);
+	if (!hdr->width || !hdr->height)
+		return -EINVAL;
+
+	for (i = 0; i < RK_VPU_JPEG_DEC_NUM_COMPS; i++) {
+		p->comp_id[i] = seg[6 + 3 * i];
+		h = seg[7 + 3 * i] >> 4;
+		v = seg[7 + 3 * i] & 0xf;
+		hdr->qtbl_sel[i] = seg[8 + 3 * i];
+		if (hdr->qtbl_sel[i] >= RK_VPU_JPEG_DEC_NUM_QTBL)
+			return -EINVAL;
+
+		if (i == 0) {
+			hdr->h_samp = h;
+			hdr->v_samp = v;
+		} else if (h != 1 || v != 1) {
+			return -EINVAL;
+		}
+	}
+
+	if (hdr->h_samp != 2 || (hdr->v_samp != 1 && hdr->v_samp != 2))
+		return -EINVAL;
+
+	p->sof = true;
+	return 0;
+}
+
+static int rockchip_vpu_jpeg_parse_dht(struct rockchip_vpu_jpeg_parser *p,
+				       const u8 *seg, unsigned int len)
+{
+	struct rockchip_vpu_jpeg_huff *huff;
+	unsigned int i, count, max;
+	u8 tc, th;
+
+	while (len) {
+		if (len < 17)
+			return -EINVAL;
+
+		tc = seg[0] >> 4;
+		th = seg[0] & 0xf;
+		if (tc > 1 || th >= RK_VPU_JPEG_DEC_NUM_HUFF)
+			return -EINVAL;
+
+		count = 0;
+		for (i = 0; i < 16; i++)
+			count += seg[1 + i];
+		max = tc ? RK_VPU_JPEG_AC_VALS : RK_VPU_JPEG_DC_VALS;
+		if (count > max || len < 17 + count)
+			return -EINVAL;
+
+		huff = tc ? &p->hdr->ac[th] : &p->hdr->dc[th];
+		memcpy(huff->bits, &seg[1], 16);
+		memset(huff->vals, 0, sizeof(huff->vals));
+		memcpy(huff->vals, &seg[17], count);
+		huff->valid = true;
+
+		seg += 17 + count;
+		len -= 17 + count;
+	}
+	return 0;
+}
+
+/* Baseline images only have 8-bit quantization tables. */
+static int rockchip_vpu_jpeg_parse_dqt(struct rockchip_vpu_jpeg_parser *p,
+				       const u8 *seg, unsigned int len)
+{
+	struct rockchip_vpu_jpeg_dec_hdr *hdr = p->hdr;
+	u8 pq, tq;
+
+	while (len) {
+		if (len < 65)
+			return -EINVAL;
+
+		pq = seg[0] >> 4;
+		tq = seg[0] & 0xf;
+		if (pq || tq >= RK_VPU_JPEG_DEC_NUM_QTBL)
+			return -EINVAL;
+
+		memcpy(hdr->qtbl[tq], &seg[1], 64);
+		hdr->qtbl_valid |= BIT(tq);
+
+		seg += 65;
+		len -= 65;
+	}
+	return 0;
+}
+
+/* The hardware only decodes a single scan, holding every component. */
+static int rockchip_vpu_jpeg_parse_sos(struct rockchip_vpu_jpeg_parser *p,
+				       const u8 *seg, unsigned int len)
+{
+	struct rockchip_vpu_jpeg_dec_hdr *hdr = p->hdr;
+	unsigned int i, j;
+	const u8 *spec;
+
+	if (!p->sof || len < 1 + 2 * RK_VPU_JPEG_DEC_NUM_COMPS + 3 ||
+	    seg[0] != RK_VPU_JPEG_DEC_NUM_COMPS)
+		return -EINVAL;
+
+	for (i = 0; i < RK_VPU_JPEG_DEC_NUM_COMPS; i++) {
+		for (j = 0; j < RK_VPU_JPEG_DEC_NUM_COMPS; j++)
+			if (p->comp_id[j] == seg[1 + 2 * i])
+				break;
+		if (j == RK_VPU_JPEG_DEC_NUM_COMPS)
+			return -EINVAL;
+
+		hdr->dc_sel[j] = seg[2 + 2 * i] >> 4;
+		hdr->ac_sel[j] = seg[2 + 2 * i] & 0xf;
+		if (hdr->dc_sel[j] >= RK_VPU_JPEG_DEC_NUM_HUFF ||
+		    hdr->ac_sel[j] >= RK_VPU_JPEG_DEC_NUM_HUFF)
+			return -EINVAL;
+	}
+
+	/* Spectral selection and successive approximation. */
+	spec = &seg[1 + 2 * RK_VPU_JPEG_DEC_NUM_COMPS];
+	if (spec[0] != 0 || spec[1] != 63 || spec[2] != 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void rockchip_vpu_jpeg_default_huff(struct rockchip_vpu_jpeg_huff *huff,
+					   const u8 *bits, const u8 *vals,
+					   unsigned int count)
+{
+	memcpy(huff->bits, bits, 16);
+	memset(huff->vals, 0, sizeof(huff->vals));
+	memcpy(huff->vals, vals, count);
+	huff->valid = true;
+}
+
+/*
+ * Fill in the Huffman tables the image leaves out, and check that the
+ * quantization tables were given. The hardware decodes the luma with
+ * its first table of each class, so the tables are swapped if the luma
+ * uses the second one.
+ */
+static int rockchip_vpu_jpeg_finish(struct rockchip_vpu_jpeg_dec_hdr *hdr)
+{
+	unsigned int i;
+
+	for (i = 0; i < RK_VPU_JPEG_DEC_NUM_COMPS; i++)
+		if (!(hdr->qtbl_valid & BIT(hdr->qtbl_sel[i])))
+			return -EINVAL;
+
+	for (i = 0; i < RK_VPU_JPEG_DEC_NUM_HUFF; i++) {
+		if (!hdr->dc[i].valid)
+			rockchip_vpu_jpeg_default_huff(&hdr->dc[i],
+						       jpeg_dc_bits[i],
+						       jpeg_dc_vals,
+						       RK_VPU_JPEG_DC_VALS);
+		if (!hdr->ac[i].valid)
+			rockchip_vpu_jpeg_default_huff(&hdr->ac[i],
+						       jpeg_ac_bits[i],
+						       jpeg_ac_vals[i],
+						       RK_VPU_JPEG_AC_VALS);
+	}
+
+	if (hdr->dc_sel[0]) {
+		swap(hdr->dc[0], hdr->dc[1]);
+		for (i = 0; i < RK_VPU_JPEG_DEC_NUM_COMPS; i++)
+			hdr->dc_sel[i] ^= 1;
+	}
+	if (hdr->ac_sel[0]) {
+		swap(hdr->ac[0], hdr->ac[1]);
+		for (i = 0; i < RK_VPU_JPEG_DEC_NUM_COMPS; i++)
+			hdr->ac_sel[i] ^= 1;
+	}
+	return 0;
+}
+
+/* Parse the markers of the image, up to the start of its scan. */
+static int rockchip_vpu_jpeg_parse(struct rockchip_vpu_jpeg_dec_hdr *hdr,
+				   const u8 *data, unsigned int size)
+{
+	struct rockchip_vpu_jpeg_parser p = { .hdr = hdr };
+	unsigned int pos = 2, len;
+	const u8 *seg;
+	u8 marker;
+	int ret;
+
+	memset(hdr, 0, sizeof(*hdr));
+
+	if (size < 2 || data[0] != 0xff || data[1] != JPEG_MARKER_SOI)
+		return -EINVAL;
+
+	for (;;) {
+		/* A marker, possibly preceded by fill bytes. */
+		if (pos >= size || data[pos] != 0xff)
+			return -EINVAL;
+		while (pos < size && data[pos] == 0xff)
+			pos++;
+		if (pos + 3 > size)
+			return -EINVAL;
+
+		marker = data[pos];
+		if (JPEG_MARKER_IS_STANDALONE(marker))
+			return -EINVAL;
+
+		len = get_unaligned_be16(&data[pos + 1]);
+		if (len < 2 || pos + 1 + len > size)
+			return -EINVAL;
+		seg = &data[pos + 3];
+		pos += 1 + len;
+		len -= 2;
+
+		switch (marker) {
+		case JPEG_MARKER_SOF0:
+			ret = rockchip_vpu_jpeg_parse_sof(&p, seg, len);
+			break;
+		case JPEG_MARKER_DHT:
+			ret = rockchip_vpu_jpeg_parse_dht(&p, seg, len);
+			break;
+		case JPEG_MARKER_DQT:
+			ret = rockchip_vpu_jpeg_parse_dqt(&p, seg, len);
+			break;
+		case JPEG_MARKER_DRI:
+			if (len < 2)
+				return -EINVAL;
+			hdr->restart_interval = get_unaligned_be16(seg);
+			ret = 0;
+			break;
+		case JPEG_MARKER_SOS:
+			ret = rockchip_vpu_jpeg_parse_sos(&p, seg, len);
+			if (ret)
+				return ret;
+			hdr->scan_offset = pos;
+			return rockchip_vpu_jpeg_finish(hdr);
+		default:
+			/* Progressive, lossless or arithmetic coded. */
+			if (JPEG_MARKER_IS_SOF(marker))
+				return -EINVAL;
+			/* Application data and comments. */
+			ret = 0;
+			break;
+		}
+		if (ret)
+			return ret;
+	}
+}
+
+static void
+rockchip_vpu_jpeg_fill_tbl(u8 *tbl, const struct rockchip_vpu_jpeg_dec_hdr *hdr)
+{
+	unsigned int i;
+
+	for (i = 0; i < RK_VPU_JPEG_DEC_NUM_COMPS; i++)
+		memcpy(tbl + i * 64, hdr->qtbl[hdr->qtbl_sel[i]], 64);
+
+	for (i = 0; i < RK_VPU_JPEG_DEC_NUM_HUFF; i++) {
+		memcpy(tbl + JPEG_TBL_AC_OFFSET + i * RK_VPU_JPEG_AC_VALS,
+		       hdr->ac[i].vals, RK_VPU_JPEG_AC_VALS);
+		memcpy(tbl + JPEG_TBL_DC_OFFSET + i * RK_VPU_JPEG_DC_VALS,
+		       hdr->dc[i].vals, RK_VPU_JPEG_DC_VALS);
+	}
+}
+
+/*
+ * Parse the image of the next source buffer and fill the table of the
+ * hardware. The image must match the capture format: NV12 for 4:2:0,
+ * NV16 for 4:2:2, and the same size in macroblocks.
+ */
+int rockchip_vpu_jpeg_dec_prepare_run(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_jpeg_dec_hdr *hdr = &ctx->jpeg_dec.hdr;
+	struct vb2_buffer *src_buf;
+	const u8 *data;
+	u32 fourcc;
+	int ret;
+
+	src_buf = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	data = vb2_plane_vaddr(src_buf, 0);
+	if (!data) {
+		vpu_err("no kernel mapping of the JPEG image\n");
+		return -EFAULT;
+	}
+
+	ret = rockchip_vpu_jpeg_parse(hdr, data,
+				      vb2_get_plane_payload(src_buf, 0));
+	if (ret) {
+		vpu_err("unsupported or corrupted JPEG image\n");
+		return ret;
+	}
+
+	fourcc = hdr->v_samp == 2 ? V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_NV16;
+	if (ctx->vpu_dst_fmt->fourcc != fourcc ||
+	    MB_WIDTH(hdr->width) != MB_WIDTH(ctx->dst_fmt.width) ||
+	    MB_HEIGHT(hdr->height) != MB_HEIGHT(ctx->dst_fmt.height)) {
+		vpu_err("JPEG image %ux%u does not match the capture format\n",
+			hdr->width, hdr->height);
+		return -EINVAL;
+	}
+
+	rockchip_vpu_jpeg_fill_tbl(ctx->jpeg_dec.tbl.cpu, hdr);
+	return 0;
+}
+
+int rockchip_vpu_jpeg_dec_init(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_aux_buf *tbl = &ctx->jpeg_dec.tbl;
+
+	tbl->size = JPEG_TBL_SIZE;
+	tbl->cpu = dma_zalloc_coherent(ctx->dev->dev, tbl->size, &tbl->dma,
+				       GFP_KERNEL);
+	if (!tbl->cpu)
+		return -ENOMEM;
+	return 0;
+}
+
+void rockchip_vpu_jpeg_dec_exit(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_aux_buf *tbl = &ctx->jpeg_dec.tbl;
+
+	dma_free_coherent(ctx->dev->dev, tbl->size, tbl->cpu, tbl->dma);
+	tbl->cpu = NULL;
+}
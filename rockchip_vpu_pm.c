@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * Runtime power management.
+ *
+ * Every job holds a runtime PM reference. Contexts with the low latency
+ * control set additionally hold one from STREAMON to STREAMOFF, so that
+ * their jobs never wait for the clocks to be enabled again.
+ *
+ * For the other contexts, the autosuspend delay follows the gaps
+ * observed between jobs: the device stays powered over the gaps of a
+ * regular stream, and suspends quickly once the stream stops.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/pm_runtime.h>
+#include <linux/seq_file.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+
+#define RK_VPU_AUTOSUSPEND_MIN_MS	20
+#define RK_VPU_AUTOSUSPEND_MAX_MS	1000
+
+/* Autosuspend delay, as a multiple of the average gap between jobs. */
+#define RK_VPU_AUTOSUSPEND_GAP_FACTOR	2
+
+void rockchip_vpu_pm_init(struct rockchip_vpu_dev *vpu)
+{
+	vpu->pm_delay_ms = RK_VPU_AUTOSUSPEND_DEFAULT_MS;
+	pm_runtime_set_autosuspend_delay(vpu->dev, vpu->pm_delay_ms);
+	pm_runtime_use_autosuspend(vpu->dev);
+}
+
+/* Called from device_run(), before the hardware is touched. */
+void rockchip_vpu_pm_job_start(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	unsigned long flags;
+	unsigned int delay_ms;
+	u64 now, gap;
+
+	pm_runtime_get_sync(vpu->dev);
+
+	now = ktime_get_ns();
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	if (vpu->pm_idle_ns) {
+		gap = min_t(u64, now - vpu->pm_idle_ns,
+			    RK_VPU_AUTOSUSPEND_MAX_MS * NSEC_PER_MSEC);
+		vpu->pm_gap_ns = (7 * vpu->pm_gap_ns + gap) / 8;
+	}
+	delay_ms = clamp_t(u64,
+			   div_u64(vpu->pm_gap_ns * RK_VPU_AUTOSUSPEND_GAP_FACTOR,
+				   NSEC_PER_MSEC),
+			   RK_VPU_AUTOSUSPEND_MIN_MS,
+			   RK_VPU_AUTOSUSPEND_MAX_MS);
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+
+	/* Avoid taking the PM lock for changes that do not matter. */
+	if (abs((int)delay_ms - (int)READ_ONCE(vpu->pm_delay_ms)) >=
+	    RK_VPU_AUTOSUSPEND_MIN_MS / 2) {
+		WRITE_ONCE(vpu->pm_delay_ms, delay_ms);
+		pm_runtime_set_autosuspend_delay(vpu->dev, delay_ms);
+		vpu_debug(1, "autosuspend delay %u ms\n", delay_ms);
+	}
+}
+
+/* Called when a job completes, from process context. */
+void rockchip_vpu_pm_job_end(struct rockchip_vpu_dev *vpu)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	vpu->pm_idle_ns = ktime_get_ns();
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+
+	pm_runtime_mark_last_busy(vpu->dev);
+	pm_runtime_put_autosuspend(vpu->dev);
+}
+
+/* Called from start_streaming() on either queue. */
+void rockchip_vpu_pm_stream_on(struct rockchip_vpu_ctx *ctx)
+{
+	if (ctx->pm_held || !READ_ONCE(ctx->pm_low_latency))
+		return;
+
+	pm_runtime_get_sync(ctx->dev->dev);
+	ctx->pm_held = true;
+}
+
+/* Called from stop_streaming() on either queue. */
+void rockchip_vpu_pm_stream_off(struct rockchip_vpu_ctx *ctx)
+{
+	if (!ctx->pm_held)
+		return;
+
+	ctx->pm_held = false;
+	pm_runtime_mark_last_busy(ctx->dev->dev);
+	pm_runtime_put_autosuspend(ctx->dev->dev);
+}
+
+static int rockchip_vpu_pm_show(struct seq_file *s, void *data)
+{
+	struct rockchip_vpu_dev *vpu = s->private;
+
+	seq_printf(s, "resumes: %llu\n", vpu->pm_resumes);
+	seq_printf(s, "autosuspend_delay_ms: %u\n", READ_ONCE(vpu->pm_delay_ms));
+	seq_printf(s, "average_gap_us: %llu\n",
+		   div_u64(vpu->pm_gap_ns, NSEC_PER_USEC));
+	return 0;
+}
+
+static int rockchip_vpu_pm_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rockchip_vpu_pm_show, inode->i_private);
+}
+
+static const struct file_operations rockchip_vpu_pm_fops = {
+	.owner = THIS_MODULE,
+	.open = rockchip_vpu_pm_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Must be called after rockchip_vpu_stats_init() created the directory. */
+void rockchip_vpu_pm_debugfs_init(struct rockchip_vpu_dev *vpu)
+{
+	if (!vpu->debugfs)
+		return;
+
+	debugfs_create_file("pm", 0444, vpu->debugfs, vpu,
+			    &rockchip_vpu_pm_fops);
+}
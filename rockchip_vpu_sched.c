@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * Weighted fair sharing of a VPU block between contexts.
+ *
+ * The mem2mem core runs jobs in FIFO order, which lets contexts with
+ * large frames starve the ones with small frames. Every context is
+ * therefore charged the hardware time of its jobs, measured from
+ * device_run() to the completion interrupt and scaled by the inverse
+ * of its weight (its "virtual time"). A context is only allowed to be
+ * queued by the mem2mem core (see .job_ready) while no other ready
+ * context lags behind it by more than RK_VPU_SCHED_SLACK_NS of virtual
+ * time. Contexts which were refused are retried once the block
+ * completes a job, from process context.
+ */
+
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <media/v4l2-mem2mem.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+
+/* Virtual time a context may run ahead of the most deserving one. */
+#define RK_VPU_SCHED_SLACK_NS	(4 * NSEC_PER_MSEC)
+
+static bool rockchip_vpu_sched_ctx_ready(struct rockchip_vpu_ctx *ctx)
+{
+	return ctx->sched_running ||
+	       (v4l2_m2m_num_src_bufs_ready(ctx->fh.m2m_ctx) &&
+		v4l2_m2m_num_dst_bufs_ready(ctx->fh.m2m_ctx));
+}
+
+/* Must be called with vpu->irqlock held. */
+static void rockchip_vpu_sched_update_min_vtime(struct rockchip_vpu_sched *sched)
+{
+	struct rockchip_vpu_ctx *ctx;
+	u64 min_vtime = U64_MAX;
+
+	list_for_each_entry(ctx, &sched->ctxs, sched_node)
+		if (rockchip_vpu_sched_ctx_ready(ctx))
+			min_vtime = min(min_vtime, ctx->sched_vtime);
+
+	/* Virtual time never goes backwards. */
+	if (min_vtime != U64_MAX && min_vtime > sched->min_vtime)
+		sched->min_vtime = min_vtime;
+}
+
+/* Must be called with vpu->irqlock held. */
+static bool rockchip_vpu_sched_eligible(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_sched *sched = ctx->sched;
+	struct rockchip_vpu_ctx *other;
+
+	/*
+	 * A context coming back from idle does not get to spend the
+	 * virtual time it did not use while idling.
+	 */
+	if (ctx->sched_vtime + RK_VPU_SCHED_SLACK_NS < sched->min_vtime)
+		ctx->sched_vtime = sched->min_vtime - RK_VPU_SCHED_SLACK_NS;
+
+	list_for_each_entry(other, &sched->ctxs, sched_node) {
+		if (other == ctx || other->sched_running)
+			continue;
+		if (other->sched_vtime + RK_VPU_SCHED_SLACK_NS >=
+		    ctx->sched_vtime)
+			continue;
+		if (rockchip_vpu_sched_ctx_ready(other))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * .job_ready callback of the mem2mem core. Called with the mem2mem
+ * job spinlock held, so vpu->irqlock must never be held while calling
+ * into the mem2mem core.
+ */
+int rockchip_vpu_sched_job_ready(void *priv)
+{
+	struct rockchip_vpu_ctx *ctx = priv;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	unsigned long flags;
+	bool ready;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	ready = rockchip_vpu_sched_eligible(ctx);
+	ctx->sched_deferred = !ready;
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+
+	if (!ready)
+		vpu_debug(1, "ctx %p deferred, vtime %llu\n",
+			  ctx, ctx->sched_vtime);
+	return ready;
+}
+
+/*
+ * Whether a context may start another frame of a batch without going
+ * back through the mem2mem core. Batched frames are charged like any
+ * other job, so a batch ends as soon as the context runs ahead of
+ * another ready context by more than the slack.
+ */
+bool rockchip_vpu_sched_may_continue(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	unsigned long flags;
+	bool eligible;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	eligible = rockchip_vpu_sched_eligible(ctx);
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+
+	if (!eligible)
+		vpu_debug(1, "ctx %p batch preempted, vtime %llu\n",
+			  ctx, ctx->sched_vtime);
+	return eligible;
+}
+
+void rockchip_vpu_sched_job_start(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	ctx->sched_running = true;
+	ctx->sched_start_ns = ktime_get_ns();
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+}
+
+void rockchip_vpu_sched_job_done(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_sched *sched = ctx->sched;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	struct rockchip_vpu_ctx *other;
+	unsigned long flags;
+	bool kick = false;
+	u64 delta;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	delta = ktime_get_ns() - ctx->sched_start_ns;
+	ctx->sched_running = false;
+	ctx->sched_hw_time_ns += delta;
+	ctx->sched_vtime += div_u64(delta * RK_VPU_SCHED_WEIGHT_DEFAULT,
+				    ctx->sched_weight);
+	rockchip_vpu_sched_update_min_vtime(sched);
+
+	list_for_each_entry(other, &sched->ctxs, sched_node)
+		kick |= other->sched_deferred;
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+
+	if (kick)
+		schedule_work(&sched->work);
+}
+
+void rockchip_vpu_sched_set_weight(struct rockchip_vpu_ctx *ctx, u32 weight)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	ctx->sched_weight = weight;
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+}
+
+static void rockchip_vpu_sched_work(struct work_struct *work)
+{
+	struct rockchip_vpu_sched *sched =
+		container_of(work, struct rockchip_vpu_sched, work);
+	struct rockchip_vpu_ctx *ctx;
+
+	/*
+	 * The context list only changes with sched->lock held, so the
+	 * contexts cannot go away while the mem2mem core looks at them.
+	 */
+	mutex_lock(sched->lock);
+	list_for_each_entry(ctx, &sched->ctxs, sched_node) {
+		if (!READ_ONCE(ctx->sched_deferred))
+			continue;
+		v4l2_m2m_try_schedule(ctx->fh.m2m_ctx);
+	}
+	mutex_unlock(sched->lock);
+}
+
+void rockchip_vpu_sched_init(struct rockchip_vpu_sched *sched,
+			     struct mutex *lock)
+{
+	INIT_LIST_HEAD(&sched->ctxs);
+	INIT_WORK(&sched->work, rockchip_vpu_sched_work);
+	sched->lock = lock;
+	sched->min_vtime = 0;
+}
+
+void rockchip_vpu_sched_add_ctx(struct rockchip_vpu_sched *sched,
+				struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	unsigned long flags;
+
+	mutex_lock(sched->lock);
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	ctx->sched = sched;
+	ctx->sched_weight = RK_VPU_SCHED_WEIGHT_DEFAULT;
+	ctx->sched_vtime = sched->min_vtime;
+	list_add_tail(&ctx->sched_node, &sched->ctxs);
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+	mutex_unlock(sched->lock);
+}
+
+void rockchip_vpu_sched_del_ctx(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_sched *sched = ctx->sched;
+	struct rockchip_vpu_dev *vpu = ctx->dev;
+	unsigned long flags;
+
+	mutex_lock(sched->lock);
+	spin_lock_irqsave(&vpu->irqlock, flags);
+	list_del(&ctx->sched_node);
+	spin_unlock_irqrestore(&vpu->irqlock, flags);
+	mutex_unlock(sched->lock);
+
+	vpu_debug(0, "ctx %p used %llu ns of hardware time\n",
+		  ctx, ctx->sched_hw_time_ns);
+
+	/* Contexts waiting behind this one may be eligible now. */
+	schedule_work(&sched->work);
+}
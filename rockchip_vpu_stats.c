@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * Per-stage job latency histograms, exposed in debugfs.
+ *
+ * Every job is timestamped when its buffers are queued, when the
+ * mem2mem core runs it, once the device is resumed, when the hardware
+ * is started, at the interrupt and when the buffers are returned. The
+ * time spent between two consecutive timestamps is accounted in a
+ * log2 histogram (in microseconds) per stage and per codec mode.
+ *
+ * <debugfs>/<device>/latency	Histograms.
+ * <debugfs>/<device>/reset	Write anything to clear the histograms.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <media/v4l2-mem2mem.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+
+static const char * const rockchip_vpu_mode_names[RK_VPU_MODE_COUNT] = {
+	[RK_VPU_MODE_JPEG_ENC] = "jpeg_enc",
+	[RK_VPU_MODE_H264_DEC] = "h264_dec",
+	[RK_VPU_MODE_VP8_DEC] = "vp8_dec",
+	[RK_VPU_MODE_H264_ENC] = "h264_enc",
+	[RK_VPU_MODE_VP8_ENC] = "vp8_enc",
+	[RK_VPU_MODE_JPEG_DEC] = "jpeg_dec",
+};
+
+/* Name of the stage ending at each timestamp. */
+static const char * const rockchip_vpu_stage_names[RK_VPU_NUM_STAMPS] = {
+	[RK_VPU_STAMP_RUN] = "queue",
+	[RK_VPU_STAMP_RESUMED] = "resume",
+	[RK_VPU_STAMP_HW_START] = "program",
+	[RK_VPU_STAMP_IRQ] = "hardware",
+	[RK_VPU_STAMP_DONE] = "complete",
+};
+
+static u64 rockchip_vpu_buf_queued_ns(void *vbuf)
+{
+	if (!vbuf)
+		return 0;
+	return container_of(vbuf, struct rockchip_vpu_buf, m2m_buf.vb)->queued_ns;
+}
+
+/* Called when a job is handed to the hardware block. */
+void rockchip_vpu_stats_job_start(struct rockchip_vpu_ctx *ctx)
+{
+	struct v4l2_m2m_ctx *m2m_ctx = ctx->fh.m2m_ctx;
+	u64 *stamps = ctx->job_stamps;
+
+	/* The job became ready when the last of its buffers was queued. */
+	stamps[RK_VPU_STAMP_QUEUED] =
+		max(rockchip_vpu_buf_queued_ns(v4l2_m2m_next_src_buf(m2m_ctx)),
+		    rockchip_vpu_buf_queued_ns(v4l2_m2m_next_dst_buf(m2m_ctx)));
+	stamps[RK_VPU_STAMP_RUN] = ktime_get_ns();
+	stamps[RK_VPU_STAMP_RESUMED] = stamps[RK_VPU_STAMP_RUN];
+}
+
+static void rockchip_vpu_stats_add(struct rockchip_vpu_stats *stats,
+				   enum rockchip_vpu_codec_mode mode,
+				   unsigned int stage, u64 delta_ns)
+{
+	u64 us = div_u64(delta_ns, NSEC_PER_USEC);
+	unsigned int bucket = us ? ilog2(us) + 1 : 0;
+
+	bucket = min(bucket, RK_VPU_HIST_BUCKETS - 1);
+	stats->hist[mode][stage][bucket]++;
+}
+
+/*
+ * Called once the buffers of a successful job were returned. The
+ * hardware start and interrupt timestamps come from the watchdog.
+ */
+void rockchip_vpu_stats_job_done(struct rockchip_vpu_ctx *ctx,
+				 const struct rockchip_vpu_watchdog *wd)
+{
+	struct rockchip_vpu_stats *stats = &ctx->dev->stats;
+	enum rockchip_vpu_codec_mode mode = ctx->codec_mode;
+	u64 *stamps = ctx->job_stamps;
+	unsigned int i;
+
+	if (mode < 0 || mode >= RK_VPU_MODE_COUNT)
+		return;
+
+	stamps[RK_VPU_STAMP_HW_START] = wd->start_ns;
+	stamps[RK_VPU_STAMP_IRQ] = wd->end_ns;
+	stamps[RK_VPU_STAMP_DONE] = ktime_get_ns();
+
+	for (i = RK_VPU_STAMP_RUN; i < RK_VPU_NUM_STAMPS; i++) {
+		/* Unknown for the first buffers queued before streaming. */
+		if (!stamps[i - 1] || stamps[i] < stamps[i - 1])
+			continue;
+		rockchip_vpu_stats_add(stats, mode, i,
+				       stamps[i] - stamps[i - 1]);
+	}
+}
+
+static void rockchip_vpu_stats_show_hist(struct seq_file *s,
+					 const u32 *hist)
+{
+	unsigned int i, p50 = 0, p99 = 0;
+	u64 count = 0, sum = 0;
+
+	for (i = 0; i < RK_VPU_HIST_BUCKETS; i++)
+		count += hist[i];
+	for (i = 0; i < RK_VPU_HIST_BUCKETS; i++) {
+		sum += hist[i];
+		if (!p50 && sum * 100 >= count * 50)
+			p50 = i + 1;
+		if (!p99 && sum * 100 >= count * 99)
+			p99 = i + 1;
+	}
+
+	/* Percentiles are given as the upper bound of their bucket. */
+	seq_printf(s, "%10llu %10lu %10lu |", count,
+		   p50 ? 1UL << (p50 - 1) : 0, p99 ? 1UL << (p99 - 1) : 0);
+	for (i = 0; i < RK_VPU_HIST_BUCKETS; i++)
+		seq_printf(s, " %u", hist[i]);
+	seq_puts(s, "\n");
+}
+
+static int rockchip_vpu_stats_latency_show(struct seq_file *s, void *data)
+{
+	struct rockchip_vpu_dev *vpu = s->private;
+	unsigned int mode, stage;
+
+	seq_puts(s, "# bucket 0: < 1us, bucket n: < 2^n us\n");
+	seq_printf(s, "%-10s %-10s %10s %10s %10s | buckets\n",
+		   "mode", "stage", "count", "p50_us", "p99_us");
+	for (mode = 0; mode < RK_VPU_MODE_COUNT; mode++) {
+		for (stage = RK_VPU_STAMP_RUN; stage < RK_VPU_NUM_STAMPS;
+		     stage++) {
+			seq_printf(s, "%-10s %-10s ",
+				   rockchip_vpu_mode_names[mode] ?: "unknown",
+				   rockchip_vpu_stage_names[stage]);
+			rockchip_vpu_stats_show_hist(s,
+				vpu->stats.hist[mode][stage]);
+		}
+	}
+	return 0;
+}
+
+static int rockchip_vpu_stats_latency_open(struct inode *inode,
+					   struct file *file)
+{
+	return single_open(file, rockchip_vpu_stats_latency_show,
+			   inode->i_private);
+}
+
+static const struct file_operations rockchip_vpu_stats_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = rockchip_vpu_stats_latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static ssize_t rockchip_vpu_stats_reset_write(struct file *file,
+					      const char __user *buf,
+					      size_t count, loff_t *ppos)
+{
+	struct rockchip_vpu_dev *vpu = file->private_data;
+
+	memset(vpu->stats.hist, 0, sizeof(vpu->stats.hist));
+	return count;
+}
+
+static const struct file_operations rockchip_vpu_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = rockchip_vpu_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+void rockchip_vpu_stats_init(struct rockchip_vpu_dev *vpu)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(vpu->dev), NULL);
+	if (IS_ERR_OR_NULL(dir)) {
+		dev_warn(vpu->dev, "Could not create debugfs directory\n");
+		return;
+	}
+	vpu->debugfs = dir;
+
+	debugfs_create_file("latency", 0444, dir, vpu,
+			    &rockchip_vpu_stats_latency_fops);
+	debugfs_create_file("reset", 0200, dir, vpu,
+			    &rockchip_vpu_stats_reset_fops);
+}
+
+void rockchip_vpu_stats_cleanup(struct rockchip_vpu_dev *vpu)
+{
+	debugfs_remove_recursive(vpu->debugfs);
+	vpu->debugfs = NULL;
+}
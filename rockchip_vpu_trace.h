@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Rockchip VPU codec driver
+ *
+ * Tracepoints for the life of a job.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rockchip_vpu
+
+#if !defined(ROCKCHIP_VPU_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define ROCKCHIP_VPU_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <media/v4l2-mem2mem.h>
+
+#include "rockchip_vpu.h"
+
+#ifndef ROCKCHIP_VPU_TRACE_HELPERS_
+#define ROCKCHIP_VPU_TRACE_HELPERS_
+static inline int rockchip_vpu_trace_buf_index(void *vbuf)
+{
+	return vbuf ? ((struct vb2_v4l2_buffer *)vbuf)->vb2_buf.index : -1;
+}
+#endif
+
+DECLARE_EVENT_CLASS(rockchip_vpu_job,
+	TP_PROTO(struct rockchip_vpu_ctx *ctx),
+	TP_ARGS(ctx),
+
+	TP_STRUCT__entry(
+		__field(const void *, ctx)
+		__field(int, mode)
+		__field(u32, sequence)
+		__field(u32, width)
+		__field(u32, height)
+		__field(int, src_index)
+		__field(int, dst_index)
+	),
+
+	TP_fast_assign(
+		__entry->ctx = ctx;
+		__entry->mode = ctx->codec_mode;
+		__entry->sequence = ctx->sequence_cap;
+		__entry->width = ctx->src_fmt.width;
+		__entry->height = ctx->src_fmt.height;
+		__entry->src_index = rockchip_vpu_trace_buf_index(
+			v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx));
+		__entry->dst_index = rockchip_vpu_trace_buf_index(
+			v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx));
+	),
+
+	TP_printk("ctx=%p mode=%d seq=%u %ux%u src=%d dst=%d",
+		  __entry->ctx, __entry->mode, __entry->sequence,
+		  __entry->width, __entry->height,
+		  __entry->src_index, __entry->dst_index)
+);
+
+DEFINE_EVENT(rockchip_vpu_job, rockchip_vpu_device_run,
+	TP_PROTO(struct rockchip_vpu_ctx *ctx),
+	TP_ARGS(ctx)
+);
+
+DEFINE_EVENT(rockchip_vpu_job, rockchip_vpu_programmed,
+	TP_PROTO(struct rockchip_vpu_ctx *ctx),
+	TP_ARGS(ctx)
+);
+
+DEFINE_EVENT(rockchip_vpu_job, rockchip_vpu_kick,
+	TP_PROTO(struct rockchip_vpu_ctx *ctx),
+	TP_ARGS(ctx)
+);
+
+DEFINE_EVENT(rockchip_vpu_job, rockchip_vpu_watchdog,
+	TP_PROTO(struct rockchip_vpu_ctx *ctx),
+	TP_ARGS(ctx)
+);
+
+DEFINE_EVENT(rockchip_vpu_job, rockchip_vpu_reset,
+	TP_PROTO(struct rockchip_vpu_ctx *ctx),
+	TP_ARGS(ctx)
+);
+
+TRACE_EVENT(rockchip_vpu_irq,
+	TP_PROTO(struct rockchip_vpu_ctx *ctx, u32 status),
+	TP_ARGS(ctx, status),
+
+	TP_STRUCT__entry(
+		__field(const void *, ctx)
+		__field(int, mode)
+		__field(u32, sequence)
+		__field(u32, width)
+		__field(u32, height)
+		__field(int, src_index)
+		__field(int, dst_index)
+		__field(u32, status)
+	),
+
+	TP_fast_assign(
+		__entry->ctx = ctx;
+		__entry->mode = ctx ? ctx->codec_mode : RK_VPU_MODE_NONE;
+		__entry->sequence = ctx ? ctx->sequence_cap : 0;
+		__entry->width = ctx ? ctx->src_fmt.width : 0;
+		__entry->height = ctx ? ctx->src_fmt.height : 0;
+		__entry->src_index = ctx ? rockchip_vpu_trace_buf_index(
+			v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx)) : -1;
+		__entry->dst_index = ctx ? rockchip_vpu_trace_buf_index(
+			v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx)) : -1;
+		__entry->status = status;
+	),
+
+	TP_printk("ctx=%p mode=%d seq=%u %ux%u src=%d dst=%d status=0x%08x",
+		  __entry->ctx, __entry->mode, __entry->sequence,
+		  __entry->width, __entry->height,
+		  __entry->src_index, __entry->dst_index, __entry->status)
+);
+
+TRACE_EVENT(rockchip_vpu_job_finish,
+	TP_PROTO(struct rockchip_vpu_ctx *ctx, unsigned int src_index,
+		 unsigned int dst_index, u32 sequence, int result),
+	TP_ARGS(ctx, src_index, dst_index, sequence, result),
+
+	TP_STRUCT__entry(
+		__field(const void *, ctx)
+		__field(int, mode)
+		__field(u32, sequence)
+		__field(u32, width)
+		__field(u32, height)
+		__field(int, src_index)
+		__field(int, dst_index)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->ctx = ctx;
+		__entry->mode = ctx->codec_mode;
+		__entry->sequence = sequence;
+		__entry->width = ctx->src_fmt.width;
+		__entry->height = ctx->src_fmt.height;
+		__entry->src_index = src_index;
+		__entry->dst_index = dst_index;
+		__entry->result = result;
+	),
+
+	TP_printk("ctx=%p mode=%d seq=%u %ux%u src=%d dst=%d result=%d",
+		  __entry->ctx, __entry->mode, __entry->sequence,
+		  __entry->width, __entry->height,
+		  __entry->src_index, __entry->dst_index, __entry->result)
+);
+
+#endif /* ROCKCHIP_VPU_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE rockchip_vpu_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * VP8 decoding helpers shared by the variants.
+ *
+ * The decoder is stateless: every job comes with a media request
+ * carrying the frame header control, parsed by userspace. The hardware
+ * reads the probabilities from a table in memory, and keeps the
+ * segment map of the stream in a buffer of the context.
+ */
+
+#include <linux/dma-mapping.h>
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_hw.h"
+
+/* Probability table, as read by the hardware. */
+struct rockchip_vpu_vp8_prob_tbl {
+	u8 prob_mb_skip_false;
+	u8 prob_intra;
+	u8 prob_ref_last;
+	u8 prob_ref_golden;
+	u8 prob_segment[3];
+	u8 padding0;
+
+	u8 prob_luma_16x16_pred_mode[4];
+	u8 prob_chroma_pred_mode[3];
+	u8 padding1;
+
+	u8 prob_mv_context[2][19];
+	u8 padding2[2];
+
+	u8 prob_coeffs[4][8][3][11];
+	u8 padding3[96];
+};
+
+/* Sub-pixel interpolation filters, from RFC 6386 section 18.3. */
+const s32 rockchip_vpu_vp8_dec_mc_filter[8][6] = {
+	{ 0,  0, 128,   0,   0, 0 },
+	{ 0, -6, 123,  12,  -1, 0 },
+	{ 2, -11, 108, 36,  -8, 1 },
+	{ 0, -9,  93,  50,  -6, 0 },
+	{ 3, -16, 77,  77, -16, 3 },
+	{ 0, -6,  50,  93,  -9, 0 },
+	{ 1, -8,  36, 108, -11, 2 },
+	{ 0, -1,  12, 123,  -6, 0 },
+};
+
+/*
+ * The hardware does not follow the layout of the structure above for
+ * the motion vector and coefficient probabilities: they are split in
+ * 8 byte rows, in the order below. The encoder reads the same table.
+ */
+void rockchip_vpu_vp8_prob_update(u8 *tbl,
+				  const struct v4l2_ctrl_vp8_frame_header *hdr)
+{
+	const struct v4l2_vp8_entropy_header *entropy = &hdr->entropy_header;
+	unsigned int i, j, k;
+	u8 *dst;
+
+	dst = tbl;
+
+	dst[0] = hdr->prob_skip_false;
+	dst[1] = hdr->prob_intra;
+	dst[2] = hdr->prob_last;
+	dst[3] = hdr->prob_gf;
+	dst[4] = hdr->segment_header.segment_probs[0];
+	dst[5] = hdr->segment_header.segment_probs[1];
+	dst[6] = hdr->segment_header.segment_probs[2];
+	dst[7] = 0;
+	dst += 8;
+
+	dst[0] = entropy->y_mode_probs[0];
+	dst[1] = entropy->y_mode_probs[1];
+	dst[2] = entropy->y_mode_probs[2];
+	dst[3] = entropy->y_mode_probs[3];
+	dst[4] = entropy->uv_mode_probs[0];
+	dst[5] = entropy->uv_mode_probs[1];
+	dst[6] = entropy->uv_mode_probs[2];
+	dst[7] = 0;
+	dst += 8;
+
+	/* Is short and sign, then the two long bits read last. */
+	dst[0] = entropy->mv_probs[0][0];
+	dst[1] = entropy->mv_probs[1][0];
+	dst[2] = entropy->mv_probs[0][1];
+	dst[3] = entropy->mv_probs[1][1];
+	dst[4] = entropy->mv_probs[0][8 + 9];
+	dst[5] = entropy->mv_probs[0][9 + 9];
+	dst[6] = entropy->mv_probs[1][8 + 9];
+	dst[7] = entropy->mv_probs[1][9 + 9];
+	dst += 8;
+
+	/* Long bits 0 to 7. */
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 8; j++)
+			*dst++ = entropy->mv_probs[i][j + 9];
+	}
+
+	/* Short tree. */
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 7; j++)
+			dst[j] = entropy->mv_probs[i][j + 2];
+		dst[7] = 0;
+		dst += 8;
+	}
+
+	/* First four coefficient probabilities of each band and context. */
+	dst = tbl;
+	dst += 8 * 7;
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 8; j++) {
+			for (k = 0; k < 3; k++) {
+				memcpy(dst, &entropy->coeff_probs[i][j][k][0], 4);
+				dst += 4;
+			}
+		}
+	}
+
+	/* The seven others. */
+	dst = tbl;
+	dst += 8 * 55;
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 8; j++) {
+			for (k = 0; k < 3; k++) {
+				memcpy(dst, &entropy->coeff_probs[i][j][k][4], 7);
+				dst[7] = 0;
+				dst += 8;
+			}
+		}
+	}
+}
+
+/*
+ * Address of the reference frame with timestamp ts, or 0 if no capture
+ * buffer has it.
+ */
+dma_addr_t rockchip_vpu_vp8_get_ref(struct rockchip_vpu_ctx *ctx, u64 ts)
+{
+	struct vb2_queue *cap_q = &ctx->fh.m2m_ctx->cap_q_ctx.q;
+	int idx;
+
+	idx = vb2_find_timestamp(cap_q, ts, 0);
+	if (idx < 0)
+		return 0;
+	return vb2_dma_contig_plane_dma_addr(cap_q->bufs[idx], 0);
+}
+
+int rockchip_vpu_vp8_dec_init(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_vp8_dec_hw_ctx *vp8_dec = &ctx->vp8_dec;
+	struct device *dev = ctx->dev->dev;
+	struct rockchip_vpu_aux_buf *aux;
+	unsigned int mbs;
+
+	/* Two bits per macroblock, in 64 byte units. */
+	mbs = MB_WIDTH(ctx->dst_fmt.width) * MB_HEIGHT(ctx->dst_fmt.height);
+	aux = &vp8_dec->segment_map;
+	aux->size = round_up(DIV_ROUND_UP(mbs, 4), 64);
+	aux->cpu = dma_zalloc_coherent(dev, aux->size, &aux->dma, GFP_KERNEL);
+	if (!aux->cpu)
+		return -ENOMEM;
+
+	BUILD_BUG_ON(sizeof(struct rockchip_vpu_vp8_prob_tbl) !=
+		     ROCKCHIP_VPU_VP8_PROB_TBL_SIZE);
+	aux = &vp8_dec->prob_tbl;
+	aux->size = sizeof(struct rockchip_vpu_vp8_prob_tbl);
+	aux->cpu = dma_zalloc_coherent(dev, aux->size, &aux->dma, GFP_KERNEL);
+	if (!aux->cpu) {
+		aux = &vp8_dec->segment_map;
+		dma_free_coherent(dev, aux->size, aux->cpu, aux->dma);
+		aux->cpu = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void rockchip_vpu_vp8_dec_exit(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_vp8_dec_hw_ctx *vp8_dec = &ctx->vp8_dec;
+	struct device *dev = ctx->dev->dev;
+
+	dma_free_coherent(dev, vp8_dec->segment_map.size,
+			  vp8_dec->segment_map.cpu, vp8_dec->segment_map.dma);
+	dma_free_coherent(dev, vp8_dec->prob_tbl.size,
+			  vp8_dec->prob_tbl.cpu, vp8_dec->prob_tbl.dma);
+	vp8_dec->segment_map.cpu = NULL;
+	vp8_dec->prob_tbl.cpu = NULL;
+}
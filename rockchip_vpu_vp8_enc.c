@@ -0,0 +1,885 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * VP8 encoding helpers shared by the variants.
+ *
+ * The encoder is stateful: every capture buffer gets one VP8 frame. The
+ * driver writes the uncompressed chunk and the beginning of the first
+ * partition, up to the macroblock headers, with its own bool encoder.
+ * The hardware picks up the state of that bool encoder, writes the
+ * macroblock headers, and the DCT coefficients in separate partitions
+ * which are moved next to the first one once the frame is done.
+ *
+ * The other frames are inter frames, predicted from the previous
+ * reconstructed frame only. The coefficient probabilities follow the
+ * token counts the hardware gathered on the previous frame, and are
+ * kept from one frame to the next.
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_common.h"
+#include "rockchip_vpu_hw.h"
+
+#define VP8_NUM_QIS			128
+#define VP8_KEY_FRAME_HDR_SIZE		10
+#define VP8_INTER_FRAME_HDR_SIZE	3
+
+/*
+ * Bound of the part of the first partition written by the driver: an
+ * update of every coefficient probability takes less than 2.5 KiB.
+ */
+#define VP8_MAX_HDR_SIZE		4096
+
+/* Probabilities which do not follow the frames. */
+#define VP8_PROB_SKIP_FALSE		128
+#define VP8_PROB_INTRA			63
+#define VP8_PROB_LAST			255
+#define VP8_PROB_GOLDEN			128
+
+/* Branch counts of each coefficient probability, written by the hardware. */
+struct rockchip_vpu_vp8_enc_counts {
+	u16 coeff[4][8][3][11][2];
+};
+
+/* Bool encoder of RFC 6386 section 7.3. */
+struct rockchip_vpu_vp8_enc_bool {
+	u8 *buf;
+	unsigned int size;
+	unsigned int pos;
+	u32 bottom;
+	u32 range;
+	int count;
+	bool overflow;
+};
+
+/* Quantizer step of each quantizer index, from RFC 6386 section 14.1. */
+static const u8 rockchip_vpu_vp8_dc_qlookup[VP8_NUM_QIS] = {
+	4, 5, 6, 7, 8, 9, 10, 10, 11, 12, 13, 14,
+	15, 16, 17, 17, 18, 19, 20, 20, 21, 21, 22, 22,
+	23, 23, 24, 25, 25, 26, 27, 28, 29, 30, 31, 32,
+	33, 34, 35, 36, 37, 37, 38, 39, 40, 41, 42, 43,
+	44, 45, 46, 46, 47, 48, 49, 50, 51, 52, 53, 54,
+	55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66,
+	67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 76, 77,
+	78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 88, 89,
+	91, 93, 95, 96, 98, 100, 101, 102, 104, 106, 108, 110,
+	112, 114, 116, 118, 122, 124, 126, 128, 130, 132, 134, 136,
+	138, 140, 143, 145, 148, 151, 154, 157,
+};
+
+static const u16 rockchip_vpu_vp8_ac_qlookup[VP8_NUM_QIS] = {
+	4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27,
+	28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39,
+	40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,
+	52, 53, 54, 55, 56, 57, 58, 60, 62, 64, 66, 68,
+	70, 72, 74, 76, 78, 80, 82, 84, 86, 88, 90, 92,
+	94, 96, 98, 100, 102, 104, 106, 108, 110, 112, 114, 116,
+	119, 122, 125, 128, 131, 134, 137, 140, 143, 146, 149, 152,
+	155, 158, 161, 164, 167, 170, 173, 177, 181, 185, 189, 193,
+	197, 201, 205, 209, 213, 217, 221, 225, 229, 234, 239, 245,
+	249, 254, 259, 264, 269, 274, 279, 284,
+};
+
+/* Default probabilities, from RFC 6386 sections 11.2, 13.5 and 17.2. */
+static const u8 rockchip_vpu_vp8_ymode_probs[4] = { 112, 86, 140, 37 };
+static const u8 rockchip_vpu_vp8_uv_mode_probs[3] = { 162, 101, 204 };
+
+static const u8 rockchip_vpu_vp8_mv_probs[2][19] = {
+	{
+		162, 128, 225, 146, 172, 147, 214, 39, 156,
+		128, 129, 132, 75, 145, 178, 206, 239, 254, 254,
+	}, {
+		164, 128, 204, 170, 119, 235, 140, 230, 228,
+		128, 130, 130, 74, 148, 180, 203, 236, 254, 254,
+	},
+};
+
+static const u8 rockchip_vpu_vp8_coeff_probs[4][8][3][11] = {
+	{
+		{
+			{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		}, {
+			{ 253, 136, 254, 255, 228, 219, 128, 128, 128, 128, 128 },
+			{ 189, 129, 242, 255, 227, 213, 255, 219, 128, 128, 128 },
+			{ 106, 126, 227, 252, 214, 209, 255, 255, 128, 128, 128 },
+		}, {
+			{ 1, 98, 248, 255, 236, 226, 255, 255, 128, 128, 128 },
+			{ 181, 133, 238, 254, 221, 234, 255, 154, 128, 128, 128 },
+			{ 78, 134, 202, 247, 198, 180, 255, 219, 128, 128, 128 },
+		}, {
+			{ 1, 185, 249, 255, 243, 255, 128, 128, 128, 128, 128 },
+			{ 184, 150, 247, 255, 236, 224, 128, 128, 128, 128, 128 },
+			{ 77, 110, 216, 255, 236, 230, 128, 128, 128, 128, 128 },
+		}, {
+			{ 1, 101, 251, 255, 241, 255, 128, 128, 128, 128, 128 },
+			{ 170, 139, 241, 252, 236, 209, 255, 255, 128, 128, 128 },
+			{ 37, 116, 196, 243, 228, 255, 255, 255, 128, 128, 128 },
+		}, {
+			{ 1, 204, 254, 255, 245, 255, 128, 128, 128, 128, 128 },
+			{ 207, 160, 250, 255, 238, 128, 128, 128, 128, 128, 128 },
+			{ 102, 103, 231, 255, 211, 171, 128, 128, 128, 128, 128 },
+		}, {
+			{ 1, 152, 252, 255, 240, 255, 128, 128, 128, 128, 128 },
+			{ 177, 135, 243, 255, 234, 225, 128, 128, 128, 128, 128 },
+			{ 80, 129, 211, 255, 194, 224, 128, 128, 128, 128, 128 },
+		}, {
+			{ 1, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 246, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 255, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		},
+	}, {
+		{
+			{ 198, 35, 237, 223, 193, 187, 162, 160, 145, 155, 62 },
+			{ 131, 45, 198, 221, 172, 176, 220, 157, 252, 221, 1 },
+			{ 68, 47, 146, 208, 149, 167, 221, 162, 255, 223, 128 },
+		}, {
+			{ 1, 149, 241, 255, 221, 224, 255, 255, 128, 128, 128 },
+			{ 184, 141, 234, 253, 222, 220, 255, 199, 128, 128, 128 },
+			{ 81, 99, 181, 242, 176, 190, 249, 202, 255, 255, 128 },
+		}, {
+			{ 1, 129, 232, 253, 214, 197, 242, 196, 255, 255, 128 },
+			{ 99, 121, 210, 250, 201, 198, 255, 202, 128, 128, 128 },
+			{ 23, 91, 163, 242, 170, 187, 247, 210, 255, 255, 128 },
+		}, {
+			{ 1, 200, 246, 255, 234, 255, 128, 128, 128, 128, 128 },
+			{ 109, 178, 241, 255, 231, 245, 255, 255, 128, 128, 128 },
+			{ 44, 130, 201, 253, 205, 192, 255, 255, 128, 128, 128 },
+		}, {
+			{ 1, 132, 239, 251, 219, 209, 255, 165, 128, 128, 128 },
+			{ 94, 136, 225, 251, 218, 190, 255, 255, 128, 128, 128 },
+			{ 22, 100, 174, 245, 186, 161, 255, 199, 128, 128, 128 },
+		}, {
+			{ 1, 182, 249, 255, 232, 235, 128, 128, 128, 128, 128 },
+			{ 124, 143, 241, 255, 227, 234, 128, 128, 128, 128, 128 },
+			{ 35, 77, 181, 251, 193, 211, 255, 205, 128, 128, 128 },
+		}, {
+			{ 1, 157, 247, 255, 236, 231, 255, 255, 128, 128, 128 },
+			{ 121, 141, 235, 255, 225, 227, 255, 255, 128, 128, 128 },
+			{ 45, 99, 188, 251, 195, 217, 255, 224, 128, 128, 128 },
+		}, {
+			{ 1, 1, 251, 255, 213, 255, 128, 128, 128, 128, 128 },
+			{ 203, 1, 248, 255, 255, 128, 128, 128, 128, 128, 128 },
+			{ 137, 1, 177, 255, 224, 255, 128, 128, 128, 128, 128 },
+		},
+	}, {
+		{
+			{ 253, 9, 248, 251, 207, 208, 255, 192, 128, 128, 128 },
+			{ 175, 13, 224, 243, 193, 185, 249, 198, 255, 255, 128 },
+			{ 73, 17, 171, 221, 161, 179, 236, 167, 255, 234, 128 },
+		}, {
+			{ 1, 95, 247, 253, 212, 183, 255, 255, 128, 128, 128 },
+			{ 239, 90, 244, 250, 211, 209, 255, 255, 128, 128, 128 },
+			{ 155, 77, 195, 248, 188, 195, 255, 255, 128, 128, 128 },
+		}, {
+			{ 1, 24, 239, 251, 218, 219, 255, 205, 128, 128, 128 },
+			{ 201, 51, 219, 255, 196, 186, 128, 128, 128, 128, 128 },
+			{ 69, 46, 190, 239, 201, 218, 255, 228, 128, 128, 128 },
+		}, {
+			{ 1, 191, 251, 255, 255, 128, 128, 128, 128, 128, 128 },
+			{ 223, 165, 249, 255, 213, 255, 128, 128, 128, 128, 128 },
+			{ 141, 124, 248, 255, 255, 128, 128, 128, 128, 128, 128 },
+		}, {
+			{ 1, 16, 248, 255, 255, 128, 128, 128, 128, 128, 128 },
+			{ 190, 36, 230, 255, 236, 255, 128, 128, 128, 128, 128 },
+			{ 149, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		}, {
+			{ 1, 226, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 247, 192, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 240, 128, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		}, {
+			{ 1, 134, 252, 255, 255, 128, 128, 128, 128, 128, 128 },
+			{ 213, 62, 250, 255, 255, 128, 128, 128, 128, 128, 128 },
+			{ 55, 93, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		}, {
+			{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		},
+	}, {
+		{
+			{ 202, 24, 213, 235, 186, 191, 220, 160, 240, 175, 255 },
+			{ 126, 38, 182, 232, 169, 184, 228, 174, 255, 187, 128 },
+			{ 61, 46, 138, 219, 151, 178, 240, 170, 255, 216, 128 },
+		}, {
+			{ 1, 112, 230, 250, 199, 191, 247, 159, 255, 255, 128 },
+			{ 166, 109, 228, 252, 211, 215, 255, 174, 128, 128, 128 },
+			{ 39, 77, 162, 232, 172, 180, 245, 178, 255, 255, 128 },
+		}, {
+			{ 1, 52, 220, 246, 198, 199, 249, 220, 255, 255, 128 },
+			{ 124, 74, 191, 243, 183, 193, 250, 221, 255, 255, 128 },
+			{ 24, 71, 130, 219, 154, 170, 243, 182, 255, 255, 128 },
+		}, {
+			{ 1, 182, 225, 249, 219, 240, 255, 224, 128, 128, 128 },
+			{ 149, 150, 226, 252, 216, 205, 255, 171, 128, 128, 128 },
+			{ 28, 108, 170, 242, 183, 194, 254, 223, 255, 255, 128 },
+		}, {
+			{ 1, 81, 230, 252, 204, 203, 255, 192, 128, 128, 128 },
+			{ 123, 102, 209, 247, 188, 196, 255, 233, 128, 128, 128 },
+			{ 20, 95, 153, 243, 164, 173, 255, 203, 128, 128, 128 },
+		}, {
+			{ 1, 222, 248, 255, 216, 213, 128, 128, 128, 128, 128 },
+			{ 168, 175, 246, 252, 235, 205, 255, 255, 128, 128, 128 },
+			{ 47, 116, 215, 255, 211, 212, 255, 255, 128, 128, 128 },
+		}, {
+			{ 1, 121, 236, 253, 212, 214, 255, 255, 128, 128, 128 },
+			{ 141, 84, 213, 252, 201, 202, 255, 219, 128, 128, 128 },
+			{ 42, 80, 160, 240, 162, 185, 255, 205, 128, 128, 128 },
+		}, {
+			{ 1, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 244, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+			{ 238, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		},
+	},
+};
+
+/* Probabilities of the update flags, from RFC 6386 sections 13.4 and 17.2. */
+static const u8 rockchip_vpu_vp8_mv_update_probs[2][19] = {
+	{
+		237, 246, 253, 253, 254, 254, 254, 254, 254,
+		254, 254, 254, 254, 254, 250, 250, 252, 254, 254,
+	}, {
+		231, 243, 245, 253, 254, 254, 254, 254, 254,
+		254, 254, 254, 254, 254, 251, 251, 254, 254, 254,
+	},
+};
+
+static const u8 rockchip_vpu_vp8_coeff_update_probs[4][8][3][11] = {
+	{
+		{
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 176, 246, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 223, 241, 252, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 249, 253, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 244, 252, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 234, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 253, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 246, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 239, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 254, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 248, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 251, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 251, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 254, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 254, 253, 255, 254, 255, 255, 255, 255, 255, 255 },
+			{ 250, 255, 254, 255, 254, 255, 255, 255, 255, 255, 255 },
+			{ 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		},
+	}, {
+		{
+			{ 217, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 225, 252, 241, 253, 255, 255, 254, 255, 255, 255, 255 },
+			{ 234, 250, 241, 250, 253, 255, 253, 254, 255, 255, 255 },
+		}, {
+			{ 255, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 223, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 238, 253, 254, 254, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 248, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 249, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 253, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 247, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 252, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 253, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 254, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 250, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		},
+	}, {
+		{
+			{ 186, 251, 250, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 234, 251, 244, 254, 255, 255, 255, 255, 255, 255, 255 },
+			{ 251, 251, 243, 253, 254, 255, 254, 255, 255, 255, 255 },
+		}, {
+			{ 255, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 236, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 251, 253, 253, 254, 254, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 254, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 254, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		},
+	}, {
+		{
+			{ 248, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 250, 254, 252, 254, 255, 255, 255, 255, 255, 255, 255 },
+			{ 248, 254, 249, 253, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 253, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 246, 253, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 252, 254, 251, 254, 254, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 254, 252, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 248, 254, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 253, 255, 254, 254, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 251, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 245, 251, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 253, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 251, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 252, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 252, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 249, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 255, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 250, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		}, {
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+			{ 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		},
+	},
+};
+
+static void rockchip_vpu_vp8_enc_put_bool(struct rockchip_vpu_vp8_enc_bool *bc,
+					  u8 prob, bool bit)
+{
+	u32 split = 1 + (((bc->range - 1) * prob) >> 8);
+	unsigned int shift, offset;
+	int i;
+
+	if (bit) {
+		bc->bottom += split;
+		bc->range -= split;
+	} else {
+		bc->range = split;
+	}
+
+	shift = 8 - fls(bc->range);
+	bc->range <<= shift;
+	bc->count += shift;
+	if (bc->count >= 0) {
+		offset = shift - bc->count;
+		/* Propagate the carry to the bytes already written. */
+		if ((bc->bottom << (offset - 1)) & BIT(31)) {
+			for (i = bc->pos - 1; i >= 0 && bc->buf[i] == 0xff; i--)
+				bc->buf[i] = 0;
+			if (i >= 0)
+				bc->buf[i]++;
+		}
+		if (bc->pos < bc->size)
+			bc->buf[bc->pos++] = bc->bottom >> (24 - offset);
+		else
+			bc->overflow = true;
+		bc->bottom <<= offset;
+		shift = bc->count;
+		bc->bottom &= 0xffffff;
+		bc->count -= 8;
+	}
+	bc->bottom <<= shift;
+}
+
+static void rockchip_vpu_vp8_enc_put_lit(struct rockchip_vpu_vp8_enc_bool *bc,
+					 u32 val, unsigned int n)
+{
+	while (n--)
+		rockchip_vpu_vp8_enc_put_bool(bc, 128, (val >> n) & 1);
+}
+
+/* log2(x) in 1/256 bits, for x from 1 to 256, linearly interpolated. */
+static u32 rockchip_vpu_vp8_enc_log2(u32 x)
+{
+	unsigned int n = fls(x) - 1;
+
+	return (n << 8) + ((x << 8) >> n) - 256;
+}
+
+/* Cost of bit with probability prob of a zero, in 1/256 bits. */
+static u32 rockchip_vpu_vp8_enc_cost(u8 prob, bool bit)
+{
+	return (8 << 8) - rockchip_vpu_vp8_enc_log2(bit ? 256 - prob : prob);
+}
+
+static void
+rockchip_vpu_vp8_enc_reset_entropy(struct v4l2_vp8_entropy_header *e)
+{
+	memcpy(e->coeff_probs, rockchip_vpu_vp8_coeff_probs,
+	       sizeof(e->coeff_probs));
+	memcpy(e->y_mode_probs, rockchip_vpu_vp8_ymode_probs,
+	       sizeof(e->y_mode_probs));
+	memcpy(e->uv_mode_probs, rockchip_vpu_vp8_uv_mode_probs,
+	       sizeof(e->uv_mode_probs));
+	memcpy(e->mv_probs, rockchip_vpu_vp8_mv_probs, sizeof(e->mv_probs));
+}
+
+/*
+ * Update prob to the one measured on the previous frame when the bits
+ * it saves on a frame like the previous one pay for the update, and
+ * write the update flag and value.
+ */
+static void
+rockchip_vpu_vp8_enc_put_coeff_prob(struct rockchip_vpu_vp8_enc_bool *bc,
+				    u8 *prob, u8 upd, const u16 count[2])
+{
+	u32 old_cost, new_cost;
+	u8 new_prob;
+
+	if (!(count[0] + count[1])) {
+		rockchip_vpu_vp8_enc_put_bool(bc, upd, 0);
+		return;
+	}
+
+	new_prob = clamp(DIV_ROUND_CLOSEST((u32)count[0] << 8,
+					   count[0] + count[1]), 1U, 255U);
+	old_cost = count[0] * rockchip_vpu_vp8_enc_cost(*prob, 0) +
+		   count[1] * rockchip_vpu_vp8_enc_cost(*prob, 1) +
+		   rockchip_vpu_vp8_enc_cost(upd, 0);
+	new_cost = count[0] * rockchip_vpu_vp8_enc_cost(new_prob, 0) +
+		   count[1] * rockchip_vpu_vp8_enc_cost(new_prob, 1) +
+		   rockchip_vpu_vp8_enc_cost(upd, 1) + (8 << 8);
+	if (new_prob == *prob || new_cost >= old_cost) {
+		rockchip_vpu_vp8_enc_put_bool(bc, upd, 0);
+		return;
+	}
+
+	rockchip_vpu_vp8_enc_put_bool(bc, upd, 1);
+	rockchip_vpu_vp8_enc_put_lit(bc, new_prob, 8);
+	*prob = new_prob;
+}
+
+/*
+ * Write token_prob_update() of RFC 6386 section 9.9. The probabilities,
+ * update probabilities and counts are all in the same order.
+ */
+static void
+rockchip_vpu_vp8_enc_put_coeff_probs(struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc,
+				     struct rockchip_vpu_vp8_enc_bool *bc)
+{
+	const struct rockchip_vpu_vp8_enc_counts *counts = vp8_enc->prob_cnt.cpu;
+	u8 *probs = &vp8_enc->hdr.entropy_header.coeff_probs[0][0][0][0];
+	const u8 *upd = &rockchip_vpu_vp8_coeff_update_probs[0][0][0][0];
+	const u16 (*count)[2] = &counts->coeff[0][0][0][0];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(rockchip_vpu_vp8_coeff_update_probs); i++) {
+		if (vp8_enc->counts_valid)
+			rockchip_vpu_vp8_enc_put_coeff_prob(bc, &probs[i],
+							    upd[i], count[i]);
+		else
+			rockchip_vpu_vp8_enc_put_bool(bc, upd[i], 0);
+	}
+}
+
+/*
+ * Write the frame header of RFC 6386 section 19.2, from the first
+ * partition, up to the macroblock headers written by the hardware.
+ */
+static void rockchip_vpu_vp8_enc_put_hdr(struct rockchip_vpu_ctx *ctx,
+					 struct rockchip_vpu_vp8_enc_bool *bc)
+{
+	struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc = &ctx->vp8_enc;
+	struct rockchip_vpu_vp8_enc_quant quant;
+	unsigned int qi, i, j;
+
+	qi = vp8_enc->key ? vp8_enc->qi_i : vp8_enc->qi_p;
+	rockchip_vpu_vp8_enc_quant(qi, &quant);
+
+	if (vp8_enc->key) {
+		/* color_space, clamping_type */
+		rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+		rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+	}
+	/* segmentation_enabled, filter_type */
+	rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+	rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+	rockchip_vpu_vp8_enc_put_lit(bc, quant.filter_level, 6);
+	/* sharpness_level, loop_filter_adj_enable */
+	rockchip_vpu_vp8_enc_put_lit(bc, 0, 3);
+	rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+	rockchip_vpu_vp8_enc_put_lit(bc, ilog2(vp8_enc->num_parts), 2);
+	/* y_ac_qi, without deltas for the other coefficients. */
+	rockchip_vpu_vp8_enc_put_lit(bc, qi, 7);
+	rockchip_vpu_vp8_enc_put_lit(bc, 0, 5);
+	if (!vp8_enc->key) {
+		/*
+		 * Golden and altref frames stay the last key frame: no
+		 * refresh, no copy, no sign bias.
+		 */
+		rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+		rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+		rockchip_vpu_vp8_enc_put_lit(bc, 0, 2);
+		rockchip_vpu_vp8_enc_put_lit(bc, 0, 2);
+		rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+		rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+	}
+	/* refresh_entropy_probs */
+	rockchip_vpu_vp8_enc_put_lit(bc, 1, 1);
+	if (!vp8_enc->key) {
+		/* refresh_last */
+		rockchip_vpu_vp8_enc_put_lit(bc, 1, 1);
+	}
+
+	rockchip_vpu_vp8_enc_put_coeff_probs(vp8_enc, bc);
+
+	/* mb_no_coeff_skip */
+	rockchip_vpu_vp8_enc_put_lit(bc, 1, 1);
+	rockchip_vpu_vp8_enc_put_lit(bc, vp8_enc->hdr.prob_skip_false, 8);
+	if (vp8_enc->key)
+		return;
+
+	rockchip_vpu_vp8_enc_put_lit(bc, vp8_enc->hdr.prob_intra, 8);
+	rockchip_vpu_vp8_enc_put_lit(bc, vp8_enc->hdr.prob_last, 8);
+	rockchip_vpu_vp8_enc_put_lit(bc, vp8_enc->hdr.prob_gf, 8);
+	/* intra_16x16_prob_update_flag, intra_chroma_prob_update_flag */
+	rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+	rockchip_vpu_vp8_enc_put_lit(bc, 0, 1);
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 19; j++)
+			rockchip_vpu_vp8_enc_put_bool(bc,
+				rockchip_vpu_vp8_mv_update_probs[i][j], 0);
+	}
+}
+
+/*
+ * Quantization at quantizer index qi, from RFC 6386 section 14.1, and
+ * the mode decision and loop filter settings following it.
+ */
+void rockchip_vpu_vp8_enc_quant(unsigned int qi,
+				struct rockchip_vpu_vp8_enc_quant *quant)
+{
+	unsigned int i;
+	u32 q;
+
+	qi = min_t(unsigned int, qi, VP8_NUM_QIS - 1);
+	quant->dequant[RK_VPU_VP8_Y1_DC] = rockchip_vpu_vp8_dc_qlookup[qi];
+	quant->dequant[RK_VPU_VP8_Y1_AC] = rockchip_vpu_vp8_ac_qlookup[qi];
+	quant->dequant[RK_VPU_VP8_Y2_DC] = 2 * rockchip_vpu_vp8_dc_qlookup[qi];
+	quant->dequant[RK_VPU_VP8_Y2_AC] =
+		max_t(u32, rockchip_vpu_vp8_ac_qlookup[qi] * 155 / 100, 8);
+	quant->dequant[RK_VPU_VP8_UV_DC] =
+		min_t(u32, rockchip_vpu_vp8_dc_qlookup[qi], 132);
+	quant->dequant[RK_VPU_VP8_UV_AC] = rockchip_vpu_vp8_ac_qlookup[qi];
+
+	for (i = 0; i < RK_VPU_VP8_NUM_COEFFS; i++) {
+		q = quant->dequant[i];
+		quant->quant[i] = min_t(u32, 65536 / q, 0x3fff);
+		/* Dead zone of half a step, rounding of 3/8 of a step. */
+		quant->zbin[i] = (q * 64 + 64) >> 7;
+		quant->round[i] = (q * 48) >> 7;
+	}
+
+	quant->lambda = DIV_ROUND_UP(rockchip_vpu_vp8_ac_qlookup[qi], 8);
+	quant->filter_level = min_t(u32, qi * 5 / 16, 63);
+}
+
+int rockchip_vpu_vp8_enc_init(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc = &ctx->vp8_enc;
+	struct device *dev = ctx->dev->dev;
+	struct rockchip_vpu_aux_buf *aux;
+	unsigned int i;
+
+	aux = &vp8_enc->prob_tbl;
+	aux->size = ROCKCHIP_VPU_VP8_PROB_TBL_SIZE;
+	aux->cpu = dma_zalloc_coherent(dev, aux->size, &aux->dma, GFP_KERNEL);
+	if (!aux->cpu)
+		return -ENOMEM;
+
+	aux = &vp8_enc->prob_cnt;
+	aux->size = sizeof(struct rockchip_vpu_vp8_enc_counts);
+	aux->cpu = dma_zalloc_coherent(dev, aux->size, &aux->dma, GFP_KERNEL);
+	if (!aux->cpu)
+		goto err_free_prob_tbl;
+
+	/* One word per partition, the first one included. */
+	aux = &vp8_enc->ctrl_buf;
+	aux->size = (RK_VPU_VP8_ENC_MAX_PARTS + 1) * sizeof(u32);
+	aux->cpu = dma_zalloc_coherent(dev, aux->size, &aux->dma, GFP_KERNEL);
+	if (!aux->cpu)
+		goto err_free_prob_cnt;
+
+	/* NV12, never accessed by the CPU. */
+	for (i = 0; i < ARRAY_SIZE(vp8_enc->rec); i++) {
+		aux = &vp8_enc->rec[i];
+		aux->size = rockchip_vpu_rounded_luma_size(ctx->src_fmt.width,
+							   ctx->src_fmt.height);
+		aux->size += aux->size / 2;
+		aux->cpu = dma_alloc_attrs(dev, aux->size, &aux->dma,
+					   GFP_KERNEL,
+					   DMA_ATTR_NO_KERNEL_MAPPING);
+		if (!aux->cpu)
+			goto err_free_rec;
+	}
+
+	memset(&vp8_enc->hdr, 0, sizeof(vp8_enc->hdr));
+	vp8_enc->hdr.prob_skip_false = VP8_PROB_SKIP_FALSE;
+	vp8_enc->hdr.prob_intra = VP8_PROB_INTRA;
+	vp8_enc->hdr.prob_last = VP8_PROB_LAST;
+	vp8_enc->hdr.prob_gf = VP8_PROB_GOLDEN;
+	memset(vp8_enc->hdr.segment_header.segment_probs, 255,
+	       sizeof(vp8_enc->hdr.segment_header.segment_probs));
+	vp8_enc->ref = 0;
+	vp8_enc->frame_num = 0;
+	vp8_enc->counts_valid = false;
+	vp8_enc->force_key = true;
+	return 0;
+
+err_free_rec:
+	while (i--) {
+		aux = &vp8_enc->rec[i];
+		dma_free_attrs(dev, aux->size, aux->cpu, aux->dma,
+			       DMA_ATTR_NO_KERNEL_MAPPING);
+	}
+	aux = &vp8_enc->ctrl_buf;
+	dma_free_coherent(dev, aux->size, aux->cpu, aux->dma);
+err_free_prob_cnt:
+	aux = &vp8_enc->prob_cnt;
+	dma_free_coherent(dev, aux->size, aux->cpu, aux->dma);
+err_free_prob_tbl:
+	aux = &vp8_enc->prob_tbl;
+	dma_free_coherent(dev, aux->size, aux->cpu, aux->dma);
+	return -ENOMEM;
+}
+
+void rockchip_vpu_vp8_enc_exit(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc = &ctx->vp8_enc;
+	struct device *dev = ctx->dev->dev;
+	struct rockchip_vpu_aux_buf *aux;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(vp8_enc->rec); i++) {
+		aux = &vp8_enc->rec[i];
+		dma_free_attrs(dev, aux->size, aux->cpu, aux->dma,
+			       DMA_ATTR_NO_KERNEL_MAPPING);
+		aux->cpu = NULL;
+	}
+	aux = &vp8_enc->ctrl_buf;
+	dma_free_coherent(dev, aux->size, aux->cpu, aux->dma);
+	aux->cpu = NULL;
+	aux = &vp8_enc->prob_cnt;
+	dma_free_coherent(dev, aux->size, aux->cpu, aux->dma);
+	aux->cpu = NULL;
+	aux = &vp8_enc->prob_tbl;
+	dma_free_coherent(dev, aux->size, aux->cpu, aux->dma);
+	aux->cpu = NULL;
+}
+
+/*
+ * Take the controls of the context. Called from
+ * rockchip_vpu_codec_ops.prepare, with the control lock held.
+ */
+void rockchip_vpu_vp8_enc_prepare(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc = &ctx->vp8_enc;
+	s32 *val;
+
+	val = rockchip_vpu_find_control_data(ctx, V4L2_CID_MPEG_VIDEO_GOP_SIZE);
+	vp8_enc->gop_size = *val;
+	val = rockchip_vpu_find_control_data(ctx,
+			V4L2_CID_MPEG_VIDEO_VPX_I_FRAME_QP);
+	vp8_enc->qi_i = *val;
+	val = rockchip_vpu_find_control_data(ctx,
+			V4L2_CID_MPEG_VIDEO_VPX_P_FRAME_QP);
+	vp8_enc->qi_p = *val;
+	val = rockchip_vpu_find_control_data(ctx,
+			V4L2_CID_MPEG_VIDEO_VPX_NUM_PARTITIONS);
+	vp8_enc->num_parts = 1 << *val;
+}
+
+/*
+ * Pick the type of the next frame, and write its uncompressed chunk and
+ * frame header at the beginning of the capture buffer. The first
+ * partition gets the first quarter of the buffer, the DCT partitions
+ * share the rest.
+ */
+int rockchip_vpu_vp8_enc_prepare_run(struct rockchip_vpu_ctx *ctx)
+{
+	struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc = &ctx->vp8_enc;
+	struct rockchip_vpu_vp8_enc_bool bc = {};
+	struct vb2_buffer *dst_buf;
+	unsigned int size, region, len, i;
+	u8 *vaddr;
+
+	dst_buf = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+	vaddr = vb2_plane_vaddr(dst_buf, 0);
+	size = vb2_plane_size(dst_buf, 0);
+	region = round_down(size / 4, 8);
+	if (!vaddr || region < VP8_MAX_HDR_SIZE) {
+		vpu_err("no room for the frame header\n");
+		return -EINVAL;
+	}
+
+	/* Consumed here, so that requests made meanwhile are not lost. */
+	vp8_enc->key = xchg(&vp8_enc->force_key, false) ||
+		       vp8_enc->frame_num >= vp8_enc->gop_size;
+	if (vp8_enc->key) {
+		rockchip_vpu_vp8_enc_reset_entropy(&vp8_enc->hdr.entropy_header);
+		vp8_enc->frame_num = 0;
+	}
+
+	/* The frame tag is only known once the frame is done. */
+	memset(vaddr, 0, VP8_INTER_FRAME_HDR_SIZE);
+	vp8_enc->hdr_size = VP8_INTER_FRAME_HDR_SIZE;
+	if (vp8_enc->key) {
+		vaddr[3] = 0x9d;
+		vaddr[4] = 0x01;
+		vaddr[5] = 0x2a;
+		/* No upscaling. */
+		vaddr[6] = ctx->src_fmt.width & 0xff;
+		vaddr[7] = ctx->src_fmt.width >> 8;
+		vaddr[8] = ctx->src_fmt.height & 0xff;
+		vaddr[9] = ctx->src_fmt.height >> 8;
+		vp8_enc->hdr_size = VP8_KEY_FRAME_HDR_SIZE;
+	}
+
+	bc.buf = vaddr + vp8_enc->hdr_size;
+	bc.size = VP8_MAX_HDR_SIZE - vp8_enc->hdr_size;
+	bc.range = 255;
+	bc.count = -24;
+	rockchip_vpu_vp8_enc_put_hdr(ctx, &bc);
+	if (WARN_ON(bc.overflow))
+		return -EINVAL;
+	rockchip_vpu_vp8_prob_update(vp8_enc->prob_tbl.cpu, &vp8_enc->hdr);
+
+	/*
+	 * The hardware writes from an aligned address: the bytes after
+	 * it go through its registers.
+	 */
+	len = vp8_enc->hdr_size + bc.pos;
+	vp8_enc->base = round_down(len, 8);
+	vp8_enc->rem_size = len - vp8_enc->base;
+	memset(vp8_enc->rem, 0, sizeof(vp8_enc->rem));
+	memcpy(vp8_enc->rem, vaddr + vp8_enc->base, vp8_enc->rem_size);
+	vp8_enc->bool_value = bc.bottom;
+	vp8_enc->bool_bits = 24 + bc.count;
+	vp8_enc->bool_range = bc.range;
+
+	vp8_enc->part_limit = round_down((size - region) / vp8_enc->num_parts,
+					 8);
+	for (i = 0; i < vp8_enc->num_parts; i++)
+		vp8_enc->part_offset[i] = region + i * vp8_enc->part_limit;
+	return 0;
+}
+
+static void rockchip_vpu_vp8_enc_put_le24(u8 *dst, u32 val)
+{
+	dst[0] = val;
+	dst[1] = val >> 8;
+	dst[2] = val >> 16;
+}
+
+/*
+ * Patch the frame tag, and move the DCT partitions after the first one,
+ * with their sizes in between. The reconstructed frame becomes the
+ * reference of the next one, and the token counts the basis of its
+ * probabilities. After a failure, the next frame is a key frame.
+ */
+unsigned int rockchip_vpu_vp8_enc_done(struct rockchip_vpu_ctx *ctx,
+				       unsigned int bytesused,
+				       enum vb2_buffer_state result)
+{
+	struct rockchip_vpu_vp8_enc_hw_ctx *vp8_enc = &ctx->vp8_enc;
+	const u32 *part_size = vp8_enc->ctrl_buf.cpu;
+	struct vb2_v4l2_buffer *dst;
+	unsigned int first, offset, size, i;
+	u8 *vaddr;
+
+	if (result != VB2_BUF_STATE_DONE)
+		goto err_key;
+
+	dst = to_vb2_v4l2_buffer(v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx));
+	vaddr = vb2_plane_vaddr(&dst->vb2_buf, 0);
+
+	first = vp8_enc->base + part_size[0];
+	offset = first + 3 * (vp8_enc->num_parts - 1);
+	if (offset > vp8_enc->part_offset[0])
+		goto err_overflow;
+
+	/* key_frame, version 0, show_frame and first_part_size. */
+	rockchip_vpu_vp8_enc_put_le24(vaddr, !vp8_enc->key | BIT(4) |
+				      (first - vp8_enc->hdr_size) << 5);
+
+	for (i = 0; i < vp8_enc->num_parts; i++) {
+		size = part_size[i + 1];
+		if (size > vp8_enc->part_limit)
+			goto err_overflow;
+		if (i < vp8_enc->num_parts - 1)
+			rockchip_vpu_vp8_enc_put_le24(vaddr + first + 3 * i,
+						      size);
+		memmove(vaddr + offset, vaddr + vp8_enc->part_offset[i], size);
+		offset += size;
+	}
+
+	dst->flags &= ~(V4L2_BUF_FLAG_KEYFRAME | V4L2_BUF_FLAG_PFRAME);
+	if (vp8_enc->key) {
+		dst->flags |= V4L2_BUF_FLAG_KEYFRAME;
+	} else {
+		dst->flags |= V4L2_BUF_FLAG_PFRAME;
+	}
+	vp8_enc->frame_num++;
+	vp8_enc->ref ^= 1;
+	vp8_enc->counts_valid = true;
+
+	return offset;
+
+err_overflow:
+	vpu_err("VP8 partition overflow\n");
+	bytesused = 0;
+err_key:
+	WRITE_ONCE(vp8_enc->force_key, true);
+	vp8_enc->counts_valid = false;
+	return bytesused;
+}
@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rockchip VPU codec driver
+ *
+ * Hardware hang detection.
+ *
+ * Each hardware block has an hrtimer armed when a job is started. The
+ * deadline is derived from the number of macroblocks of the job and
+ * from a moving average of the time the block took per macroblock on
+ * the previous jobs of the same codec mode, so that small frames
+ * recover from a hang within milliseconds while huge frames are not
+ * failed early. When the deadline expires while the hardware still
+ * makes progress (as reported by rockchip_vpu_codec_ops.progress), the
+ * deadline is pushed back instead of failing the job.
+ *
+ * Either the interrupt handler or the timer completes a job, never
+ * both: whoever clears the armed flag first owns the job.
+ */
+
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "rockchip_vpu.h"
+#include "rockchip_vpu_hw.h"
+#include "rockchip_vpu_trace.h"
+
+/* Deadline granted on top of the expected processing time. */
+#define RK_VPU_WATCHDOG_MIN_NS		(10 * NSEC_PER_MSEC)
+/* Factor applied to the expected processing time. */
+#define RK_VPU_WATCHDOG_MARGIN		4
+/*
+ * Initial processing time per macroblock, before anything was measured.
+ * Conservative: a 8192x8192 frame then gets about 8 seconds.
+ */
+#define RK_VPU_WATCHDOG_INIT_NS_PER_MB	8000
+
+static u64 rockchip_vpu_watchdog_timeout(struct rockchip_vpu_watchdog *wd)
+{
+	return (u64)wd->mbs * rockchip_vpu_watchdog_ns_per_mb(wd, wd->mode) *
+	       RK_VPU_WATCHDOG_MARGIN +
+	       RK_VPU_WATCHDOG_MIN_NS;
+}
+
+static u32 rockchip_vpu_watchdog_progress(struct rockchip_vpu_watchdog *wd)
+{
+	struct rockchip_vpu_ctx *ctx = wd->ctx;
+
+	if (!ctx->codec_ops->progress)
+		return 0;
+	return ctx->codec_ops->progress(ctx);
+}
+
+static enum hrtimer_restart rockchip_vpu_watchdog_expired(struct hrtimer *timer)
+{
+	struct rockchip_vpu_watchdog *wd =
+		container_of(timer, struct rockchip_vpu_watchdog, timer);
+	u32 progress;
+
+	if (!atomic_read(&wd->armed))
+		return HRTIMER_NORESTART;
+
+	progress = rockchip_vpu_watchdog_progress(wd);
+	if (progress != wd->progress) {
+		vpu_debug(1, "job still running, progress %u\n", progress);
+		wd->progress = progress;
+		hrtimer_forward_now(timer,
+			ns_to_ktime(rockchip_vpu_watchdog_timeout(wd)));
+		return HRTIMER_RESTART;
+	}
+
+	if (atomic_xchg(&wd->armed, 0))
+		schedule_work(&wd->work);
+	return HRTIMER_NORESTART;
+}
+
+void rockchip_vpu_watchdog_init(struct rockchip_vpu_watchdog *wd,
+				work_func_t recover)
+{
+	unsigned int i;
+
+	hrtimer_init(&wd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	wd->timer.function = rockchip_vpu_watchdog_expired;
+	INIT_WORK(&wd->work, recover);
+	atomic_set(&wd->armed, 0);
+	for (i = 0; i < RK_VPU_MODE_COUNT; i++)
+		wd->ns_per_mb[i] = RK_VPU_WATCHDOG_INIT_NS_PER_MB;
+}
+
+/*
+ * Arm the watchdog for a job of ctx processing mbs macroblocks. Must be
+ * called right before starting the hardware.
+ */
+void rockchip_vpu_watchdog_arm(struct rockchip_vpu_watchdog *wd,
+			       struct rockchip_vpu_ctx *ctx,
+			       unsigned int mbs)
+{
+	trace_rockchip_vpu_programmed(ctx);
+	wd->ctx = ctx;
+	wd->mode = ctx->codec_mode;
+	wd->mbs = max(mbs, 1u);
+	wd->progress = rockchip_vpu_watchdog_progress(wd);
+	wd->start_ns = ktime_get_ns();
+	atomic_set(&wd->armed, 1);
+	hrtimer_start(&wd->timer,
+		      ns_to_ktime(rockchip_vpu_watchdog_timeout(wd)),
+		      HRTIMER_MODE_REL);
+}
+
+/*
+ * Called from the hard interrupt handler when the hardware reports the
+ * end of a job. Returns false if the timer already took over the job.
+ */
+bool rockchip_vpu_watchdog_disarm(struct rockchip_vpu_watchdog *wd,
+				  bool done)
+{
+	u64 ns_per_mb;
+
+	if (!atomic_xchg(&wd->armed, 0))
+		return false;
+	hrtimer_try_to_cancel(&wd->timer);
+	wd->end_ns = ktime_get_ns();
+
+	/* Only successful jobs tell anything about the throughput. */
+	if (done) {
+		ns_per_mb = div_u64(wd->end_ns - wd->start_ns, wd->mbs);
+		ns_per_mb += 3 * rockchip_vpu_watchdog_ns_per_mb(wd, wd->mode);
+		WRITE_ONCE(wd->ns_per_mb[wd->mode], ns_per_mb / 4);
+	}
+	return true;
+}
+
+/*
+ * Wait for a concurrently running timer callback. Must be called from
+ * process context before the job is completed, so that the callback
+ * never looks at a finished job.
+ */
+void rockchip_vpu_watchdog_sync(struct rockchip_vpu_watchdog *wd)
+{
+	hrtimer_cancel(&wd->timer);
+}
+
+/*
+ * Fail the job of ctx without starting the hardware, when it cannot be
+ * programmed. The job is completed in error by the recovery work.
+ */
+void rockchip_vpu_watchdog_fail(struct rockchip_vpu_watchdog *wd,
+				struct rockchip_vpu_ctx *ctx)
+{
+	wd->ctx = ctx;
+	wd->mode = ctx->codec_mode;
+	wd->mbs = 1;
+	wd->start_ns = ktime_get_ns();
+	atomic_set(&wd->armed, 0);
+	schedule_work(&wd->work);
+}
+
+void rockchip_vpu_watchdog_stop(struct rockchip_vpu_watchdog *wd)
+{
+	atomic_set(&wd->armed, 0);
+	hrtimer_cancel(&wd->timer);
+	cancel_work_sync(&wd->work);
+}